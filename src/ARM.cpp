@@ -133,6 +133,9 @@ void ARM::Reset()
     FastBlockLookup = NULL;
     FastBlockLookupStart = 0;
     FastBlockLookupSize = 0;
+    LinkSite = 0;
+    LinkHits = 0;
+    SlowMemAccesses = 0;
 #endif
 
     // zorp
@@ -679,6 +682,7 @@ void ARMv5::ExecuteJIT()
             && !ARMJIT::SetupExecutableRegion(0, instrAddr, FastBlockLookup, FastBlockLookupStart, FastBlockLookupSize))
         {
             NDS::ARM9Timestamp = NDS::ARM9Target;
+            LinkSite = 0;
             printf("ARMv5 PC in non executable region %08X\n", R[15]);
             return;
         }
@@ -686,12 +690,23 @@ void ARMv5::ExecuteJIT()
         ARMJIT::JitBlockEntry block = ARMJIT::LookUpBlock(0, FastBlockLookup,
             instrAddr - FastBlockLookupStart, instrAddr);
         if (block)
+        {
+            if (LinkSite)
+                ARMJIT::LinkBlock(this, instrAddr);
             ARM_Dispatch(this, block);
+        }
         else
             ARMJIT::CompileBlock(this);
 
         if (StopExecution)
         {
+            // the block returned before doing anything
+            if (HotBlock)
+            {
+                HotBlock = 0;
+                ARMJIT::RecompileHotBlock(this);
+            }
+
             // this order is crucial otherwise idle loops waiting for an IRQ won't function
             if (IRQ)
                 TriggerIRQ();
@@ -830,6 +845,7 @@ void ARMv4::ExecuteJIT()
             && !ARMJIT::SetupExecutableRegion(1, instrAddr, FastBlockLookup, FastBlockLookupStart, FastBlockLookupSize))
         {
             NDS::ARM7Timestamp = NDS::ARM7Target;
+            LinkSite = 0;
             printf("ARMv4 PC in non executable region %08X\n", R[15]);
             return;
         }
@@ -837,12 +853,23 @@ void ARMv4::ExecuteJIT()
         ARMJIT::JitBlockEntry block = ARMJIT::LookUpBlock(1, FastBlockLookup,
             instrAddr - FastBlockLookupStart, instrAddr);
         if (block)
+        {
+            if (LinkSite)
+                ARMJIT::LinkBlock(this, instrAddr);
             ARM_Dispatch(this, block);
+        }
         else
             ARMJIT::CompileBlock(this);
 
         if (StopExecution)
         {
+            // the block returned before doing anything
+            if (HotBlock)
+            {
+                HotBlock = 0;
+                ARMJIT::RecompileHotBlock(this);
+            }
+
             if (IRQ)
                 TriggerIRQ();
 
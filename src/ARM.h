@@ -109,10 +109,12 @@ public:
     virtual void DataWrite32(u32 addr, u32 val) = 0;
     virtual void DataWrite32S(u32 addr, u32 val) = 0;
 
-    virtual void AddCycles_C() = 0;
-    virtual void AddCycles_CI(s32 numI) = 0;
-    virtual void AddCycles_CDI() = 0;
-    virtual void AddCycles_CD() = 0;
+    // called once or more per interpreted instruction, so these pick the
+    // implementation by Num instead of going through the vtable
+    inline void AddCycles_C();
+    inline void AddCycles_CI(s32 numI);
+    inline void AddCycles_CDI();
+    inline void AddCycles_CD();
 
 
     u32 Num;
@@ -125,6 +127,7 @@ public:
             u8 Halted;
             u8 IRQ; // nonzero to trigger IRQ
             u8 IdleLoop;
+            u8 HotBlock; // set by a JIT block which wants to be compiled again
         };
         u32 StopExecution;
     };
@@ -152,6 +155,14 @@ public:
 #ifdef JIT_ENABLED
     u32 FastBlockLookupStart, FastBlockLookupSize;
     u64* FastBlockLookup;
+
+    // code offset of the block exit which last returned to the dispatcher,
+    // if it can be linked to the block executed next
+    u32 LinkSite;
+    // how often a block was entered through a link
+    u64 LinkHits;
+    // how many memory accesses of JIT code took the slow path
+    u64 SlowMemAccesses;
 #endif
 
     static u32 ConditionTable[16];
@@ -460,6 +471,30 @@ public:
     }
 };
 
+void ARM::AddCycles_C()
+{
+    if (Num == 0) ((ARMv5*)this)->ARMv5::AddCycles_C();
+    else          ((ARMv4*)this)->ARMv4::AddCycles_C();
+}
+
+void ARM::AddCycles_CI(s32 numI)
+{
+    if (Num == 0) ((ARMv5*)this)->ARMv5::AddCycles_CI(numI);
+    else          ((ARMv4*)this)->ARMv4::AddCycles_CI(numI);
+}
+
+void ARM::AddCycles_CDI()
+{
+    if (Num == 0) ((ARMv5*)this)->ARMv5::AddCycles_CDI();
+    else          ((ARMv4*)this)->ARMv4::AddCycles_CDI();
+}
+
+void ARM::AddCycles_CD()
+{
+    if (Num == 0) ((ARMv5*)this)->ARMv5::AddCycles_CD();
+    else          ((ARMv4*)this)->ARMv4::AddCycles_CD();
+}
+
 namespace ARMInterpreter
 {
 
@@ -18,9 +18,13 @@
 
 #include "ARMJIT.h"
 
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
-#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <vector>
 
 #define XXH_STATIC_LINKING_ONLY
 #include "xxhash/xxhash.h"
@@ -61,12 +65,219 @@ int MaxBlockSize;
 bool LiteralOptimizations;
 bool BranchOptimizations;
 bool FastMemory;
+int CodeMemorySize;
 
+u32 SegmentsEvicted;
+u32 BlocksEvicted;
 
-std::unordered_map<u32, JitBlock*> JitBlocks9;
-std::unordered_map<u32, JitBlock*> JitBlocks7;
+// longer blocks mostly save dispatching, which doesn't matter much for cold code
+const int MaxTier0BlockSize = 8;
+u16 HotCounters[HotCountersSize];
 
-std::unordered_map<u32, JitBlock*> RestoreCandidates;
+
+const u32 BlockChunkSize = 1024;
+std::vector<JitBlock*> BlockChunks;
+std::vector<u32> FreeBlocks;
+u32 NumActiveBlocks;
+
+u32* BlockData;
+std::vector<u32> BlockDataStorage;
+std::vector<u32> FreeBlockData[32 * 3 + 1];
+
+// direct mapped by the instruction hash, the buckets are chained through JitBlock::Next
+std::vector<u32> RestoreCandidates;
+u32 NumRestoreCandidates;
+
+struct BlockLink
+{
+    u32 Site;
+    u32 Unlinked;
+    // next link to the same block
+    u32 Next;
+};
+
+std::vector<BlockLink> BlockLinks;
+std::vector<u32> FreeBlockLinks;
+
+std::string BlockCacheFile;
+
+void SaveBlockCache();
+void LoadBlockCache();
+
+/*
+    Background compilation
+
+    Blocks are always traced on the emulation thread, which runs them through
+    the interpreter for the first time. With BackgroundCompile their code is then
+    emitted by another thread, until it's done the block is pending and whenever
+    it's reached it's only interpreted again. Once the emulation thread picks up
+    the finished code the block is made active, unless it was invalidated in the
+    meantime.
+
+    The compilation thread holds CompilerLock while it compiles a block, the
+    emulation thread takes it too when it modifies the code memory itself.
+    When the current code segment is full, the compilation thread stops and
+    leaves it to the emulation thread to make room.
+*/
+struct CompileJob
+{
+    u32 Block;
+    ARM* CPU;
+    bool Thumb;
+    bool HasMemoryInstr;
+    int NumInstrs;
+    u16* HotCounter;
+    FetchedInstr Instrs[32];
+};
+
+struct CompiledBlock
+{
+    u32 Block;
+    JitBlockEntry EntryPoint;
+};
+
+bool BackgroundCompile;
+
+Platform::Thread* CompileThread;
+Platform::Semaphore* CompileThreadWake;
+Platform::Mutex* CompilerLock;
+// for everything below
+Platform::Mutex* CompileJobsLock;
+bool CompileThreadRunning;
+std::deque<CompileJob> CompileJobs;
+std::vector<CompiledBlock> CompiledBlocks;
+
+std::atomic<u32> NumCompiledBlocks;
+std::vector<CompiledBlock> PublishedBlocks;
+std::atomic<bool> CodeSegmentFull;
+
+JitBlockEntry CompileJobCode(CompileJob& job)
+{
+    JitEnableWrite();
+    JitBlockEntry entry = JITCompiler->CompileBlock(job.CPU, job.Thumb, job.Instrs, job.NumInstrs, job.HasMemoryInstr, job.HotCounter);
+    JitEnableExecute();
+    return entry;
+}
+
+void CompileThreadFunc()
+{
+    for (;;)
+    {
+        Platform::Semaphore_Wait(CompileThreadWake);
+
+        for (;;)
+        {
+            Platform::Mutex_Lock(CompilerLock);
+            Platform::Mutex_Lock(CompileJobsLock);
+            if (!CompileThreadRunning)
+            {
+                Platform::Mutex_Unlock(CompileJobsLock);
+                Platform::Mutex_Unlock(CompilerLock);
+                return;
+            }
+            if (CompileJobs.empty() || JITCompiler->IsFull())
+            {
+                // we're woken up again once there's space
+                if (!CompileJobs.empty())
+                    CodeSegmentFull = true;
+                Platform::Mutex_Unlock(CompileJobsLock);
+                Platform::Mutex_Unlock(CompilerLock);
+                break;
+            }
+            // the jobs are only removed from the queue while holding CompilerLock
+            CompileJob& job = CompileJobs.front();
+            Platform::Mutex_Unlock(CompileJobsLock);
+
+            JitBlockEntry entry = CompileJobCode(job);
+
+            Platform::Mutex_Lock(CompileJobsLock);
+            CompiledBlocks.push_back({job.Block, entry});
+            NumCompiledBlocks++;
+            CompileJobs.pop_front();
+            Platform::Mutex_Unlock(CompileJobsLock);
+            Platform::Mutex_Unlock(CompilerLock);
+        }
+    }
+}
+
+void StartCompileThread()
+{
+    CompileThreadWake = Platform::Semaphore_Create();
+    CompilerLock = Platform::Mutex_Create();
+    CompileJobsLock = Platform::Mutex_Create();
+
+    CompileThreadRunning = true;
+    CompileThread = Platform::Thread_Create(CompileThreadFunc);
+}
+
+void StopCompileThread()
+{
+    if (!CompileThread)
+        return;
+
+    Platform::Mutex_Lock(CompileJobsLock);
+    CompileThreadRunning = false;
+    Platform::Mutex_Unlock(CompileJobsLock);
+    Platform::Semaphore_Post(CompileThreadWake);
+
+    Platform::Thread_Wait(CompileThread);
+    Platform::Thread_Free(CompileThread);
+    CompileThread = NULL;
+
+    // the blocks which were still pending are freed by ResetBlockCache
+    CompileJobs.clear();
+    CompiledBlocks.clear();
+    NumCompiledBlocks = 0;
+    CodeSegmentFull = false;
+
+    Platform::Semaphore_Free(CompileThreadWake);
+    Platform::Mutex_Free(CompilerLock);
+    Platform::Mutex_Free(CompileJobsLock);
+}
+
+void LockCompiler()
+{
+    if (CompileThread)
+        Platform::Mutex_Lock(CompilerLock);
+}
+
+void UnlockCompiler()
+{
+    if (CompileThread)
+        Platform::Mutex_Unlock(CompilerLock);
+}
+
+void QueueCompileJob(JitBlock* block, ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, bool hasMemoryInstr, u16* hotCounter)
+{
+    Platform::Mutex_Lock(CompileJobsLock);
+    CompileJob& job = CompileJobs.emplace_back();
+    job.Block = block->Index;
+    job.CPU = cpu;
+    job.Thumb = thumb;
+    job.HasMemoryInstr = hasMemoryInstr;
+    job.NumInstrs = instrsCount;
+    job.HotCounter = hotCounter;
+    memcpy(job.Instrs, instrs, instrsCount * sizeof(FetchedInstr));
+    Platform::Mutex_Unlock(CompileJobsLock);
+
+    Platform::Semaphore_Post(CompileThreadWake);
+}
+
+// what's queued is dropped, what's being compiled right now is waited for
+void CancelCompileJobs()
+{
+    if (!CompileThread)
+        return;
+
+    Platform::Mutex_Lock(CompilerLock);
+    Platform::Mutex_Lock(CompileJobsLock);
+    CompileJobs.clear();
+    CompiledBlocks.clear();
+    NumCompiledBlocks = 0;
+    CodeSegmentFull = false;
+    Platform::Mutex_Unlock(CompileJobsLock);
+    Platform::Mutex_Unlock(CompilerLock);
+}
 
 TinyVector<u32> InvalidLiterals;
 
@@ -84,6 +295,22 @@ AddressRange CodeIndexNWRAM_A[DSi::NWRAMSize / 512];
 AddressRange CodeIndexNWRAM_B[DSi::NWRAMSize / 512];
 AddressRange CodeIndexNWRAM_C[DSi::NWRAMSize / 512];
 
+// first block starting in each 16 byte unit of code memory, the others
+// starting there are chained through JitBlock::Next
+u32 BlockIndexITCM[ITCMPhysicalSize / 16];
+u32 BlockIndexMainRAM[NDS::MainRAMMaxSize / 16];
+u32 BlockIndexSWRAM[NDS::SharedWRAMSize / 16];
+u32 BlockIndexVRAM[0x100000 / 16];
+u32 BlockIndexARM9BIOS[sizeof(NDS::ARM9BIOS) / 16];
+u32 BlockIndexARM7BIOS[sizeof(NDS::ARM7BIOS) / 16];
+u32 BlockIndexARM7WRAM[NDS::ARM7WRAMSize / 16];
+u32 BlockIndexARM7WVRAM[0x40000 / 16];
+u32 BlockIndexBIOS9DSi[0x10000 / 16];
+u32 BlockIndexBIOS7DSi[0x10000 / 16];
+u32 BlockIndexNWRAM_A[DSi::NWRAMSize / 16];
+u32 BlockIndexNWRAM_B[DSi::NWRAMSize / 16];
+u32 BlockIndexNWRAM_C[DSi::NWRAMSize / 16];
+
 u64 FastBlockLookupITCM[ITCMPhysicalSize / 2];
 u64 FastBlockLookupMainRAM[NDS::MainRAMMaxSize / 2];
 u64 FastBlockLookupSWRAM[NDS::SharedWRAMSize / 2];
@@ -142,6 +369,28 @@ AddressRange* const CodeMemRegions[ARMJIT_Memory::memregions_Count] =
     CodeIndexNWRAM_C
 };
 
+u32* const BlockIndexRegions[ARMJIT_Memory::memregions_Count] =
+{
+    NULL,
+    BlockIndexITCM,
+    NULL,
+    BlockIndexARM9BIOS,
+    BlockIndexMainRAM,
+    BlockIndexSWRAM,
+    NULL,
+    BlockIndexVRAM,
+    BlockIndexARM7BIOS,
+    BlockIndexARM7WRAM,
+    NULL,
+    NULL,
+    BlockIndexARM7WVRAM,
+    BlockIndexBIOS9DSi,
+    BlockIndexBIOS7DSi,
+    BlockIndexNWRAM_A,
+    BlockIndexNWRAM_B,
+    BlockIndexNWRAM_C
+};
+
 u64* const FastBlockLookupRegions[ARMJIT_Memory::memregions_Count] =
 {
     NULL,
@@ -178,6 +427,8 @@ u32 LocaliseCodeAddress(u32 num, u32 addr)
 template <typename T, int ConsoleType>
 T SlowRead9(u32 addr, ARMv5* cpu)
 {
+    cpu->SlowMemAccesses++;
+
     u32 offset = addr & 0x3;
     addr &= ~(sizeof(T) - 1);
 
@@ -202,6 +453,8 @@ T SlowRead9(u32 addr, ARMv5* cpu)
 template <typename T, int ConsoleType>
 void SlowWrite9(u32 addr, ARMv5* cpu, u32 val)
 {
+    cpu->SlowMemAccesses++;
+
     addr &= ~(sizeof(T) - 1);
 
     if (addr < cpu->ITCMSize)
@@ -230,6 +483,8 @@ void SlowWrite9(u32 addr, ARMv5* cpu, u32 val)
 template <typename T, int ConsoleType>
 T SlowRead7(u32 addr)
 {
+    NDS::ARM7->SlowMemAccesses++;
+
     u32 offset = addr & 0x3;
     addr &= ~(sizeof(T) - 1);
 
@@ -250,6 +505,8 @@ T SlowRead7(u32 addr)
 template <typename T, int ConsoleType>
 void SlowWrite7(u32 addr, u32 val)
 {
+    NDS::ARM7->SlowMemAccesses++;
+
     addr &= ~(sizeof(T) - 1);
 
     if (std::is_same<T, u32>::value)
@@ -322,29 +579,59 @@ void Init()
 
 void DeInit()
 {
+    SaveBlockCache();
+    StopCompileThread();
+
     JitEnableWrite();
     ResetBlockCache();
     ARMJIT_Memory::DeInit();
 
+    for (JitBlock* chunk : BlockChunks)
+        delete[] chunk;
+    BlockChunks.clear();
+    FreeBlocks.clear();
+
     delete JITCompiler;
 }
 
 void Reset()
 {
+    // the settings are part of the cache key, so save before they change
+    SaveBlockCache();
+    StopCompileThread();
+
     MaxBlockSize = Platform::GetConfigInt(Platform::JIT_MaxBlockSize);
     LiteralOptimizations = Platform::GetConfigBool(Platform::JIT_LiteralOptimizations);
     BranchOptimizations = Platform::GetConfigBool(Platform::JIT_BranchOptimizations);
     FastMemory = Platform::GetConfigBool(Platform::JIT_FastMemory);
+    BackgroundCompile = Platform::GetConfigBool(Platform::JIT_BackgroundCompile);
+    CodeMemorySize = Platform::GetConfigInt(Platform::JIT_CodeMemorySize);
 
     if (MaxBlockSize < 1)
         MaxBlockSize = 1;
     if (MaxBlockSize > 32)
         MaxBlockSize = 32;
 
+    // in MB, the backend limits it further to what it has
+    if (CodeMemorySize < 4)
+        CodeMemorySize = 4;
+    if (CodeMemorySize > 256)
+        CodeMemorySize = 256;
+
+    SegmentsEvicted = 0;
+    BlocksEvicted = 0;
+
     JitEnableWrite();
     ResetBlockCache();
+    JITCompiler->SetCodeMemorySize(CodeMemorySize * 1024 * 1024);
 
     ARMJIT_Memory::Reset();
+
+    LoadBlockCache();
+    JitEnableExecute();
+
+    if (BackgroundCompile)
+        StartCompileThread();
 }
 
 void FloodFillSetFlags(FetchedInstr instrs[], int start, u8 flags)
@@ -453,6 +740,273 @@ bool DecodeBranch(bool thumb, const FetchedInstr& instr, u32& cond, bool hasLink
     return false;
 }
 
+// the target (including the thumb bit) of a branch compiled with Comp_JumpTo(u32)
+bool DecodeStaticJump(bool thumb, u32 num, const FetchedInstr& instr, u32& targetAddr)
+{
+    if (thumb)
+    {
+        switch (instr.Info.Kind)
+        {
+        case ARMInstrInfo::tk_BCOND:
+            targetAddr = instr.Addr + 4 + ((s32)(instr.Instr << 24) >> 23) + 1;
+            return true;
+        case ARMInstrInfo::tk_B:
+            targetAddr = instr.Addr + 4 + ((s32)((instr.Instr & 0x7FF) << 21) >> 20) + 1;
+            return true;
+        case ARMInstrInfo::tk_BL_LONG:
+            targetAddr = instr.Addr + 4 + ((s32)((instr.Instr & 0x7FF) << 21) >> 9);
+            targetAddr += ((instr.Instr >> 16) & 0x7FF) << 1;
+            if (num == 1 || instr.Instr & (1 << 28))
+                targetAddr |= 1;
+            return true;
+        default:
+            return false;
+        }
+    }
+    else
+    {
+        switch (instr.Info.Kind)
+        {
+        case ARMInstrInfo::ak_B:
+        case ARMInstrInfo::ak_BL:
+        case ARMInstrInfo::ak_BLX_IMM:
+            targetAddr = instr.Addr + 8 + ((s32)(instr.Instr << 8) >> 6);
+            if (instr.Cond() == 0xF)
+                targetAddr += (((instr.Instr >> 24) & 1) << 1) + 1;
+            return true;
+        default:
+            return false;
+        }
+    }
+}
+
+// when the code in each 128 byte chunk was last written to, counted in writes
+// to code. finer than the code pages, so that data next to code doesn't count.
+// chunks share their serial on collision
+const u32 CodeWriteSerialsSize = 0x4000;
+u64 CodeWriteSerials[CodeWriteSerialsSize];
+u64 CodeWriteSerial = 1;
+
+u16 CodeWriteChunkIndex(u32 localAddr)
+{
+    u32 chunk = localAddr >> 7;
+    return (chunk ^ (chunk >> 14)) & (CodeWriteSerialsSize - 1);
+}
+
+// whether code in the same code page was written to lately
+bool CodeRecentlyModified(u32 localAddr)
+{
+    for (u32 chunk = localAddr & ~0x1FF; chunk < (localAddr & ~0x1FF) + 512; chunk += 128)
+    {
+        u64 serial = CodeWriteSerials[CodeWriteChunkIndex(chunk)];
+        if (serial && CodeWriteSerial - serial < 0x400)
+            return true;
+    }
+    return false;
+}
+
+// the instruction word as it ends up in the pipeline once R15 points to it
+u32 FetchCodeWord(ARM* cpu, u32 addr, bool thumb)
+{
+    u32 r15 = cpu->R[15];
+    s32 codeCycles = cpu->CodeCycles;
+
+    u32 val;
+    if (cpu->Num == 0)
+    {
+        ARMv5* cpuv5 = (ARMv5*)cpu;
+        // the first halfword is taken out of the previous fetch
+        u32 fetchAddr = thumb ? (addr & ~0x2) : addr;
+        cpu->R[15] = fetchAddr;
+        val = cpuv5->CodeRead32(fetchAddr, false);
+        if (addr & 0x2)
+            val >>= 16;
+    }
+    else
+    {
+        ARMv4* cpuv4 = (ARMv4*)cpu;
+        // R15 matters for the BIOS protection
+        cpu->R[15] = addr;
+        val = thumb ? cpuv4->CodeRead16(addr) : cpuv4->CodeRead32(addr);
+    }
+
+    cpu->R[15] = r15;
+    cpu->CodeCycles = codeCycles;
+    return val;
+}
+
+const u32 SuccessorScanSize = 8;
+
+// the addresses execution might continue at after the block, | 1 for THUMB
+int DecodeStaticSuccessors(bool thumb, u32 num, FetchedInstr instrs[], int instrsCount, u32 addrs[2])
+{
+    const FetchedInstr& last = instrs[instrsCount - 1];
+    u32 next = (last.Addr + (thumb ? 2 : 4)) | thumb;
+    if (!last.Info.Branches())
+    {
+        addrs[0] = next;
+        return 1;
+    }
+    if (last.BranchFlags & (branch_FollowCondTaken | branch_FollowCondNotTaken))
+        return 0;
+    if (!DecodeStaticJump(thumb, num, last, addrs[0]))
+        return 0;
+    // BLX from THUMB aligns the target
+    if (!(addrs[0] & 0x1))
+        addrs[0] &= ~0x3;
+    if (thumb ? last.Info.Kind != ARMInstrInfo::tk_BCOND : last.Cond() >= 0xE)
+        return 1;
+    addrs[1] = next;
+    return 2;
+}
+
+// code there is only changed by writing to it, so whatever was read
+// from it stays true as long as the block is invalidated on writes
+bool IsFixedCodeMemory(u32 addr, u32 localAddr)
+{
+    switch (localAddr >> 27)
+    {
+    case ARMJIT_Memory::memregion_MainRAM:
+    case ARMJIT_Memory::memregion_BIOS9:
+    case ARMJIT_Memory::memregion_BIOS7:
+        return true;
+    case ARMJIT_Memory::memregion_WRAM7:
+        // below it's a mirror as long as no shared WRAM is mapped
+        return addr >= 0x03800000;
+    default:
+        return false;
+    }
+}
+
+// instructions which work on more of the state than their info says
+bool ReadsWholeState(bool thumb, const ARMInstrInfo::Info& info, u32 instr)
+{
+    if (thumb)
+        return info.Kind == ARMInstrInfo::tk_SVC || info.Kind == ARMInstrInfo::tk_UNK;
+
+    switch (info.Kind)
+    {
+    case ARMInstrInfo::ak_MSR_IMM:
+    case ARMInstrInfo::ak_MSR_REG:
+    case ARMInstrInfo::ak_MRS:
+    case ARMInstrInfo::ak_MCR:
+    case ARMInstrInfo::ak_MRC:
+    case ARMInstrInfo::ak_SVC:
+    case ARMInstrInfo::ak_UNK:
+        return true;
+    case ARMInstrInfo::ak_LDM:
+    case ARMInstrInfo::ak_STM:
+        // accessing the user mode registers
+        return instr & (1 << 22);
+    default:
+        return false;
+    }
+}
+
+/*
+    The registers and flags the code at a block's successor might read before
+    setting them itself. Only the instructions which are certain to run after
+    each other are looked at, none past the end of their code page.
+    Everything else is assumed to be needed.
+*/
+u32 ScanSuccessor(ARM* cpu, u32 addr, bool thumb, u16& liveRegs, u8& liveFlags, u32 words[])
+{
+    u32 instrSize = thumb ? 2 : 4;
+    u16 writtenRegs = 0;
+    u8 writtenFlags = 0;
+    liveRegs = 0;
+    liveFlags = 0;
+
+    u32 numWords = 0;
+    while (numWords < SuccessorScanSize)
+    {
+        u32 instrAddr = addr + numWords * instrSize;
+        if (numWords > 0 && !(instrAddr & 0x1FF))
+            break;
+
+        u32 instr = FetchCodeWord(cpu, instrAddr, thumb);
+        words[numWords++] = instr;
+
+        ARMInstrInfo::Info info = ARMInstrInfo::Decode(thumb, cpu->Num, instr);
+        if (ReadsWholeState(thumb, info, instr))
+            break;
+
+        liveRegs |= info.SrcRegs & ~writtenRegs;
+        liveFlags |= info.ReadFlags & ~writtenFlags;
+        // conditional instructions might not overwrite anything
+        if (thumb || (instr >> 28) == 0xE)
+            writtenRegs |= info.DstRegs;
+        writtenFlags |= info.WriteFlags & 0xF;
+
+        if (info.EndBlock || ((writtenRegs | liveRegs) == 0xFFFF && (writtenFlags | liveFlags) == 0xF))
+            break;
+    }
+
+    liveRegs |= ~writtenRegs;
+    liveFlags |= ~writtenFlags & 0xF;
+    return numWords;
+}
+
+// the cycles it takes to fetch the first instructions at the target
+void LookUpJumpCycles(ARM* cpu, FetchedInstr& instr, u32 addr)
+{
+    u32 cycles = 0;
+
+    if (cpu->Num == 0)
+    {
+        ARMv5* cpu9 = (ARMv5*)cpu;
+
+        u32 regionCodeCycles = cpu9->MemTimings[addr >> 12][0];
+        u32 curRegionCodeCycles = cpu9->RegionCodeCycles;
+        u32 curCodeCycles = cpu9->CodeCycles;
+        cpu9->RegionCodeCycles = regionCodeCycles;
+
+        if (addr & 0x1)
+        {
+            addr &= ~0x1;
+
+            // two-opcodes-at-once fetch
+            if (addr & 0x2)
+            {
+                cpu9->CodeRead32(addr-2, true);
+                cycles += cpu9->CodeCycles;
+                cpu9->CodeRead32(addr+2, false);
+                cycles += cpu9->CodeCycles;
+            }
+            else
+            {
+                cpu9->CodeRead32(addr, true);
+                cycles += cpu9->CodeCycles;
+            }
+        }
+        else
+        {
+            addr &= ~0x3;
+
+            cpu9->CodeRead32(addr, true);
+            cycles += cpu9->CodeCycles;
+            cpu9->CodeRead32(addr+4, false);
+            cycles += cpu9->CodeCycles;
+        }
+
+        cpu9->RegionCodeCycles = curRegionCodeCycles;
+        cpu9->CodeCycles = curCodeCycles;
+
+        instr.BranchRegionCodeCycles = regionCodeCycles;
+    }
+    else
+    {
+        u32 codeCycles = addr >> 15; // cheato
+
+        if (addr & 0x1)
+            cycles += NDS::ARM7MemTimings[codeCycles][0] + NDS::ARM7MemTimings[codeCycles][1];
+        else
+            cycles += NDS::ARM7MemTimings[codeCycles][2] + NDS::ARM7MemTimings[codeCycles][3];
+    }
+
+    instr.BranchCycles = cycles;
+}
+
 bool IsIdleLoop(bool thumb, FetchedInstr* instrs, int instrsCount)
 {
     // see https://github.com/dolphin-emu/dolphin/blob/master/Source/Core/Core/PowerPC/PPCAnalyst.cpp#L678
@@ -571,24 +1125,439 @@ InterpreterFunc InterpretTHUMB[ARMInstrInfo::tk_Count] =
 };
 #undef F
 
+JitBlock* GetBlock(u32 index)
+{
+    index--;
+    return &BlockChunks[index / BlockChunkSize][index % BlockChunkSize];
+}
+
+JitBlock* AllocBlock(u32 num, u32 numAddresses, u32 numLiterals)
+{
+    if (FreeBlocks.empty())
+    {
+        u32 base = BlockChunks.size() * BlockChunkSize;
+        BlockChunks.push_back(new JitBlock[BlockChunkSize]);
+
+        for (u32 i = BlockChunkSize; i > 0; i--)
+        {
+            JitBlock* block = &BlockChunks.back()[i - 1];
+            block->Index = base + i;
+            block->Status = blockStatus_Free;
+            FreeBlocks.push_back(base + i);
+        }
+    }
+
+    JitBlock* block = GetBlock(FreeBlocks.back());
+    FreeBlocks.pop_back();
+
+    u32 dataSize = numAddresses * 2 + numLiterals;
+    if (!FreeBlockData[dataSize].empty())
+    {
+        block->DataOffset = FreeBlockData[dataSize].back();
+        FreeBlockData[dataSize].pop_back();
+    }
+    else
+    {
+        block->DataOffset = BlockDataStorage.size();
+        BlockDataStorage.resize(BlockDataStorage.size() + dataSize);
+        BlockData = BlockDataStorage.data();
+    }
+
+    block->Num = num;
+    block->NumAddresses = numAddresses;
+    block->NumLiterals = numLiterals;
+    block->Next = 0;
+    block->Links = 0;
+    block->Status = blockStatus_Active;
+    return block;
+}
+
+void FreeBlock(JitBlock* block)
+{
+    FreeBlockData[block->NumAddresses * 2 + block->NumLiterals].push_back(block->DataOffset);
+    FreeBlocks.push_back(block->Index);
+    block->Status = blockStatus_Free;
+}
+
+void FreeAllBlocks()
+{
+    FreeBlocks.clear();
+    for (u32 i = BlockChunks.size() * BlockChunkSize; i > 0; i--)
+    {
+        GetBlock(i)->Status = blockStatus_Free;
+        FreeBlocks.push_back(i);
+    }
+
+    BlockDataStorage.clear();
+    BlockData = BlockDataStorage.data();
+    for (std::vector<u32>& freeData : FreeBlockData)
+        freeData.clear();
+
+    RestoreCandidates.clear();
+    NumRestoreCandidates = 0;
+    NumActiveBlocks = 0;
+
+    BlockLinks.clear();
+    FreeBlockLinks.clear();
+}
+
+u32* BlockIndexBucket(u32 localAddr)
+{
+    return &BlockIndexRegions[localAddr >> 27][(localAddr & 0x7FFFFFF) / 16];
+}
+
+JitBlock* FindBlock(u32 num, u32 blockAddr, u32 localAddr)
+{
+    for (u32 i = *BlockIndexBucket(localAddr); i;)
+    {
+        JitBlock* block = GetBlock(i);
+        if (block->StartAddrLocal == localAddr && block->StartAddr == blockAddr && block->Num == num)
+            return block;
+        i = block->Next;
+    }
+    return NULL;
+}
+
+void AddToBlockIndex(JitBlock* block)
+{
+    u32* bucket = BlockIndexBucket(block->StartAddrLocal);
+    block->Next = *bucket;
+    *bucket = block->Index;
+    NumActiveBlocks++;
+}
+
+void RemoveFromBlockIndex(JitBlock* block)
+{
+    u32* link = BlockIndexBucket(block->StartAddrLocal);
+    while (*link != block->Index)
+        link = &GetBlock(*link)->Next;
+
+    *link = block->Next;
+    block->Next = 0;
+    NumActiveBlocks--;
+}
+
+bool CanLinkTo(u32 num, u32 addr)
+{
+    // VRAM can be remapped without the blocks noticing
+    u32 localAddr = LocaliseCodeAddress(num, addr);
+    return localAddr
+        && (localAddr >> 27) != ARMJIT_Memory::memregion_VRAM
+        && (localAddr >> 27) != ARMJIT_Memory::memregion_VWRAM;
+}
+
+void LinkBlock(ARM* cpu, u32 addr)
+{
+    u32 site = cpu->LinkSite;
+    cpu->LinkSite = 0;
+
+    if (!CanLinkTo(cpu->Num, addr))
+        return;
+    JitBlock* block = FindBlock(cpu->Num, addr, LocaliseCodeAddress(cpu->Num, addr));
+    if (!block || block->Status != blockStatus_Active)
+        return;
+    // rather than waiting for the compilation thread it's linked another time
+    if (CompileThread && !Platform::Mutex_TryLock(CompilerLock))
+        return;
+
+    u32 link;
+    if (FreeBlockLinks.empty())
+    {
+        BlockLinks.emplace_back();
+        link = BlockLinks.size();
+    }
+    else
+    {
+        link = FreeBlockLinks.back();
+        FreeBlockLinks.pop_back();
+    }
+
+    JitEnableWrite();
+    BlockLinks[link - 1].Site = site;
+    BlockLinks[link - 1].Unlinked = JITCompiler->LinkExit(site, block->EntryPoint);
+    JitEnableExecute();
+    UnlockCompiler();
+
+    BlockLinks[link - 1].Next = block->Links;
+    block->Links = link;
+}
+
+// the compiler needs to be locked
+void UnlinkExitsTo(JitBlock* block)
+{
+    for (u32 i = block->Links; i;)
+    {
+        BlockLink& link = BlockLinks[i - 1];
+        JITCompiler->UnlinkExit(link.Site, link.Unlinked);
+
+        FreeBlockLinks.push_back(i);
+        i = link.Next;
+    }
+    block->Links = 0;
+}
+
+void UnlinkBlock(JitBlock* block)
+{
+    if (!block->Links)
+        return;
+
+    LockCompiler();
+    UnlinkExitsTo(block);
+    UnlockCompiler();
+}
+
+void UnlinkAllBlocks()
+{
+    if (BlockLinks.size() == FreeBlockLinks.size())
+        return;
+
+    JitEnableWrite();
+    for (u32 i = 1; i <= BlockChunks.size() * BlockChunkSize; i++)
+    {
+        JitBlock* block = GetBlock(i);
+        if (block->Status == blockStatus_Active)
+            UnlinkBlock(block);
+    }
+    JitEnableExecute();
+}
+
+JitBlock* TakeRestoreCandidate(u32 instrHash)
+{
+    if (NumRestoreCandidates == 0)
+        return NULL;
+
+    u32* link = &RestoreCandidates[instrHash & (RestoreCandidates.size() - 1)];
+    while (*link)
+    {
+        JitBlock* block = GetBlock(*link);
+        if (block->InstrHash == instrHash)
+        {
+            *link = block->Next;
+            block->Next = 0;
+            block->Status = blockStatus_Active;
+            NumRestoreCandidates--;
+            return block;
+        }
+        link = &block->Next;
+    }
+    return NULL;
+}
+
 void RetireJitBlock(JitBlock* block)
 {
-    auto it = RestoreCandidates.find(block->InstrHash);
-    if (it != RestoreCandidates.end())
+    JitBlock* prevCandidate = TakeRestoreCandidate(block->InstrHash);
+    if (prevCandidate)
+        FreeBlock(prevCandidate);
+
+    if (NumRestoreCandidates >= RestoreCandidates.size())
+    {
+        std::vector<u32> oldBuckets;
+        oldBuckets.swap(RestoreCandidates);
+        RestoreCandidates.resize(std::max((u32)oldBuckets.size() * 2, 0x400U), 0);
+
+        for (u32 i = 0; i < oldBuckets.size(); i++)
+        {
+            for (u32 j = oldBuckets[i]; j;)
+            {
+                JitBlock* candidate = GetBlock(j);
+                j = candidate->Next;
+
+                u32* bucket = &RestoreCandidates[candidate->InstrHash & (RestoreCandidates.size() - 1)];
+                candidate->Next = *bucket;
+                *bucket = candidate->Index;
+            }
+        }
+    }
+
+    u32* bucket = &RestoreCandidates[block->InstrHash & (RestoreCandidates.size() - 1)];
+    block->Next = *bucket;
+    *bucket = block->Index;
+    block->Status = blockStatus_Retired;
+    NumRestoreCandidates++;
+}
+
+void AddToFastBlockLookup(JitBlock* block)
+{
+    u64* entry = &FastBlockLookupRegions[block->StartAddrLocal >> 27][(block->StartAddrLocal & 0x7FFFFFF) / 2];
+    *entry = ((u64)block->StartAddr | block->Num) << 32;
+    *entry |= JITCompiler->SubEntryOffset(block->EntryPoint);
+}
+
+void RemoveFromCodeRanges(JitBlock* block)
+{
+    for (int j = 0; j < block->NumAddresses; j++)
     {
-        delete it->second;
-        it->second = block;
+        u32 addr = block->AddressRanges()[j];
+        AddressRange* region = CodeMemRegions[addr >> 27];
+        AddressRange* range = &region[(addr & 0x7FFFFFF) / 512];
+
+        range->Blocks.RemoveByValue(block);
+        if (range->Blocks.Length == 0 && !PageContainsCode(&region[(addr & 0x7FFF000) / 512]))
+            ARMJIT_Memory::SetCodeProtection(addr >> 27, addr & 0x7FFFFFF, false);
+    }
+}
+
+// makes room by throwing away the code segment which was filled the longest time
+// ago together with all blocks inside of it, the compiler needs to be locked
+void EvictCodeSegment()
+{
+    u32 segment = (JITCompiler->GetCurrentCodeSegment() + 1) % NumCodeSegments;
+    JIT_DEBUGPRINT("evicting code segment %d\n", segment);
+
+    JitEnableWrite();
+    for (u32 i = 1; i <= BlockChunks.size() * BlockChunkSize; i++)
+    {
+        JitBlock* block = GetBlock(i);
+        if (block->Status != blockStatus_Active)
+            continue;
+
+        if (JITCompiler->CodeSegment(JITCompiler->SubEntryOffset(block->EntryPoint)) == segment)
+        {
+            RemoveFromCodeRanges(block);
+            FastBlockLookupRegions[block->StartAddrLocal >> 27][(block->StartAddrLocal & 0x7FFFFFF) / 2] = (u64)UINT32_MAX << 32;
+            RemoveFromBlockIndex(block);
+            UnlinkExitsTo(block);
+            FreeBlock(block);
+            BlocksEvicted++;
+        }
+        else
+        {
+            // exits from within the segment are just forgotten
+            for (u32* link = &block->Links; *link;)
+            {
+                BlockLink& blockLink = BlockLinks[*link - 1];
+                if (JITCompiler->CodeSegment(blockLink.Site) == segment)
+                {
+                    FreeBlockLinks.push_back(*link);
+                    *link = blockLink.Next;
+                }
+                else
+                {
+                    link = &blockLink.Next;
+                }
+            }
+        }
+    }
+
+    for (u32& bucket : RestoreCandidates)
+    {
+        for (u32* link = &bucket; *link;)
+        {
+            JitBlock* block = GetBlock(*link);
+            if (JITCompiler->CodeSegment(JITCompiler->SubEntryOffset(block->EntryPoint)) == segment)
+            {
+                *link = block->Next;
+                FreeBlock(block);
+                NumRestoreCandidates--;
+                BlocksEvicted++;
+            }
+            else
+            {
+                link = &block->Next;
+            }
+        }
+    }
+
+    // the exit might be gone
+    NDS::ARM9->LinkSite = 0;
+    NDS::ARM7->LinkSite = 0;
+
+    // the segments are only taken into use one after another at first
+    u32 used = JITCompiler->GetCodeMemoryUsed();
+    JITCompiler->StartCodeSegment(segment);
+    JitEnableExecute();
+
+    if (JITCompiler->GetCodeMemoryUsed() != used)
+        SegmentsEvicted++;
+}
+
+void FinishBlock(JitBlock* block, JitBlockEntry entry)
+{
+    if (block->Status == blockStatus_Cancelled)
+    {
+        FreeBlock(block);
     }
     else
     {
-        RestoreCandidates[block->InstrHash] = block;
+        block->EntryPoint = entry;
+        block->Status = blockStatus_Active;
+        AddToFastBlockLookup(block);
     }
 }
 
-void CompileBlock(ARM* cpu)
+void PublishCompiledBlocks()
+{
+    if (NumCompiledBlocks == 0)
+        return;
+
+    Platform::Mutex_Lock(CompileJobsLock);
+    PublishedBlocks.swap(CompiledBlocks);
+    NumCompiledBlocks = 0;
+    Platform::Mutex_Unlock(CompileJobsLock);
+
+#ifdef __aarch64__
+    // the code was written on another core
+    asm volatile("isb" ::: "memory");
+#endif
+
+    for (CompiledBlock& compiled : PublishedBlocks)
+        FinishBlock(GetBlock(compiled.Block), compiled.EntryPoint);
+    PublishedBlocks.clear();
+}
+
+// compiles what's left on this thread
+void FinishCompileJobs()
 {
+    if (!CompileThread)
+        return;
+
+    Platform::Mutex_Lock(CompilerLock);
+    PublishCompiledBlocks();
+
+    Platform::Mutex_Lock(CompileJobsLock);
+    for (CompileJob& job : CompileJobs)
+    {
+        if (JITCompiler->IsFull())
+            EvictCodeSegment();
+        FinishBlock(GetBlock(job.Block), CompileJobCode(job));
+    }
+    CompileJobs.clear();
+    CodeSegmentFull = false;
+    Platform::Mutex_Unlock(CompileJobsLock);
+    Platform::Mutex_Unlock(CompilerLock);
+}
+
+void CompileBlock(ARM* cpu, int tier)
+{
+    // the exit which led here is linked the next time it's taken, once
+    // the block is in place. dispatching doesn't necessarily continue here
+    cpu->LinkSite = 0;
+
+    if (CompileThread)
+    {
+        PublishCompiledBlocks();
+
+        if (CodeSegmentFull)
+        {
+            Platform::Mutex_Lock(CompilerLock);
+            // so that nothing which is still unpublished is thrown away
+            PublishCompiledBlocks();
+            EvictCodeSegment();
+            CodeSegmentFull = false;
+            Platform::Mutex_Unlock(CompilerLock);
+            Platform::Semaphore_Post(CompileThreadWake);
+        }
+    }
+    else if (JITCompiler->IsFull())
+    {
+        EvictCodeSegment();
+    }
+
     bool thumb = cpu->CPSR & 0x20;
 
+    int maxBlockSize = tier == 0 ? std::min(MaxBlockSize, MaxTier0BlockSize) : MaxBlockSize;
+    bool branchOptimizations = tier != 0 && BranchOptimizations;
+
     u32 blockAddr = cpu->R[15] - (thumb ? 2 : 4);
 
     u32 localAddr = LocaliseCodeAddress(cpu->Num, blockAddr);
@@ -597,29 +1566,19 @@ void CompileBlock(ARM* cpu)
         printf("trying to compile non executable code? %x\n", blockAddr);
     }
 
-    auto& map = cpu->Num == 0 ? JitBlocks9 : JitBlocks7;
-    auto existingBlockIt = map.find(blockAddr);
-    if (existingBlockIt != map.end())
+    JitBlock* existingBlock = FindBlock(cpu->Num, blockAddr, localAddr);
+    if (existingBlock && existingBlock->Status == blockStatus_Active)
     {
         // there's already a block, though it's not inside the fast map
         // could be that there are two blocks at the same physical addr
         // but different mirrors
-        u32 otherLocalAddr = existingBlockIt->second->StartAddrLocal;
-
-        if (localAddr == otherLocalAddr)
-        {
-            JIT_DEBUGPRINT("switching out block %x %x %x\n", localAddr, blockAddr, existingBlockIt->second->StartAddr);
-
-            u64* entry = &FastBlockLookupRegions[localAddr >> 27][(localAddr & 0x7FFFFFF) / 2];
-            *entry = ((u64)blockAddr | cpu->Num) << 32;
-            *entry |= JITCompiler->SubEntryOffset(existingBlockIt->second->EntryPoint);
-            return;
-        }
+        JIT_DEBUGPRINT("switching out block %x %x\n", localAddr, blockAddr);
 
-        // some memory has been remapped
-        RetireJitBlock(existingBlockIt->second);
-        map.erase(existingBlockIt);
+        AddToFastBlockLookup(existingBlock);
+        return;
     }
+    // its code isn't there yet, so it's only interpreted
+    bool interpretOnly = existingBlock != NULL;
 
     FetchedInstr instrs[MaxBlockSize];
     int i = 0;
@@ -632,9 +1591,10 @@ void CompileBlock(ARM* cpu)
 
     u32 numLiterals = 0;
     u32 literalLoadAddrs[MaxBlockSize];
+    u32 literalInstrs[MaxBlockSize];
     // they are going to be hashed
     u32 literalValues[MaxBlockSize];
-    u32 instrValues[MaxBlockSize];
+    u32 instrValues[MaxBlockSize + SuccessorScanSize];
     // due to instruction merging i might not reflect the amount of actual instructions
     u32 numInstrs = 0;
 
@@ -659,6 +1619,8 @@ void CompileBlock(ARM* cpu)
 
         instrs[i].BranchFlags = 0;
         instrs[i].SetFlags = 0;
+        instrs[i].DeadRegs = 0;
+        instrs[i].LoadsLiteral = false;
         instrs[i].Instr = nextInstr[0];
         nextInstr[0] = nextInstr[1];
 
@@ -779,6 +1741,9 @@ void CompileBlock(ARM* cpu)
                 addressMasks[j] |= 1 << ((translatedAddr & 0x1FF) / 16);
                 JIT_DEBUGPRINT("literal loading %08x %08x %08x %08x\n", literalAddr, translatedAddr, addressMasks[j], addressRanges[j]);
                 cpu->DataRead32(literalAddr, &literalValues[numLiterals]);
+                instrs[i].LoadsLiteral = true;
+                instrs[i].LiteralValue = literalValues[numLiterals];
+                literalInstrs[numLiterals] = i;
                 literalLoadAddrs[numLiterals++] = translatedAddr;
             }
         }
@@ -796,7 +1761,11 @@ void CompileBlock(ARM* cpu)
             JIT_DEBUGPRINT("merged BL\n");
         }
 
-        if (instrs[i].Info.Branches() && BranchOptimizations
+        u32 jumpTarget;
+        if (DecodeStaticJump(thumb, cpu->Num, instrs[i], jumpTarget))
+            LookUpJumpCycles(cpu, instrs[i], jumpTarget);
+
+        if (instrs[i].Info.Branches() && branchOptimizations
             && instrs[i].Info.Kind != (thumb ? ARMInstrInfo::tk_SVC : ARMInstrInfo::ak_SVC))
         {
             bool hasBranched = cpu->R[15] != r15;
@@ -833,7 +1802,7 @@ void CompileBlock(ARM* cpu)
                         JIT_DEBUGPRINT("found %s idle loop %d in block %08x\n", thumb ? "thumb" : "arm", cpu->Num, blockAddr);
                     }
                 }
-                else if (hasBranched && !isBackJump && i + 1 < MaxBlockSize)
+                else if (hasBranched && !isBackJump && i + 1 < maxBlockSize)
                 {
                     if (link)
                     {
@@ -861,7 +1830,7 @@ void CompileBlock(ARM* cpu)
                 }
             }
 
-            if (!hasBranched && cond < 0xE && i + 1 < MaxBlockSize)
+            if (!hasBranched && cond < 0xE && i + 1 < maxBlockSize)
             {
                 JIT_DEBUGPRINT("block lengthened by untaken branch\n");
                 instrs[i].Info.EndBlock = false;
@@ -871,11 +1840,89 @@ void CompileBlock(ARM* cpu)
 
         i++;
 
-        bool canCompile = JITCompiler->CanCompile(thumb, instrs[i - 1].Info.Kind);
-        bool secondaryFlagReadCond = !canCompile || (instrs[i - 1].BranchFlags & (branch_FollowCondTaken | branch_FollowCondNotTaken));
-        if (instrs[i - 1].Info.ReadFlags != 0 || secondaryFlagReadCond)
-            FloodFillSetFlags(instrs, i - 2, !secondaryFlagReadCond ? instrs[i - 1].Info.ReadFlags : 0xF);
-    } while(!instrs[i - 1].Info.EndBlock && i < MaxBlockSize && !cpu->Halted && (!cpu->IRQ || (cpu->CPSR & 0x80)));
+        if (tier == 0)
+        {
+            // without looking which flags are actually used
+            instrs[i - 1].SetFlags = (instrs[i - 1].Info.WriteFlags | (instrs[i - 1].Info.WriteFlags >> 4)) & 0xF;
+        }
+        else
+        {
+            bool canCompile = JITCompiler->CanCompile(thumb, instrs[i - 1].Info.Kind);
+            bool secondaryFlagReadCond = !canCompile || (instrs[i - 1].BranchFlags & (branch_FollowCondTaken | branch_FollowCondNotTaken));
+            if (instrs[i - 1].Info.ReadFlags != 0 || secondaryFlagReadCond)
+                FloodFillSetFlags(instrs, i - 2, !secondaryFlagReadCond ? instrs[i - 1].Info.ReadFlags : 0xF);
+        }
+    } while(!instrs[i - 1].Info.EndBlock && i < maxBlockSize && !cpu->Halted && (!cpu->IRQ || (cpu->CPSR & 0x80)));
+
+    if (interpretOnly)
+        return;
+
+    // whatever the code after the block overwrites anyway doesn't need to be set at its end
+    u8 exitFlags = 0xF;
+    u32 successorAddrs[2];
+    int numSuccessors = tier > 0 ? DecodeStaticSuccessors(thumb, cpu->Num, instrs, i, successorAddrs) : 0;
+    if (numSuccessors > 0 && numAddressRanges + numSuccessors <= (u32)MaxBlockSize)
+    {
+        // the block could change the code after it while it's running.
+        // The ARM9 can't execute code it has just written without invalidating
+        // its instruction cache in between, which ends a block
+        bool writesCode = false;
+        // registers can't be left behind if they could be banked or the block left early
+        bool keepsRegs = true;
+        for (int j = 0; j < i; j++)
+        {
+            if (cpu->Num == 1 && (instrs[j].Info.SpecialKind == ARMInstrInfo::special_WriteMem
+                || (!thumb && (instrs[j].Info.Kind == ARMInstrInfo::ak_SWP || instrs[j].Info.Kind == ARMInstrInfo::ak_SWPB))))
+                writesCode = true;
+            if ((instrs[j].BranchFlags & (branch_FollowCondTaken | branch_FollowCondNotTaken))
+                || !JITCompiler->CanCompile(thumb, instrs[j].Info.Kind)
+                || ReadsWholeState(thumb, instrs[j].Info, instrs[j].Instr))
+                keepsRegs = false;
+        }
+
+        u32 successorLocalAddrs[2];
+        bool fixed = !writesCode;
+        for (int j = 0; j < numSuccessors && fixed; j++)
+        {
+            successorLocalAddrs[j] = LocaliseCodeAddress(cpu->Num, successorAddrs[j] & ~0x1);
+            // code which keeps being rewritten would only take the block down with it
+            fixed = successorLocalAddrs[j] && IsFixedCodeMemory(successorAddrs[j] & ~0x1, successorLocalAddrs[j])
+                && !CodeRecentlyModified(successorLocalAddrs[j]);
+        }
+
+        if (fixed)
+        {
+            u16 deadRegs = 0x7FFF;
+            exitFlags = 0;
+            for (int j = 0; j < numSuccessors; j++)
+            {
+                bool successorThumb = successorAddrs[j] & 0x1;
+                u16 liveRegs;
+                u8 liveFlags;
+                u32 numWords = ScanSuccessor(cpu, successorAddrs[j] & ~0x1, successorThumb,
+                    liveRegs, liveFlags, &instrValues[numInstrs]);
+                numInstrs += numWords;
+                deadRegs &= ~liveRegs;
+                exitFlags |= liveFlags;
+
+                // the block depends on that code now as well
+                u32 range = successorLocalAddrs[j] & ~0x1FF;
+                u32 k = 0;
+                for (; k < numAddressRanges; k++)
+                    if (addressRanges[k] == range)
+                        break;
+                if (k == numAddressRanges)
+                    addressRanges[numAddressRanges++] = range;
+                u32 end = successorLocalAddrs[j] + numWords * (successorThumb ? 2 : 4);
+                for (u32 chunk = successorLocalAddrs[j] & ~0xF; chunk < end; chunk += 16)
+                    addressMasks[k] |= 1 << ((chunk & 0x1FF) / 16);
+            }
+
+            if (keepsRegs)
+                instrs[i - 1].DeadRegs = deadRegs;
+            JIT_DEBUGPRINT("successors need flags %x, regs %x are dead\n", exitFlags, deadRegs);
+        }
+    }
 
     if (numLiterals)
     {
@@ -890,7 +1937,7 @@ void CompileBlock(ARM* cpu)
                     {
                         if (InvalidLiterals.Find(translatedAddr) == -1)
                             InvalidLiterals.Add(translatedAddr);
-                        break;
+                        instrs[literalInstrs[k]].LoadsLiteral = false;
                     }
                 }
             }
@@ -900,15 +1947,14 @@ void CompileBlock(ARM* cpu)
     u32 literalHash = (u32)XXH3_64bits(literalValues, numLiterals * 4);
     u32 instrHash = (u32)XXH3_64bits(instrValues, numInstrs * 4);
 
-    auto prevBlockIt = RestoreCandidates.find(instrHash);
-    JitBlock* prevBlock = NULL;
+    JitBlock* prevBlock = TakeRestoreCandidate(instrHash);
     bool mayRestore = true;
-    if (prevBlockIt != RestoreCandidates.end())
+    if (prevBlock)
     {
-        prevBlock = prevBlockIt->second;
-        RestoreCandidates.erase(prevBlockIt);
-
-        mayRestore = prevBlock->StartAddr == blockAddr && prevBlock->LiteralHash == literalHash;
+        mayRestore = prevBlock->Num == cpu->Num
+            && prevBlock->StartAddr == blockAddr
+            && prevBlock->LiteralHash == literalHash
+            && prevBlock->Tier >= tier;
 
         if (mayRestore && prevBlock->NumAddresses == numAddressRanges)
         {
@@ -934,9 +1980,9 @@ void CompileBlock(ARM* cpu)
     if (!mayRestore)
     {
         if (prevBlock)
-            delete prevBlock;
+            FreeBlock(prevBlock);
 
-        block = new JitBlock(cpu->Num, i, numAddressRanges, numLiterals);
+        block = AllocBlock(cpu->Num, numAddressRanges, numLiterals);
         block->LiteralHash = literalHash;
         block->InstrHash = instrHash;
         for (u32 j = 0; j < numAddressRanges; j++)
@@ -948,12 +1994,29 @@ void CompileBlock(ARM* cpu)
 
         block->StartAddr = blockAddr;
         block->StartAddrLocal = localAddr;
+        block->Tier = tier;
 
-        FloodFillSetFlags(instrs, i - 1, 0xF);
+        u16* hotCounter = NULL;
+        if (tier == 0)
+        {
+            hotCounter = HotCounter(localAddr);
+            *hotCounter = HotThreshold;
+        }
+        else
+            FloodFillSetFlags(instrs, i - 1, exitFlags);
 
-        JitEnableWrite();
-        block->EntryPoint = JITCompiler->CompileBlock(cpu, thumb, instrs, i, hasMemoryInstr);
-        JitEnableExecute();
+        if (CompileThread)
+        {
+            block->Status = blockStatus_Pending;
+            block->EntryPoint = NULL;
+            QueueCompileJob(block, cpu, thumb, instrs, i, hasMemoryInstr, hotCounter);
+        }
+        else
+        {
+            JitEnableWrite();
+            block->EntryPoint = JITCompiler->CompileBlock(cpu, thumb, instrs, i, hasMemoryInstr, hotCounter);
+            JitEnableExecute();
+        }
 
         JIT_DEBUGPRINT("block start %p\n", block->EntryPoint);
     }
@@ -980,20 +2043,46 @@ void CompileBlock(ARM* cpu)
         range->Blocks.Add(block);
     }
 
-    if (cpu->Num == 0)
-        JitBlocks9[blockAddr] = block;
-    else
-        JitBlocks7[blockAddr] = block;
+    AddToBlockIndex(block);
 
-    u64* entry = &FastBlockLookupRegions[(localAddr >> 27)][(localAddr & 0x7FFFFFF) / 2];
-    *entry = ((u64)blockAddr | cpu->Num) << 32;
-    *entry |= JITCompiler->SubEntryOffset(block->EntryPoint);
+    if (block->Status == blockStatus_Active)
+        AddToFastBlockLookup(block);
+}
+
+void CompileBlock(ARM* cpu)
+{
+    CompileBlock(cpu, 0);
+}
+
+void RecompileHotBlock(ARM* cpu)
+{
+    u32 blockAddr = cpu->R[15] - ((cpu->CPSR & 0x20) ? 2 : 4);
+    u32 localAddr = LocaliseCodeAddress(cpu->Num, blockAddr);
+
+    JitBlock* block = FindBlock(cpu->Num, blockAddr, localAddr);
+    if (block)
+    {
+        RemoveFromCodeRanges(block);
+        // nothing may enter the freed block, even if no new one takes its place
+        FastBlockLookupRegions[localAddr >> 27][(localAddr & 0x7FFFFFF) / 2] = (u64)UINT32_MAX << 32;
+        RemoveFromBlockIndex(block);
+
+        JitEnableWrite();
+        UnlinkBlock(block);
+        JitEnableExecute();
+
+        FreeBlock(block);
+    }
+
+    CompileBlock(cpu, 1);
 }
 
 void InvalidateByAddr(u32 localAddr)
 {
     JIT_DEBUGPRINT("invalidating by addr %x\n", localAddr);
 
+    CodeWriteSerials[CodeWriteChunkIndex(localAddr)] = ++CodeWriteSerial;
+
     AddressRange* region = CodeMemRegions[localAddr >> 27];
     AddressRange* range = &region[(localAddr & 0x7FFFFFF) / 512];
     u32 mask = 1 << ((localAddr & 0x1FF) / 16);
@@ -1068,18 +2157,24 @@ void InvalidateByAddr(u32 localAddr)
         }
 
         FastBlockLookupRegions[block->StartAddrLocal >> 27][(block->StartAddrLocal & 0x7FFFFFF) / 2] = (u64)UINT32_MAX << 32;
-        if (block->Num == 0)
-            JitBlocks9.erase(block->StartAddr);
-        else
-            JitBlocks7.erase(block->StartAddr);
+        RemoveFromBlockIndex(block);
+
+        JitEnableWrite();
+        UnlinkBlock(block);
+        JitEnableExecute();
 
-        if (!literalInvalidation)
+        if (block->Status == blockStatus_Pending)
+        {
+            // it's freed once its code arrives
+            block->Status = blockStatus_Cancelled;
+        }
+        else if (!literalInvalidation)
         {
             RetireJitBlock(block);
         }
         else
         {
-            delete block;
+            FreeBlock(block);
         }
     }
 }
@@ -1177,22 +2272,25 @@ void ResetBlockCache()
 {
     printf("Resetting JIT block cache...\n");
 
+    CancelCompileJobs();
+
     // could be replace through a function which only resets
     // the permissions but we're too lazy
     ARMJIT_Memory::Reset();
 
     InvalidLiterals.Clear();
+    std::fill_n(HotCounters, HotCountersSize, HotThreshold);
     for (int i = 0; i < ARMJIT_Memory::memregions_Count; i++)
     {
         if (FastBlockLookupRegions[i])
             memset(FastBlockLookupRegions[i], 0xFF, CodeRegionSizes[i] * sizeof(u64) / 2);
     }
-    for (auto it = RestoreCandidates.begin(); it != RestoreCandidates.end(); it++)
-        delete it->second;
-    RestoreCandidates.clear();
-    for (auto it : JitBlocks9)
+    for (u32 i = 1; i <= BlockChunks.size() * BlockChunkSize; i++)
     {
-        JitBlock* block = it.second;
+        JitBlock* block = GetBlock(i);
+        if (block->Status != blockStatus_Active && block->Status != blockStatus_Pending)
+            continue;
+
         for (int j = 0; j < block->NumAddresses; j++)
         {
             u32 addr = block->AddressRanges()[j];
@@ -1200,24 +2298,209 @@ void ResetBlockCache()
             range->Blocks.Clear();
             range->Code = 0;
         }
-        delete block;
+        *BlockIndexBucket(block->StartAddrLocal) = 0;
+    }
+    FreeAllBlocks();
+
+    // the exit it's pointing to is gone
+    NDS::ARM9->LinkSite = 0;
+    NDS::ARM7->LinkSite = 0;
+
+    JITCompiler->Reset();
+}
+
+void GetCodeMemoryStats(CodeMemoryStats& stats)
+{
+    LockCompiler();
+    stats.Size = JITCompiler->GetCodeMemorySize();
+    stats.Used = JITCompiler->GetCodeMemoryUsed();
+    UnlockCompiler();
+
+    stats.NumSegments = NumCodeSegments;
+    stats.SegmentsEvicted = SegmentsEvicted;
+    stats.BlocksEvicted = BlocksEvicted;
+}
+
+// the code is stored as is, it's only valid for the exact same build
+// (calls into the emulator are relative) and the same JIT settings
+u64 GetBlockCacheKey()
+{
+    u8* base = (u8*)JITCompiler->AddEntryOffset(0);
+    s64 values[] =
+    {
+        (u8*)&ARM_Dispatch - base,
+        (u8*)InterpretARM[0] - base,
+        (u8*)&SlowRead9<u32, 0> - base,
+        (u8*)&NDS::ARM7MemTimings - base,
+        MaxBlockSize,
+        LiteralOptimizations,
+        BranchOptimizations,
+        FastMemory,
+        NDS::ConsoleType,
+    };
+
+    static const char version[] = "melonDS " MELONDS_VERSION;
+    return XXH3_64bits_withSeed(values, sizeof(values), XXH3_64bits(version, sizeof(version)));
+}
+
+const u32 BlockCacheMagic = 0x54494A4D; // MJIT
+const u32 BlockCacheVersion = 3;
+
+struct SavedJitBlock
+{
+    u32 StartAddr;
+    u32 StartAddrLocal;
+    u32 InstrHash, LiteralHash;
+    u32 EntryOffset;
+    u8 Num;
+    u8 Tier;
+    u16 NumAddresses;
+    u16 NumLiterals;
+    u16 Pad2;
+};
+
+bool SaveBlock(FILE* file, JitBlock* block)
+{
+    SavedJitBlock saved;
+    memset(&saved, 0, sizeof(saved));
+    saved.StartAddr = block->StartAddr;
+    saved.StartAddrLocal = block->StartAddrLocal;
+    saved.InstrHash = block->InstrHash;
+    saved.LiteralHash = block->LiteralHash;
+    saved.EntryOffset = JITCompiler->SubEntryOffset(block->EntryPoint);
+    saved.Num = block->Num;
+    saved.Tier = block->Tier;
+    saved.NumAddresses = block->NumAddresses;
+    saved.NumLiterals = block->NumLiterals;
+
+    if (fwrite(&saved, sizeof(saved), 1, file) != 1) return false;
+    return fwrite(block->AddressRanges(), (block->NumAddresses * 2 + block->NumLiterals) * 4, 1, file) == 1;
+}
+
+void SaveBlockCache()
+{
+    if (BlockCacheFile.empty())
+        return;
+
+    FinishCompileJobs();
+
+    u32 numBlocks = NumActiveBlocks + NumRestoreCandidates;
+    if (numBlocks == 0)
+        return;
+
+    FILE* file = Platform::OpenFile(BlockCacheFile, "wb");
+    if (!file)
+    {
+        printf("JIT: could not write block cache to %s\n", BlockCacheFile.c_str());
+        return;
     }
-    for (auto it : JitBlocks7)
+
+    u32 header[2] = {BlockCacheMagic, BlockCacheVersion};
+    u64 key = GetBlockCacheKey();
+
+    // links are made again once the blocks run
+    UnlinkAllBlocks();
+
+    bool ok = fwrite(header, sizeof(header), 1, file) == 1
+        && fwrite(&key, sizeof(key), 1, file) == 1
+        && JITCompiler->SaveCode(file)
+        && fwrite(&numBlocks, 4, 1, file) == 1;
+
+    for (u32 i = 1; i <= BlockChunks.size() * BlockChunkSize; i++)
     {
-        JitBlock* block = it.second;
-        for (int j = 0; j < block->NumAddresses; j++)
+        if (GetBlock(i)->Status != blockStatus_Free)
+            ok = ok && SaveBlock(file, GetBlock(i));
+    }
+
+    fclose(file);
+
+    if (ok)
+        printf("JIT: saved %d blocks to %s\n", numBlocks, BlockCacheFile.c_str());
+    else
+    {
+        printf("JIT: error while writing block cache to %s\n", BlockCacheFile.c_str());
+        remove(BlockCacheFile.c_str());
+    }
+}
+
+bool LoadBlocks(FILE* file)
+{
+    u32 header[2];
+    u64 key;
+    if (fread(header, sizeof(header), 1, file) != 1) return false;
+    if (header[0] != BlockCacheMagic || header[1] != BlockCacheVersion) return false;
+    if (fread(&key, sizeof(key), 1, file) != 1) return false;
+    if (key != GetBlockCacheKey()) return false;
+
+    if (!JITCompiler->LoadCode(file)) return false;
+
+    u32 numBlocks;
+    if (fread(&numBlocks, 4, 1, file) != 1) return false;
+
+    // all blocks start out as restore candidates, CompileBlock
+    // then only needs to verify them instead of compiling again
+    for (u32 i = 0; i < numBlocks; i++)
+    {
+        SavedJitBlock saved;
+        if (fread(&saved, sizeof(saved), 1, file) != 1) return false;
+        if (saved.Num > 1 || saved.Tier > 1 || saved.NumAddresses > 32 || saved.NumLiterals > 32) return false;
+        if (!JITCompiler->IsUsedCode(saved.EntryOffset, 1)) return false;
+
+        JitBlock* block = AllocBlock(saved.Num, saved.NumAddresses, saved.NumLiterals);
+        if (fread(block->AddressRanges(), (saved.NumAddresses * 2 + saved.NumLiterals) * 4, 1, file) != 1)
         {
-            u32 addr = block->AddressRanges()[j];
-            AddressRange* range = &CodeMemRegions[addr >> 27][(addr & 0x7FFFFFF) / 512];
-            range->Blocks.Clear();
-            range->Code = 0;
+            FreeBlock(block);
+            return false;
         }
-        delete block;
+
+        block->StartAddr = saved.StartAddr;
+        block->StartAddrLocal = saved.StartAddrLocal;
+        block->InstrHash = saved.InstrHash;
+        block->LiteralHash = saved.LiteralHash;
+        block->Tier = saved.Tier;
+        block->EntryPoint = JITCompiler->AddEntryOffset(saved.EntryOffset);
+
+        RetireJitBlock(block);
     }
-    JitBlocks9.clear();
-    JitBlocks7.clear();
 
-    JITCompiler->Reset();
+    return true;
+}
+
+void LoadBlockCache()
+{
+    if (BlockCacheFile.empty())
+        return;
+
+    FILE* file = Platform::OpenFile(BlockCacheFile, "rb", true);
+    if (!file)
+        return;
+
+    bool ok = LoadBlocks(file);
+    fclose(file);
+
+    if (ok)
+        printf("JIT: loaded %d blocks from %s\n", (int)NumRestoreCandidates, BlockCacheFile.c_str());
+    else
+    {
+        // stale or broken cache, start over
+        printf("JIT: block cache %s is outdated, ignoring\n", BlockCacheFile.c_str());
+        ResetBlockCache();
+    }
+}
+
+void SetBlockCacheFile(std::string path)
+{
+    if (!JITCompiler || path == BlockCacheFile)
+        return;
+
+    SaveBlockCache();
+
+    JitEnableWrite();
+    ResetBlockCache();
+
+    BlockCacheFile = path;
+    LoadBlockCache();
+    JitEnableExecute();
 }
 
 void JitEnableWrite()
@@ -19,6 +19,8 @@
 #ifndef ARMJIT_H
 #define ARMJIT_H
 
+#include <string>
+
 #include "types.h"
 
 #include "ARM.h"
@@ -55,7 +57,30 @@ void CompileBlock(ARM* cpu);
 
 void ResetBlockCache();
 
+struct CodeMemoryStats
+{
+    u32 Size, Used;
+    u32 NumSegments;
+    // since the last reset
+    u32 SegmentsEvicted;
+    u32 BlocksEvicted;
+};
+
+void GetCodeMemoryStats(CodeMemoryStats& stats);
+
+// keeps the compiled code across sessions in the given file
+// the current cache is written back to the previous file (if any),
+// an empty path disables the persistent cache
+void SetBlockCacheFile(std::string path);
+
 JitBlockEntry LookUpBlock(u32 num, u64* entries, u32 offset, u32 addr);
+
+// patches the exit cpu->LinkSite to jump directly to the block at addr
+void LinkBlock(ARM* cpu, u32 addr);
+// replaces the block the cpu is about to execute with one compiled with all optimisations
+void RecompileHotBlock(ARM* cpu);
+// to be called when the memory mapping changed in a way the blocks can't see
+void UnlinkAllBlocks();
 bool SetupExecutableRegion(u32 num, u32 blockAddr, u64*& entry, u32& start, u32& size);
 
 void JitEnableWrite();
@@ -32,6 +32,8 @@ extern char __start__;
 
 #include <stdlib.h>
 
+#include <algorithm>
+
 using namespace Arm64Gen;
 
 extern "C" void ARM_Ret();
@@ -458,12 +460,15 @@ Compiler::Compiler()
 
     FlushIcache();
 
-    JitMemSecondarySize = 1024*1024*4;
-
-    JitMemMainSize -= GetCodeOffset();
-    JitMemMainSize -= JitMemSecondarySize;
+    MaxCodeMemSize = JitMemMainSize - GetCodeOffset();
 
     SetCodeBase((u8*)GetRWPtr(), (u8*)GetRXPtr());
+
+    JitMemMainSize = JitMemSecondarySize = 0;
+    SegmentMainSize = SegmentSecondarySize = 0;
+    memset(SegmentMainUsed, 0, sizeof(SegmentMainUsed));
+    memset(SegmentSecondaryUsed, 0, sizeof(SegmentSecondaryUsed));
+    SetCodeMemorySize(MaxCodeMemSize);
 }
 
 Compiler::~Compiler()
@@ -686,19 +691,132 @@ void Compiler::Comp_BranchSpecialBehaviour(bool taken)
     }
 }
 
-JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, bool hasMemInstr)
+void Compiler::MovAddrRelative(ARM64Reg reg, const void* ptr)
+{
+    ADRP(reg, (s32)(((uintptr_t)ptr & ~0xFFF) - ((uintptr_t)GetRXPtr() & ~0xFFF)));
+    if ((uintptr_t)ptr & 0xFFF)
+        ADD(reg, reg, (uintptr_t)ptr & 0xFFF);
+}
+
+/*
+    Block linking
+
+    If the block after this one is always the same, the exit does what the
+    dispatcher would do before entering the next block itself. The first time
+    it's taken it goes back to the dispatcher, leaving the location of the
+    branch in LinkSite, which is then patched to go directly to the next block.
+*/
+void Compiler::Comp_LinkableExit()
+{
+    LDR(INDEX_UNSIGNED, W0, RCPU, offsetof(ARM, StopExecution));
+    FixupBranch stop = CBNZ(W0);
+
+    MovAddrRelative(X1, Num == 0 ? &NDS::ARM9Timestamp : &NDS::ARM7Timestamp);
+    LDR(INDEX_UNSIGNED, X0, X1, 0);
+    SXTW(X2, RCycles);
+    ADD(X0, X0, X2);
+    STR(INDEX_UNSIGNED, X0, X1, 0);
+    MOVI2R(RCycles, 0);
+
+    MovAddrRelative(X1, Num == 0 ? &NDS::ARM9Target : &NDS::ARM7Target);
+    LDR(INDEX_UNSIGNED, X1, X1, 0);
+    CMP(X0, X1);
+    FixupBranch targetReached = B(CC_HS);
+
+    // branches either to the code below or to the linked path right after it
+    u8* site = (u8*)GetRXPtr();
+    FixupBranch unlinked = B();
+
+    LDR(INDEX_UNSIGNED, X0, RCPU, offsetof(ARM, LinkHits));
+    ADD(X0, X0, 1);
+    STR(INDEX_UNSIGNED, X0, RCPU, offsetof(ARM, LinkHits));
+    // patched to branch to the next block
+    BRK(0);
+
+    SetJumpTarget(unlinked);
+    MOVI2R(W0, SubEntryOffset((JitBlockEntry)site));
+    STR(INDEX_UNSIGNED, W0, RCPU, offsetof(ARM, LinkSite));
+
+    SetJumpTarget(stop);
+    SetJumpTarget(targetReached);
+    QuickTailCall(X0, ARM_Ret);
+}
+
+u32 Compiler::LinkExit(u32 site, JitBlockEntry target)
+{
+    u8* sitePtr = GetRXBase() + site;
+    u8* unlinked = sitePtr + (((s32)(*(u32*)sitePtr << 6)) >> 6) * 4;
+
+    ptrdiff_t curCodeOffset = GetCodeOffset();
+
+    SetCodePtrUnsafe(unlinked - 4 - GetRXBase());
+    B((const void*)target);
+    FlushIcacheSection(unlinked - 4, unlinked);
+
+    SetCodePtrUnsafe(site);
+    B(sitePtr + 4);
+    FlushIcacheSection(sitePtr, sitePtr + 4);
+
+    SetCodePtrUnsafe(curCodeOffset);
+
+    return unlinked - GetRXBase();
+}
+
+void Compiler::UnlinkExit(u32 site, u32 unlinked)
+{
+    ptrdiff_t curCodeOffset = GetCodeOffset();
+
+    SetCodePtrUnsafe(site);
+    B(GetRXBase() + unlinked);
+    FlushIcacheSection(GetRXBase() + site, GetRXBase() + site + 4);
+
+    SetCodePtrUnsafe(curCodeOffset);
+}
+
+bool Compiler::IsFull()
+{
+    return (CurSegment + 1) * SegmentMainSize - GetCodeOffset() < 1024 * 16
+        || JitMemMainSize + (CurSegment + 1) * SegmentSecondarySize - OtherCodeRegion < 1024 * 8;
+}
+
+u32 Compiler::CodeSegment(u32 offset)
+{
+    if (offset < JitMemMainSize)
+        return offset / SegmentMainSize;
+    return (offset - JitMemMainSize) / SegmentSecondarySize;
+}
+
+void Compiler::StartCodeSegment(u32 segment)
 {
-    if (JitMemMainSize - GetCodeOffset() < 1024 * 16)
+    u32 mainStart = segment * SegmentMainSize;
+    u32 secondaryStart = JitMemMainSize + segment * SegmentSecondarySize;
+
+    FillWithBreakpoints(mainStart, SegmentMainUsed[segment]);
+    FillWithBreakpoints(secondaryStart, SegmentSecondaryUsed[segment]);
+    SegmentMainUsed[segment] = 0;
+    SegmentSecondaryUsed[segment] = 0;
+
+    for (auto it = LoadStorePatches.begin(); it != LoadStorePatches.end();)
     {
-        printf("JIT near memory full, resetting...\n");
-        ResetBlockCache();
+        if (CodeSegment(it->first) == segment)
+            it = LoadStorePatches.erase(it);
+        else
+            it++;
     }
-    if ((JitMemMainSize +  JitMemSecondarySize) - OtherCodeRegion < 1024 * 8)
+    for (int i = 0; i < 2; i++)
     {
-        printf("JIT far memory full, resetting...\n");
-        ResetBlockCache();
+        FastMemRelocs[i].erase(std::remove_if(FastMemRelocs[i].begin(), FastMemRelocs[i].end(),
+            [this, segment](u32 offset) { return CodeSegment(offset) == segment; }),
+            FastMemRelocs[i].end());
     }
 
+    CurSegment = segment;
+    SetCodePtr(mainStart);
+    OtherCodeRegion = secondaryStart;
+}
+
+JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, bool hasMemInstr, u16* hotCounter)
+{
     JitBlockEntry res = (JitBlockEntry)GetRXPtr();
 
     Thumb = thumb;
@@ -708,8 +826,22 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
     RegCache = RegisterCache<Compiler, ARM64Reg>(this, instrs, instrsCount, true);
     CPSRDirty = false;
 
+    if (hotCounter)
+    {
+        // once it's hot, return right away to be compiled again
+        MovAddrRelative(X0, hotCounter);
+        LDRH(INDEX_UNSIGNED, W1, X0, 0);
+        SUBS(W1, W1, 1);
+        STRH(INDEX_UNSIGNED, W1, X0, 0);
+        FixupBranch notHot = B(CC_NEQ);
+        MOVI2R(W0, 1);
+        STRB(INDEX_UNSIGNED, W0, RCPU, offsetof(ARM, HotBlock));
+        QuickTailCall(X0, ARM_Ret);
+        SetJumpTarget(notHot);
+    }
+
     if (hasMemInstr)
-        MOVP2R(RMemBase, Num == 0 ? ARMJIT_Memory::FastMem9Start : ARMJIT_Memory::FastMem7Start);
+        Comp_FastMemBase();
 
     for (int i = 0; i < instrsCount; i++)
     {
@@ -722,6 +854,7 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
             : A_Comp[CurInstr.Info.Kind];
 
         Exit = i == (instrsCount - 1) || (CurInstr.BranchFlags & branch_FollowCondNotTaken);
+        LinkableExit = false;
 
         //printf("%x instr %x regs: r%x w%x n%x flags: %x %x %x\n", R15, CurInstr.Instr, CurInstr.Info.SrcRegs, CurInstr.Info.DstRegs, CurInstr.Info.ReadFlags, CurInstr.Info.NotStrictlyNeeded, CurInstr.Info.WriteFlags, CurInstr.SetFlags);
 
@@ -828,30 +961,78 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
             LoadCycles();
             LoadCPSR();
         }
+        else if (i == instrsCount - 1 && !CurInstr.Info.Branches())
+            LinkableExit = CanLinkTo(Num, R15 - (Thumb ? 2 : 4));
     }
 
-    RegCache.Flush();
+    RegCache.FlushExit();
 
     if (ConstantCycles)
         ADD(RCycles, RCycles, ConstantCycles);
-    QuickTailCall(X0, ARM_Ret);
+    if (LinkableExit)
+        Comp_LinkableExit();
+    else
+        QuickTailCall(X0, ARM_Ret);
 
     FlushIcache();
 
+    SegmentMainUsed[CurSegment] = GetCodeOffset() - CurSegment * SegmentMainSize;
+    SegmentSecondaryUsed[CurSegment] = OtherCodeRegion - JitMemMainSize - CurSegment * SegmentSecondarySize;
+
     return res;
 }
 
+void Compiler::FillWithBreakpoints(u32 offset, u32 size)
+{
+    const u32 brk_0 = 0xD4200000;
+
+    u32* code = (u32*)(GetRWBase() + offset);
+    for (u32 i = 0; i < size / 4; i++)
+        code[i] = brk_0;
+}
+
 void Compiler::Reset()
 {
     LoadStorePatches.clear();
+    FastMemRelocs[0].clear();
+    FastMemRelocs[1].clear();
 
+    // only what was used is overwritten, the pages which never
+    // held any code don't need to be backed by memory
+    for (u32 i = 0; i < NumCodeSegments; i++)
+    {
+        FillWithBreakpoints(i * SegmentMainSize, SegmentMainUsed[i]);
+        FillWithBreakpoints(JitMemMainSize + i * SegmentSecondarySize, SegmentSecondaryUsed[i]);
+        SegmentMainUsed[i] = 0;
+        SegmentSecondaryUsed[i] = 0;
+    }
+
+    CurSegment = 0;
     SetCodePtr(0);
     OtherCodeRegion = JitMemMainSize;
+}
 
-    const u32 brk_0 = 0xD4200000;
+void Compiler::SetCodeMemorySize(u32 size)
+{
+    Reset();
+
+    // a quarter for the secondary region like before
+    u32 segmentSize = std::min(size, MaxCodeMemSize) / NumCodeSegments;
+    SegmentSecondarySize = (segmentSize / 4) & ~0xF;
+    SegmentMainSize = (segmentSize - SegmentSecondarySize) & ~0xF;
+
+    JitMemMainSize = SegmentMainSize * NumCodeSegments;
+    JitMemSecondarySize = SegmentSecondarySize * NumCodeSegments;
 
-    for (int i = 0; i < (JitMemMainSize + JitMemSecondarySize) / 4; i++)
-        *(((u32*)GetRWPtr()) + i) = brk_0;
+    Reset();
+}
+
+u32 Compiler::GetCodeMemoryUsed()
+{
+    u32 used = 0;
+    for (u32 i = 0; i < NumCodeSegments; i++)
+        used += SegmentMainUsed[i] + SegmentSecondaryUsed[i];
+    return used;
 }
 
 void Compiler::Comp_AddCycles_C(bool forceNonConstant)
@@ -27,7 +27,9 @@
 #include "../ARMJIT_Internal.h"
 #include "../ARMJIT_RegisterCache.h"
 
+#include <stdio.h>
 #include <unordered_map>
+#include <vector>
 
 namespace ARMJIT
 {
@@ -109,7 +111,19 @@ public:
         return RegCache.Mapping[reg];
     }
 
-    JitBlockEntry CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, bool hasMemInstr);
+    // the part of the code memory which is used, clears it
+    void SetCodeMemorySize(u32 size);
+    u32 GetCodeMemorySize() { return JitMemMainSize + JitMemSecondarySize; }
+    u32 GetCodeMemoryUsed();
+
+    // whether there's too little space left in the current code segment to compile another block
+    bool IsFull();
+    u32 CodeSegment(u32 offset);
+    u32 GetCurrentCodeSegment() { return CurSegment; }
+    // throws away everything in the segment and continues compiling there
+    void StartCodeSegment(u32 segment);
+    // if hotCounter isn't NULL, the block counts its executions down there
+    JitBlockEntry CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, bool hasMemInstr, u16* hotCounter);
 
     bool CanCompile(bool thumb, u16 kind);
 
@@ -222,6 +236,10 @@ public:
     void* Gen_JumpTo7(int kind);
 
     void Comp_BranchSpecialBehaviour(bool taken);
+    void Comp_LinkableExit();
+
+    // relative to the code, so that it can be stored in the block cache
+    void MovAddrRelative(Arm64Gen::ARM64Reg reg, const void* ptr);
 
     JitBlockEntry AddEntryOffset(u32 offset)
     {
@@ -236,6 +254,18 @@ public:
     bool IsJITFault(u8* pc);
     u8* RewriteMemAccess(u8* pc);
 
+    void Comp_FastMemBase();
+
+    bool SaveCode(FILE* file);
+    bool LoadCode(FILE* file);
+    // whether offset..offset+size lies within the code of one segment
+    bool IsUsedCode(u32 offset, u32 size);
+    bool IsPatchFunc(void* func);
+
+    // returns the offset of the code the exit jumps to when unlinked
+    u32 LinkExit(u32 site, JitBlockEntry target);
+    void UnlinkExit(u32 site, u32 unlinked);
+
     void SwapCodeRegion()
     {
         ptrdiff_t offset = GetCodeOffset();
@@ -243,9 +273,17 @@ public:
         OtherCodeRegion = offset;
     }
 
+    u8* GetRWBase()
+    {
+        return GetWriteableRWPtr() - GetCodeOffset();
+    }
+
+    void FillWithBreakpoints(u32 offset, u32 size);
+
     ptrdiff_t OtherCodeRegion;
 
     bool Exit;
+    bool LinkableExit;
 
     FetchedInstr CurInstr;
     bool Thumb;
@@ -259,8 +297,15 @@ public:
 
     u32 JitMemSecondarySize;
     u32 JitMemMainSize;
+    u32 MaxCodeMemSize;
+
+    u32 CurSegment;
+    u32 SegmentMainSize, SegmentSecondarySize;
+    u32 SegmentMainUsed[NumCodeSegments], SegmentSecondaryUsed[NumCodeSegments];
 
     std::unordered_map<ptrdiff_t, LoadStorePatch> LoadStorePatches; 
+    // locations of the fast memory base pointers, per CPU
+    std::vector<u32> FastMemRelocs[2];
 
     RegisterCache<Compiler, Arm64Gen::ARM64Reg> RegCache;
 
@@ -32,6 +32,193 @@ bool Compiler::IsJITFault(u8* pc)
     return (u64)pc >= (u64)GetRXBase() && (u64)pc - (u64)GetRXBase() < (JitMemMainSize + JitMemSecondarySize);
 }
 
+void Compiler::Comp_FastMemBase()
+{
+    // always the full movz/movk sequence, the fast memory
+    // base is patched when the code is loaded from disk
+    u64 base = (u64)(Num == 0 ? ARMJIT_Memory::FastMem9Start : ARMJIT_Memory::FastMem7Start);
+    FastMemRelocs[Num].push_back(GetCodeOffset());
+    MOVZ(RMemBase, base & 0xFFFF, SHIFT_0);
+    MOVK(RMemBase, (base >> 16) & 0xFFFF, SHIFT_16);
+    MOVK(RMemBase, (base >> 32) & 0xFFFF, SHIFT_32);
+    MOVK(RMemBase, (base >> 48) & 0xFFFF, SHIFT_48);
+}
+
+struct SavedLoadStorePatch
+{
+    u32 Location;
+    s32 PatchFunc;
+    s32 PatchOffset;
+    u32 PatchSize;
+};
+
+bool Compiler::IsUsedCode(u32 offset, u32 size)
+{
+    u64 start = offset;
+    u64 end = start + size;
+    for (u32 i = 0; i < NumCodeSegments; i++)
+    {
+        u64 mainStart = (u64)i * SegmentMainSize;
+        u64 secondaryStart = JitMemMainSize + (u64)i * SegmentSecondarySize;
+        if ((start >= mainStart && end <= mainStart + SegmentMainUsed[i])
+            || (start >= secondaryStart && end <= secondaryStart + SegmentSecondaryUsed[i]))
+            return true;
+    }
+    return false;
+}
+
+bool Compiler::IsPatchFunc(void* func)
+{
+    for (int consoleType = 0; consoleType < 2; consoleType++)
+    {
+        for (int num = 0; num < 2; num++)
+        {
+            for (int size = 0; size < 3; size++)
+            {
+                for (int reg = 0; reg < 32; reg++)
+                {
+                    if (func && (func == PatchedStoreFuncs[consoleType][num][size][reg]
+                        || func == PatchedLoadFuncs[consoleType][num][size][0][reg]
+                        || func == PatchedLoadFuncs[consoleType][num][size][1][reg]))
+                        return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool Compiler::SaveCode(FILE* file)
+{
+#if defined(__APPLE__) || defined(__SWITCH__)
+    // the code memory isn't part of the executable there, so
+    // calls into the emulator might not be relative
+    return false;
+#endif
+
+    u32 header[4] = {SegmentMainSize, SegmentSecondarySize, NumCodeSegments, CurSegment};
+    if (fwrite(header, sizeof(header), 1, file) != 1) return false;
+    if (fwrite(SegmentMainUsed, sizeof(SegmentMainUsed), 1, file) != 1) return false;
+    if (fwrite(SegmentSecondaryUsed, sizeof(SegmentSecondaryUsed), 1, file) != 1) return false;
+
+    u8* rwBase = GetRWBase();
+    for (u32 i = 0; i < NumCodeSegments; i++)
+    {
+        if (SegmentMainUsed[i] && fwrite(rwBase + i * SegmentMainSize, SegmentMainUsed[i], 1, file) != 1) return false;
+        if (SegmentSecondaryUsed[i] && fwrite(rwBase + JitMemMainSize + i * SegmentSecondarySize, SegmentSecondaryUsed[i], 1, file) != 1) return false;
+    }
+
+    // the patch functions are generated in front of the block code
+    u32 numPatches = LoadStorePatches.size();
+    if (fwrite(&numPatches, 4, 1, file) != 1) return false;
+    for (auto it : LoadStorePatches)
+    {
+        SavedLoadStorePatch patch;
+        patch.Location = it.first;
+        patch.PatchFunc = (u8*)it.second.PatchFunc - GetRXBase();
+        patch.PatchOffset = it.second.PatchOffset;
+        patch.PatchSize = it.second.PatchSize;
+        if (fwrite(&patch, sizeof(patch), 1, file) != 1) return false;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        u32 numRelocs = FastMemRelocs[i].size();
+        if (fwrite(&numRelocs, 4, 1, file) != 1) return false;
+        if (numRelocs && fwrite(FastMemRelocs[i].data(), numRelocs * 4, 1, file) != 1) return false;
+    }
+
+    return true;
+}
+
+bool Compiler::LoadCode(FILE* file)
+{
+#if defined(__APPLE__) || defined(__SWITCH__)
+    // the code memory isn't part of the executable there, so
+    // calls into the emulator might not be relative
+    return false;
+#endif
+
+    u32 header[4];
+    if (fread(header, sizeof(header), 1, file) != 1) return false;
+    if (header[0] != SegmentMainSize || header[1] != SegmentSecondarySize) return false;
+    if (header[2] != NumCodeSegments || header[3] >= NumCodeSegments) return false;
+
+    u32 mainUsed[NumCodeSegments], secondaryUsed[NumCodeSegments];
+    if (fread(mainUsed, sizeof(mainUsed), 1, file) != 1) return false;
+    if (fread(secondaryUsed, sizeof(secondaryUsed), 1, file) != 1) return false;
+    for (u32 i = 0; i < NumCodeSegments; i++)
+    {
+        if (mainUsed[i] > SegmentMainSize || secondaryUsed[i] > SegmentSecondarySize) return false;
+    }
+
+    // set right away, so that whatever was read is cleared again if something fails
+    memcpy(SegmentMainUsed, mainUsed, sizeof(mainUsed));
+    memcpy(SegmentSecondaryUsed, secondaryUsed, sizeof(secondaryUsed));
+
+    u8* rwBase = GetRWBase();
+    for (u32 i = 0; i < NumCodeSegments; i++)
+    {
+        if (SegmentMainUsed[i] && fread(rwBase + i * SegmentMainSize, SegmentMainUsed[i], 1, file) != 1) return false;
+        if (SegmentSecondaryUsed[i] && fread(rwBase + JitMemMainSize + i * SegmentSecondarySize, SegmentSecondaryUsed[i], 1, file) != 1) return false;
+    }
+
+    u32 numPatches;
+    if (fread(&numPatches, 4, 1, file) != 1) return false;
+    for (u32 i = 0; i < numPatches; i++)
+    {
+        SavedLoadStorePatch patch;
+        if (fread(&patch, sizeof(patch), 1, file) != 1) return false;
+
+        // everything here is jumped to or written over once the access faults
+        s64 rewritten = (s64)patch.Location + patch.PatchOffset;
+        if (!IsUsedCode(patch.Location, 4) || rewritten < 0
+            || patch.PatchSize < 4 || (patch.PatchSize & 3) || !IsUsedCode(rewritten, patch.PatchSize))
+            return false;
+        // either a generic patch function or the slow path of an LDM/STM
+        if (patch.PatchFunc < 0 ? !IsPatchFunc(GetRXBase() + patch.PatchFunc) : !IsUsedCode(patch.PatchFunc, 4))
+            return false;
+
+        LoadStorePatch& loaded = LoadStorePatches[patch.Location];
+        loaded.PatchFunc = GetRXBase() + patch.PatchFunc;
+        loaded.PatchOffset = patch.PatchOffset;
+        loaded.PatchSize = patch.PatchSize;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        u32 numRelocs;
+        if (fread(&numRelocs, 4, 1, file) != 1) return false;
+        FastMemRelocs[i].resize(numRelocs);
+        if (numRelocs && fread(FastMemRelocs[i].data(), numRelocs * 4, 1, file) != 1) return false;
+
+        u64 base = (u64)(i == 0 ? ARMJIT_Memory::FastMem9Start : ARMJIT_Memory::FastMem7Start);
+        for (u32 offset : FastMemRelocs[i])
+        {
+            if (!IsUsedCode(offset, 16)) return false;
+
+            // replace the immediates of the movz/movk sequence
+            u32* instrs = (u32*)(rwBase + offset);
+            for (int j = 0; j < 4; j++)
+                instrs[j] = (instrs[j] & ~(0xFFFF << 5)) | (((base >> (j * 16)) & 0xFFFF) << 5);
+        }
+    }
+
+    for (u32 i = 0; i < NumCodeSegments; i++)
+    {
+        u8* mainStart = GetRXBase() + i * SegmentMainSize;
+        u8* secondaryStart = GetRXBase() + JitMemMainSize + i * SegmentSecondarySize;
+        FlushIcacheSection(mainStart, mainStart + SegmentMainUsed[i]);
+        FlushIcacheSection(secondaryStart, secondaryStart + SegmentSecondaryUsed[i]);
+    }
+
+    CurSegment = header[3];
+    SetCodePtr(CurSegment * SegmentMainSize + SegmentMainUsed[CurSegment]);
+    OtherCodeRegion = JitMemMainSize + CurSegment * SegmentSecondarySize + SegmentSecondaryUsed[CurSegment];
+
+    return true;
+}
+
 u8* Compiler::RewriteMemAccess(u8* pc)
 {
     ptrdiff_t pcOffset = pc - GetRXBase();
@@ -62,38 +249,31 @@ u8* Compiler::RewriteMemAccess(u8* pc)
 
 bool Compiler::Comp_MemLoadLiteral(int size, bool signExtend, int rd, u32 addr)
 {
-    u32 localAddr = LocaliseCodeAddress(Num, addr);
-
-    int invalidLiteralIdx = InvalidLiterals.Find(localAddr);
-    if (invalidLiteralIdx != -1)
+    // it was read while tracing, unless it's overwritten inside the block
+    if (!CurInstr.LoadsLiteral)
     {
         return false;
     }
 
     Comp_AddCycles_CDI();
 
-    u32 val;
-    // make sure arm7 bios is accessible
-    u32 tmpR15 = CurCPU->R[15];
-    CurCPU->R[15] = R15;
+    u32 val = CurInstr.LiteralValue;
     if (size == 32)
     {
-        CurCPU->DataRead32(addr & ~0x3, &val);
         val = ::ROR(val, (addr & 0x3) << 3);
     }
     else if (size == 16)
     {
-        CurCPU->DataRead16(addr & ~0x1, &val);
+        val = (val >> ((addr & 0x2) << 3)) & 0xFFFF;
         if (signExtend)
             val = ((s32)val << 16) >> 16;
     }
     else
     {
-        CurCPU->DataRead8(addr, &val);
+        val = (val >> ((addr & 0x3) << 3)) & 0xFF;
         if (signExtend)
             val = ((s32)val << 24) >> 24;
     }
-    CurCPU->R[15] = tmpR15;
 
     MOVI2R(MapReg(rd), val);
 
@@ -188,7 +368,7 @@ void Compiler::Comp_MemAccess(int rd, int rn, Op2 offset, int size, int flags)
         ? ARMJIT_Memory::ClassifyAddress9(addrIsStatic ? staticAddress : CurInstr.DataRegion)
         : ARMJIT_Memory::ClassifyAddress7(addrIsStatic ? staticAddress : CurInstr.DataRegion);
 
-    if (ARMJIT::FastMemory && ((!Thumb && CurInstr.Cond() != 0xE) || ARMJIT_Memory::IsFastmemCompatible(expectedTarget)))
+    if (ARMJIT::FastMemory && ((!Thumb && CurInstr.Cond() != 0xE) || ARMJIT_Memory::IsFastmemCompatible(expectedTarget, flags & memop_Store)))
     {
         ptrdiff_t memopStart = GetCodeOffset();
         LoadStorePatch patch;
@@ -498,7 +678,7 @@ s32 Compiler::Comp_MemAccessBlock(int rn, BitSet16 regs, bool store, bool preinc
         : ARMJIT_Memory::ClassifyAddress7(CurInstr.DataRegion);
 
     bool compileFastPath = ARMJIT::FastMemory
-        && store && !usermode && (CurInstr.Cond() < 0xE || ARMJIT_Memory::IsFastmemCompatible(expectedTarget));
+        && store && !usermode && (CurInstr.Cond() < 0xE || ARMJIT_Memory::IsFastmemCompatible(expectedTarget, store));
 
     {
         s32 offset = decrement
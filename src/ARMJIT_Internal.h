@@ -59,6 +59,9 @@ struct FetchedInstr
 
     u8 BranchFlags;
     u8 SetFlags;
+    // only for the last instruction of a block, registers which
+    // the code after it overwrites before reading them
+    u16 DeadRegs;
     u32 Instr;
     u32 Addr;
 
@@ -66,6 +69,13 @@ struct FetchedInstr
     u16 CodeCycles;
     u32 DataRegion;
 
+    // everything else compiling the instruction would need the cpu for
+    // is looked up while tracing, so that it can be done on another thread
+    bool LoadsLiteral;
+    u32 LiteralValue; // the whole aligned word
+    u8 BranchRegionCodeCycles;
+    u16 BranchCycles;
+
     ARMInstrInfo::Info Info;
 };
 
@@ -171,35 +181,71 @@ struct __attribute__((packed)) TinyVector
     }
 };
 
+extern u32* BlockData;
+
+/*
+    Blocks are first compiled without most optimisations (tier 0), which is
+    quicker. They count their executions down and once they're hot, they're
+    compiled again with everything (tier 1). The counters are shared between
+    blocks whose addresses are the same in the lower bits.
+*/
+const u32 HotCountersSize = 0x4000;
+const u16 HotThreshold = 256;
+extern u16 HotCounters[HotCountersSize];
+
+inline u16* HotCounter(u32 localAddr)
+{
+    return &HotCounters[(localAddr >> 1) & (HotCountersSize - 1)];
+}
+
+/*
+    The code memory is split into segments, which are filled one after another.
+    Once the last one is full, the oldest one is emptied and reused, only the
+    blocks inside of it need to be compiled again.
+*/
+const u32 NumCodeSegments = 8;
+
+enum
+{
+    blockStatus_Free = 0,
+    blockStatus_Active,
+    blockStatus_Retired,
+    // still being compiled in the background
+    blockStatus_Pending,
+    // invalidated before the compiled code arrived
+    blockStatus_Cancelled,
+};
+
+// blocks are allocated in chunks and refer to each other by index (starting at 1,
+// 0 means none), their address ranges, masks and literals are packed into BlockData
 class JitBlock
 {
 public:
-    JitBlock(u32 num, u32 literalHash, u32 numAddresses, u32 numLiterals)
-    {
-        Num = num;
-        NumAddresses = numAddresses;
-        NumLiterals = numLiterals;
-        Data.SetLength(numAddresses * 2 + numLiterals);
-    }
-
     u32 StartAddr;
     u32 StartAddrLocal;
     u32 InstrHash, LiteralHash;
     u8 Num;
+    u8 Status;
     u16 NumAddresses;
     u16 NumLiterals;
+    u8 Tier;
+
+    u32 Index;
+    u32 DataOffset;
+    // next block in the same bucket of the block index
+    // or of the restore candidates once it's retired
+    u32 Next;
+    // first of the exits linked to this block
+    u32 Links;
 
     JitBlockEntry EntryPoint;
 
     u32* AddressRanges()
-    { return &Data[0]; }
+    { return &BlockData[DataOffset]; }
     u32* AddressMasks()
-    { return &Data[NumAddresses]; }
+    { return &BlockData[DataOffset + NumAddresses]; }
     u32* Literals()
-    { return &Data[NumAddresses * 2]; }
-
-private:
-    TinyVector<u32> Data;
+    { return &BlockData[DataOffset + NumAddresses * 2]; }
 };
 
 // size should be 16 bytes because I'm to lazy to use mul and whatnot
@@ -230,8 +276,12 @@ inline bool PageContainsCode(AddressRange* range)
 
 u32 LocaliseCodeAddress(u32 num, u32 addr);
 
-template <u32 Num>
-void LinkBlock(ARM* cpu, u32 codeOffset);
+// whether a block exit to addr may be linked to the block there
+bool CanLinkTo(u32 num, u32 addr);
+
+// to be held while modifying the code memory, if blocks are compiled in the background
+void LockCompiler();
+void UnlockCompiler();
 
 template <typename T, int ConsoleType> T SlowRead9(u32 addr, ARMv5* cpu);
 template <typename T, int ConsoleType> void SlowWrite9(u32 addr, ARMv5* cpu, u32 val);
@@ -259,7 +259,10 @@ const u32 MemBlockDTCMOffset = MemBlockARM7WRAMOffset + RoundUp(NDS::ARM7WRAMSiz
 const u32 MemBlockNWRAM_AOffset = MemBlockDTCMOffset + RoundUp(DTCMPhysicalSize);
 const u32 MemBlockNWRAM_BOffset = MemBlockNWRAM_AOffset + RoundUp(DSi::NWRAMSize);
 const u32 MemBlockNWRAM_COffset = MemBlockNWRAM_BOffset + RoundUp(DSi::NWRAMSize);
-const u32 MemoryTotalSize = MemBlockNWRAM_COffset + RoundUp(DSi::NWRAMSize);
+const u32 MemBlockVRAMOffset = MemBlockNWRAM_COffset + RoundUp(DSi::NWRAMSize);
+// the VRAM banks are laid out like in the LCDC region
+const u32 VRAMTotalSize = 0xA4000;
+const u32 MemoryTotalSize = MemBlockVRAMOffset + RoundUp(VRAMTotalSize);
 
 const u32 OffsetsPerRegion[memregions_Count] =
 {
@@ -270,12 +273,12 @@ const u32 OffsetsPerRegion[memregions_Count] =
     MemBlockMainRAMOffset,
     MemBlockSWRAMOffset,
     UINT32_MAX,
-    UINT32_MAX,
+    MemBlockVRAMOffset,
     UINT32_MAX,
     MemBlockARM7WRAMOffset,
     UINT32_MAX,
     UINT32_MAX,
-    UINT32_MAX,
+    MemBlockVRAMOffset,
     UINT32_MAX,
     UINT32_MAX,
     MemBlockNWRAM_AOffset,
@@ -440,6 +443,10 @@ ARMJIT::TinyVector<Mapping> Mappings[memregions_Count];
 
 void SetCodeProtection(int region, u32 offset, bool protect)
 {
+    // VRAM is always mapped read only
+    if (region == memregion_VRAM || region == memregion_VWRAM)
+        return;
+
     offset &= ~0xFFF;
     //printf("set code protection %d %x %d\n", region, offset, protect);
 
@@ -544,6 +551,8 @@ void RemapNWRAM(int num)
         Mappings[memregion_NewSharedWRAM_A + num][i].Unmap(memregion_NewSharedWRAM_A + num);
     }
     Mappings[memregion_NewSharedWRAM_A + num].Clear();
+
+    ARMJIT::UnlinkAllBlocks();
 }
 
 void RemapSWRAM()
@@ -565,6 +574,31 @@ void RemapSWRAM()
         Mappings[memregion_SharedWRAM][i].Unmap(memregion_SharedWRAM);
     }
     Mappings[memregion_SharedWRAM].Clear();
+
+    ARMJIT::UnlinkAllBlocks();
+}
+
+void RemapVRAM()
+{
+    // only throw away the pages which are now backed by another bank (or none at all)
+    for (int region : {memregion_VRAM, memregion_VWRAM})
+    {
+        for (int i = 0; i < Mappings[region].Length;)
+        {
+            Mapping& mapping = Mappings[region][i];
+            u32 memoryOffset, mirrorStart, mirrorSize;
+            if (GetVRAMMirrorLocation(mapping.Num, mapping.Addr, memoryOffset, mirrorStart, mirrorSize)
+                && memoryOffset == mapping.LocalOffset)
+            {
+                i++;
+            }
+            else
+            {
+                mapping.Unmap(region);
+                Mappings[region].Remove(i);
+            }
+        }
+    }
 }
 
 bool MapAtAddress(u32 addr)
@@ -575,17 +609,23 @@ bool MapAtAddress(u32 addr)
         ? ClassifyAddress9(addr)
         : ClassifyAddress7(addr);
 
-    if (!IsFastmemCompatible(region))
+    if (!IsFastmemCompatible(region, false))
         return false;
 
+    // VRAM is mapped read only, writes fault and are then rewritten
+    // to the slow path which keeps track of the dirty pages
+    bool isVRAM = region == memregion_VRAM || region == memregion_VWRAM;
+
     u32 mirrorStart, mirrorSize, memoryOffset;
-    bool isMapped = GetMirrorLocation(region, num, addr, memoryOffset, mirrorStart, mirrorSize);
+    bool isMapped = isVRAM
+        ? GetVRAMMirrorLocation(num, addr, memoryOffset, mirrorStart, mirrorSize)
+        : GetMirrorLocation(region, num, addr, memoryOffset, mirrorStart, mirrorSize);
     if (!isMapped)
         return false;
 
     u8* states = num == 0 ? MappingStatus9 : MappingStatus7;
     //printf("mapping mirror %x, %x %x %d %d\n", mirrorStart, mirrorSize, memoryOffset, region, num);
-    bool isExecutable = ARMJIT::CodeMemRegions[region];
+    bool isExecutable = !isVRAM && ARMJIT::CodeMemRegions[region];
 
     u32 dtcmStart = NDS::ARM9->DTCMBase;
     u32 dtcmSize = ~NDS::ARM9->DTCMMask + 1;
@@ -635,7 +675,7 @@ bool MapAtAddress(u32 addr)
         else
         {
             u32 sectionOffset = offset;
-            bool hasCode = isExecutable && ARMJIT::PageContainsCode(&range[offset / 512]);
+            bool hasCode = isVRAM || (isExecutable && ARMJIT::PageContainsCode(&range[offset / 512]));
             while (offset < mirrorSize
                 && (!isExecutable || ARMJIT::PageContainsCode(&range[offset / 512]) == hasCode)
                 && (!skipDTCM || mirrorStart + offset != NDS::ARM9->DTCMBase))
@@ -684,7 +724,11 @@ bool FaultHandler(FaultDescription& faultDesc)
             rewriteToSlowPath = !MapAtAddress(faultDesc.EmulatedFaultAddr);
 
         if (rewriteToSlowPath)
+        {
+            ARMJIT::LockCompiler();
             faultDesc.FaultPC = ARMJIT::JITCompiler->RewriteMemAccess(faultDesc.FaultPC);
+            ARMJIT::UnlockCompiler();
+        }
 
         return true;
     }
@@ -802,6 +846,13 @@ void Init()
     DSi::NWRAM_A = basePtr + MemBlockNWRAM_AOffset;
     DSi::NWRAM_B = basePtr + MemBlockNWRAM_BOffset;
     DSi::NWRAM_C = basePtr + MemBlockNWRAM_COffset;
+
+    u8* vram = basePtr + MemBlockVRAMOffset;
+    for (int i = 0; i < 9; i++)
+    {
+        GPU::VRAM[i] = vram;
+        vram += GPU::VRAMMask[i] + 1;
+    }
 }
 
 void DeInit()
@@ -848,8 +899,18 @@ void Reset()
     printf("done resetting jit mem\n");
 }
 
-bool IsFastmemCompatible(int region)
+bool IsFastmemCompatible(int region, bool store)
 {
+    // stores to VRAM would always fault
+    // so they should directly use the slow path
+    if (store && (region == memregion_VRAM || region == memregion_VWRAM))
+        return false;
+#if defined(_WIN32) || defined(__SWITCH__)
+    // VRAM is mapped in read only 16 KB pieces which neither fits
+    // the 64 KB granularity on Windows nor the Switch' memory mapping
+    if (region == memregion_VRAM || region == memregion_VWRAM)
+        return false;
+#endif
 #ifdef _WIN32
     /*
         TODO: with some hacks, the smaller shared WRAM regions
@@ -1003,6 +1064,54 @@ bool GetMirrorLocation(int region, u32 num, u32 addr, u32& memoryOffset, u32& mi
     }
 }
 
+bool GetVRAMMirrorLocation(u32 num, u32 addr, u32& memoryOffset, u32& mirrorStart, u32& mirrorSize)
+{
+    // we can only map pages which are backed by exactly one bank
+    u8* ptr = NULL;
+    if (num == 0)
+    {
+        mirrorStart = addr & ~0x3FFF;
+        mirrorSize = 0x4000;
+        switch (addr & 0x00E00000)
+        {
+        case 0x00000000: ptr = GPU::VRAMPtr_ABG[(addr >> 14) & 0x1F]; break;
+        case 0x00200000: ptr = GPU::VRAMPtr_BBG[(addr >> 14) & 0x7]; break;
+        case 0x00400000: ptr = GPU::VRAMPtr_AOBJ[(addr >> 14) & 0xF]; break;
+        case 0x00600000: ptr = GPU::VRAMPtr_BOBJ[(addr >> 14) & 0x7]; break;
+        default:
+            {
+                u32 offset = addr & 0xFFFFF;
+                if (offset < VRAMTotalSize)
+                {
+                    u32 page = offset >> 14;
+                    int bank = page < 32 ? page >> 3
+                        : page < 36 ? 4
+                        : page < 38 ? page - 31
+                        : page < 40 ? 7 : 8;
+                    if (GPU::VRAMMap_LCDC & (1 << bank))
+                        ptr = GPU::VRAM_A + (offset & ~0x3FFF);
+                }
+            }
+            break;
+        }
+    }
+    else
+    {
+        mirrorStart = addr & ~0x1FFFF;
+        mirrorSize = 0x20000;
+        u32 mask = GPU::VRAMMap_ARM7[(addr >> 17) & 0x1];
+        if (mask == (1<<2) || mask == (1<<3))
+            ptr = GPU::VRAM[__builtin_ctz(mask)];
+    }
+
+    if (ptr)
+    {
+        memoryOffset = ptr - GPU::VRAM_A;
+        return true;
+    }
+    return false;
+}
+
 u32 LocaliseAddress(int region, u32 num, u32 addr)
 {
     switch (region)
@@ -1181,6 +1290,7 @@ u32 WifiRead32(u32 addr)
 template <typename T>
 void VRAMWrite(u32 addr, T val)
 {
+    NDS::ARM9->SlowMemAccesses++;
     switch (addr & 0x00E00000)
     {
     case 0x00000000: GPU::WriteVRAM_ABG<T>(addr, val); return;
@@ -1193,6 +1303,7 @@ void VRAMWrite(u32 addr, T val)
 template <typename T>
 T VRAMRead(u32 addr)
 {
+    NDS::ARM9->SlowMemAccesses++;
     switch (addr & 0x00E00000)
     {
     case 0x00000000: return GPU::ReadVRAM_ABG<T>(addr);
@@ -1203,6 +1314,19 @@ T VRAMRead(u32 addr)
     }
 }
 
+template <typename T>
+void VWRAMWrite(u32 addr, T val)
+{
+    NDS::ARM7->SlowMemAccesses++;
+    GPU::WriteVRAM_ARM7<T>(addr, val);
+}
+template <typename T>
+T VWRAMRead(u32 addr)
+{
+    NDS::ARM7->SlowMemAccesses++;
+    return GPU::ReadVRAM_ARM7<T>(addr);
+}
+
 void* GetFuncForAddr(ARM* cpu, u32 addr, bool store, int size)
 {
     if (cpu->Num == 0)
@@ -1329,12 +1453,12 @@ void* GetFuncForAddr(ARM* cpu, u32 addr, bool store, int size)
         case 0x06800000:
             switch (size | store)
             {
-            case 8: return (void*)GPU::ReadVRAM_ARM7<u8>;
-            case 9: return (void*)GPU::WriteVRAM_ARM7<u8>;
-            case 16: return (void*)GPU::ReadVRAM_ARM7<u16>;
-            case 17: return (void*)GPU::WriteVRAM_ARM7<u16>;
-            case 32: return (void*)GPU::ReadVRAM_ARM7<u32>;
-            case 33: return (void*)GPU::WriteVRAM_ARM7<u32>;
+            case 8: return (void*)VWRAMRead<u8>;
+            case 9: return (void*)VWRAMWrite<u8>;
+            case 16: return (void*)VWRAMRead<u16>;
+            case 17: return (void*)VWRAMWrite<u16>;
+            case 32: return (void*)VWRAMRead<u32>;
+            case 33: return (void*)VWRAMWrite<u32>;
             }
         }
     }
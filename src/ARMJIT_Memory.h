@@ -64,13 +64,15 @@ int ClassifyAddress9(u32 addr);
 int ClassifyAddress7(u32 addr);
 
 bool GetMirrorLocation(int region, u32 num, u32 addr, u32& memoryOffset, u32& mirrorStart, u32& mirrorSize);
+bool GetVRAMMirrorLocation(u32 num, u32 addr, u32& memoryOffset, u32& mirrorStart, u32& mirrorSize);
 u32 LocaliseAddress(int region, u32 num, u32 addr);
 
-bool IsFastmemCompatible(int region);
+bool IsFastmemCompatible(int region, bool store);
 
 void RemapDTCM(u32 newBase, u32 newSize);
 void RemapSWRAM();
 void RemapNWRAM(int num);
+void RemapVRAM();
 
 void SetCodeProtection(int region, u32 offset, bool protect);
 
@@ -115,6 +115,14 @@ public:
         LiteralsLoaded = 0;
     }
 
+    // at the end of the block, registers which the code
+    // after it overwrites don't need to be saved
+    void FlushExit()
+    {
+        DirtyRegs &= ~Instrs[InstrsCount - 1].DeadRegs;
+        Flush();
+    }
+
     void Prepare(bool thumb, int i)
     {
         FetchedInstr instr = Instrs[i];
@@ -141,6 +149,7 @@ public:
 
         // we'll unload all registers which are never used again
         BitSet16 neverNeededAgain(LoadedRegs & ~futureNeeded);
+        DirtyRegs &= ~(neverNeededAgain.m_val & Instrs[InstrsCount - 1].DeadRegs);
         for (int reg : neverNeededAgain)
             UnloadRegister(reg);
 
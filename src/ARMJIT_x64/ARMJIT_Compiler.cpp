@@ -23,6 +23,8 @@
 #include <assert.h>
 #include <stdarg.h>
 
+#include <algorithm>
+
 #include "../dolphin/CommonFuncs.h"
 
 #ifdef _WIN32
@@ -260,7 +262,7 @@ Compiler::Compiler()
         CodeMemSize = alignedSize;
     }
 
-    Reset();
+    SetCodePtr(ResetStart);
 
     {
         // RSCRATCH mode
@@ -465,11 +467,13 @@ Compiler::Compiler()
     CodeMemSize -= GetWritableCodePtr() - ResetStart;
     ResetStart = GetWritableCodePtr();
 
-    NearStart = ResetStart;
-    FarStart = ResetStart + 1024*1024*24;
+    MaxCodeMemSize = CodeMemSize;
 
-    NearSize = FarStart - ResetStart;
-    FarSize = (ResetStart + CodeMemSize) - FarStart;
+    NearStart = FarStart = ResetStart;
+    SegmentNearSize = SegmentFarSize = 0;
+    memset(SegmentNearUsed, 0, sizeof(SegmentNearUsed));
+    memset(SegmentFarUsed, 0, sizeof(SegmentFarUsed));
+    SetCodeMemorySize(MaxCodeMemSize);
 }
 
 void Compiler::LoadCPSR()
@@ -655,13 +659,89 @@ bool Compiler::CanCompile(bool thumb, u16 kind)
 
 void Compiler::Reset()
 {
-    memset(ResetStart, 0xcc, CodeMemSize);
-    SetCodePtr(ResetStart);
+    // only what was used is cleared, the pages which never
+    // held any code don't need to be backed by memory
+    for (u32 i = 0; i < NumCodeSegments; i++)
+    {
+        memset(NearStart + i * SegmentNearSize, 0xcc, SegmentNearUsed[i]);
+        memset(FarStart + i * SegmentFarSize, 0xcc, SegmentFarUsed[i]);
+        SegmentNearUsed[i] = 0;
+        SegmentFarUsed[i] = 0;
+    }
+
+    CurSegment = 0;
+    SetCodePtr(NearStart);
 
     NearCode = NearStart;
     FarCode = FarStart;
 
     LoadStorePatches.clear();
+    FastMemRelocs[0].clear();
+    FastMemRelocs[1].clear();
+}
+
+void Compiler::SetCodeMemorySize(u32 size)
+{
+    Reset();
+
+    // same split between near and far code as before
+    CodeMemSize = std::min(size, MaxCodeMemSize);
+    SegmentNearSize = (CodeMemSize / NumCodeSegments / 4 * 3) & ~0xF;
+    SegmentFarSize = (CodeMemSize / NumCodeSegments - SegmentNearSize) & ~0xF;
+
+    NearStart = ResetStart;
+    NearSize = SegmentNearSize * NumCodeSegments;
+    FarStart = NearStart + NearSize;
+    FarSize = SegmentFarSize * NumCodeSegments;
+
+    Reset();
+}
+
+u32 Compiler::GetCodeMemoryUsed()
+{
+    u32 used = 0;
+    for (u32 i = 0; i < NumCodeSegments; i++)
+        used += SegmentNearUsed[i] + SegmentFarUsed[i];
+    return used;
+}
+
+u32 Compiler::CodeSegment(u32 offset)
+{
+    u8* code = ResetStart + offset;
+    if (code < FarStart)
+        return (code - NearStart) / SegmentNearSize;
+    return (code - FarStart) / SegmentFarSize;
+}
+
+void Compiler::StartCodeSegment(u32 segment)
+{
+    u8* nearStart = NearStart + segment * SegmentNearSize;
+    u8* farStart = FarStart + segment * SegmentFarSize;
+
+    memset(nearStart, 0xcc, SegmentNearUsed[segment]);
+    memset(farStart, 0xcc, SegmentFarUsed[segment]);
+    SegmentNearUsed[segment] = 0;
+    SegmentFarUsed[segment] = 0;
+
+    for (auto it = LoadStorePatches.begin(); it != LoadStorePatches.end();)
+    {
+        if (CodeSegment(it->first - ResetStart) == segment)
+            it = LoadStorePatches.erase(it);
+        else
+            it++;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        FastMemRelocs[i].erase(std::remove_if(FastMemRelocs[i].begin(), FastMemRelocs[i].end(),
+            [this, segment](u32 offset) { return CodeSegment(offset) == segment; }),
+            FastMemRelocs[i].end());
+    }
+
+    CurSegment = segment;
+    SetCodePtr(nearStart);
+
+    NearCode = nearStart;
+    FarCode = farStart;
 }
 
 bool Compiler::IsJITFault(u8* addr)
@@ -669,6 +749,165 @@ bool Compiler::IsJITFault(u8* addr)
     return (u64)addr >= (u64)ResetStart && (u64)addr < (u64)ResetStart + CodeMemSize;
 }
 
+void Compiler::Comp_FastMemBase(X64Reg reg)
+{
+    // always a full mov r64, imm64, the fast memory
+    // base is patched when the code is loaded from disk
+    Write8(0x48 | (reg >> 3));
+    Write8(0xB8 | (reg & 0x7));
+    FastMemRelocs[Num].push_back(GetWritableCodePtr() - ResetStart);
+    Write64((u64)(Num == 0 ? ARMJIT_Memory::FastMem9Start : ARMJIT_Memory::FastMem7Start));
+}
+
+struct SavedLoadStorePatch
+{
+    u32 Location;
+    s32 PatchFunc;
+    s16 Offset;
+    u16 Size;
+};
+
+bool Compiler::IsUsedCode(u32 offset, u32 size)
+{
+    u64 start = offset;
+    u64 end = start + size;
+    for (u32 i = 0; i < NumCodeSegments; i++)
+    {
+        u64 nearStart = (NearStart - ResetStart) + (u64)i * SegmentNearSize;
+        u64 farStart = (FarStart - ResetStart) + (u64)i * SegmentFarSize;
+        if ((start >= nearStart && end <= nearStart + SegmentNearUsed[i])
+            || (start >= farStart && end <= farStart + SegmentFarUsed[i]))
+            return true;
+    }
+    return false;
+}
+
+bool Compiler::IsPatchFunc(void* func)
+{
+    for (int consoleType = 0; consoleType < 2; consoleType++)
+    {
+        for (int num = 0; num < 2; num++)
+        {
+            for (int size = 0; size < 3; size++)
+            {
+                for (int reg = 0; reg < 16; reg++)
+                {
+                    if (func && (func == PatchedStoreFuncs[consoleType][num][size][reg]
+                        || func == PatchedLoadFuncs[consoleType][num][size][0][reg]
+                        || func == PatchedLoadFuncs[consoleType][num][size][1][reg]))
+                        return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool Compiler::SaveCode(FILE* file)
+{
+    u32 header[4] = {SegmentNearSize, SegmentFarSize, NumCodeSegments, CurSegment};
+    if (fwrite(header, sizeof(header), 1, file) != 1) return false;
+    if (fwrite(SegmentNearUsed, sizeof(SegmentNearUsed), 1, file) != 1) return false;
+    if (fwrite(SegmentFarUsed, sizeof(SegmentFarUsed), 1, file) != 1) return false;
+
+    for (u32 i = 0; i < NumCodeSegments; i++)
+    {
+        if (SegmentNearUsed[i] && fwrite(NearStart + i * SegmentNearSize, SegmentNearUsed[i], 1, file) != 1) return false;
+        if (SegmentFarUsed[i] && fwrite(FarStart + i * SegmentFarSize, SegmentFarUsed[i], 1, file) != 1) return false;
+    }
+
+    // the patch functions are generated in front of the block code
+    u32 numPatches = LoadStorePatches.size();
+    if (fwrite(&numPatches, 4, 1, file) != 1) return false;
+    for (auto it : LoadStorePatches)
+    {
+        SavedLoadStorePatch patch;
+        patch.Location = it.first - ResetStart;
+        patch.PatchFunc = (u8*)it.second.PatchFunc - ResetStart;
+        patch.Offset = it.second.Offset;
+        patch.Size = it.second.Size;
+        if (fwrite(&patch, sizeof(patch), 1, file) != 1) return false;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        u32 numRelocs = FastMemRelocs[i].size();
+        if (fwrite(&numRelocs, 4, 1, file) != 1) return false;
+        if (numRelocs && fwrite(FastMemRelocs[i].data(), numRelocs * 4, 1, file) != 1) return false;
+    }
+
+    return true;
+}
+
+bool Compiler::LoadCode(FILE* file)
+{
+    u32 header[4];
+    if (fread(header, sizeof(header), 1, file) != 1) return false;
+    if (header[0] != SegmentNearSize || header[1] != SegmentFarSize) return false;
+    if (header[2] != NumCodeSegments || header[3] >= NumCodeSegments) return false;
+
+    u32 nearUsed[NumCodeSegments], farUsed[NumCodeSegments];
+    if (fread(nearUsed, sizeof(nearUsed), 1, file) != 1) return false;
+    if (fread(farUsed, sizeof(farUsed), 1, file) != 1) return false;
+    for (u32 i = 0; i < NumCodeSegments; i++)
+    {
+        if (nearUsed[i] > SegmentNearSize || farUsed[i] > SegmentFarSize) return false;
+    }
+
+    // set right away, so that whatever was read is cleared again if something fails
+    memcpy(SegmentNearUsed, nearUsed, sizeof(nearUsed));
+    memcpy(SegmentFarUsed, farUsed, sizeof(farUsed));
+
+    for (u32 i = 0; i < NumCodeSegments; i++)
+    {
+        if (SegmentNearUsed[i] && fread(NearStart + i * SegmentNearSize, SegmentNearUsed[i], 1, file) != 1) return false;
+        if (SegmentFarUsed[i] && fread(FarStart + i * SegmentFarSize, SegmentFarUsed[i], 1, file) != 1) return false;
+    }
+
+    u32 numPatches;
+    if (fread(&numPatches, 4, 1, file) != 1) return false;
+    for (u32 i = 0; i < numPatches; i++)
+    {
+        SavedLoadStorePatch patch;
+        if (fread(&patch, sizeof(patch), 1, file) != 1) return false;
+
+        // everything here is jumped to or written over once the access faults
+        s64 rewritten = (s64)patch.Location + patch.Offset;
+        if (!IsUsedCode(patch.Location, 1) || rewritten < 0
+            || patch.Size < 5 || !IsUsedCode(rewritten, patch.Size))
+            return false;
+        // either a generic patch function or the slow path of an LDM/STM
+        if (patch.PatchFunc < 0 ? !IsPatchFunc(ResetStart + patch.PatchFunc) : !IsUsedCode(patch.PatchFunc, 1))
+            return false;
+
+        LoadStorePatch& loaded = LoadStorePatches[ResetStart + patch.Location];
+        loaded.PatchFunc = ResetStart + patch.PatchFunc;
+        loaded.Offset = patch.Offset;
+        loaded.Size = patch.Size;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        u32 numRelocs;
+        if (fread(&numRelocs, 4, 1, file) != 1) return false;
+        FastMemRelocs[i].resize(numRelocs);
+        if (numRelocs && fread(FastMemRelocs[i].data(), numRelocs * 4, 1, file) != 1) return false;
+
+        u8* base = (u8*)(i == 0 ? ARMJIT_Memory::FastMem9Start : ARMJIT_Memory::FastMem7Start);
+        for (u32 offset : FastMemRelocs[i])
+        {
+            if (!IsUsedCode(offset, 8)) return false;
+            memcpy(ResetStart + offset, &base, 8);
+        }
+    }
+
+    CurSegment = header[3];
+    SetCodePtr(NearStart + CurSegment * SegmentNearSize + SegmentNearUsed[CurSegment]);
+    FarCode = FarStart + CurSegment * SegmentFarSize + SegmentFarUsed[CurSegment];
+
+    return true;
+}
+
 void Compiler::Comp_SpecialBranchBehaviour(bool taken)
 {
     if (taken && CurInstr.BranchFlags & branch_IdleBranch)
@@ -685,6 +924,58 @@ void Compiler::Comp_SpecialBranchBehaviour(bool taken)
     }
 }
 
+/*
+    Block linking
+
+    If the block after this one is always the same, the exit does what the
+    dispatcher would do before entering the next block itself. The first time
+    it's taken it goes back to the dispatcher, leaving the location of the
+    jump in LinkSite, which is then patched to go directly to the next block.
+*/
+void Compiler::Comp_LinkableExit()
+{
+    CMP(32, MDisp(RCPU, offsetof(ARM, StopExecution)), Imm8(0));
+    J_CC(CC_NZ, (u8*)&ARM_Ret);
+
+    // relative, so that the code can be stored in the block cache
+    OpArg timestamp = M(Num == 0 ? &NDS::ARM9Timestamp : &NDS::ARM7Timestamp);
+    MOVSX(64, 32, RSCRATCH, MDisp(RCPU, offsetof(ARM, Cycles)));
+    ADD(64, R(RSCRATCH), timestamp);
+    MOV(64, timestamp, R(RSCRATCH));
+    MOV(32, MDisp(RCPU, offsetof(ARM, Cycles)), Imm32(0));
+
+    CMP(64, R(RSCRATCH), M(Num == 0 ? &NDS::ARM9Target : &NDS::ARM7Target));
+    J_CC(CC_AE, (u8*)&ARM_Ret);
+
+    // jumps either to the code below or to the linked path right after it
+    u8* site = GetWritableCodePtr();
+    FixupBranch unlinked = J(true);
+
+    ADD(64, MDisp(RCPU, offsetof(ARM, LinkHits)), Imm8(1));
+    // patched to jump to the next block
+    JMP((u8*)&ARM_Ret, true);
+
+    SetJumpTarget(unlinked);
+    MOV(32, MDisp(RCPU, offsetof(ARM, LinkSite)), Imm32(SubEntryOffset((JitBlockEntry)site)));
+    JMP((u8*)&ARM_Ret, true);
+}
+
+u32 Compiler::LinkExit(u32 site, JitBlockEntry target)
+{
+    u8* sitePtr = ResetStart + site;
+    u8* unlinked = sitePtr + 5 + *(s32*)(sitePtr + 1);
+
+    XEmitter(unlinked - 5).JMP((u8*)target, true);
+    XEmitter(sitePtr).JMP(sitePtr + 5, true);
+
+    return unlinked - ResetStart;
+}
+
+void Compiler::UnlinkExit(u32 site, u32 unlinked)
+{
+    XEmitter(ResetStart + site).JMP(ResetStart + unlinked, true);
+}
+
 #ifdef JIT_PROFILING_ENABLED
 void Compiler::CreateMethod(const char* namefmt, void* start, ...)
 {
@@ -707,19 +998,15 @@ void Compiler::CreateMethod(const char* namefmt, void* start, ...)
 }
 #endif
 
-JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, bool hasMemoryInstr)
+bool Compiler::IsFull()
 {
-    if (NearSize - (GetCodePtr() - NearStart) < 1024 * 32) // guess...
-    {
-        printf("near reset\n");
-        ResetBlockCache();
-    }
-    if (FarSize - (FarCode - FarStart) < 1024 * 32) // guess...
-    {
-        printf("far reset\n");
-        ResetBlockCache();
-    }
+    // guess...
+    return NearStart + (CurSegment + 1) * SegmentNearSize - GetCodePtr() < 1024 * 32
+        || FarStart + (CurSegment + 1) * SegmentFarSize - FarCode < 1024 * 32;
+}
 
+JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, bool hasMemoryInstr, u16* hotCounter)
+{
     ConstantCycles = 0;
     Thumb = thumb;
     Num = cpu->Num;
@@ -730,6 +1017,18 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
 
     JitBlockEntry res = (JitBlockEntry)GetWritableCodePtr();
 
+    if (hotCounter)
+    {
+        // once it's hot, return right away to be compiled again
+        SUB(16, M(hotCounter), Imm8(1));
+        FixupBranch hot = J_CC(CC_Z, true);
+        SwitchToFarCode();
+        SetJumpTarget(hot);
+        MOV(8, MDisp(RCPU, offsetof(ARM, HotBlock)), Imm8(1));
+        JMP((u8*)&ARM_Ret, true);
+        SwitchToNearCode();
+    }
+
     RegCache = RegisterCache<Compiler, X64Reg>(this, instrs, instrsCount);
 
     for (int i = 0; i < instrsCount; i++)
@@ -739,6 +1038,7 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
         CodeRegion = R15 >> 24;
 
         Exit = i == instrsCount - 1 || (CurInstr.BranchFlags & branch_FollowCondNotTaken);
+        LinkableExit = false;
 
         CompileFunc comp = Thumb
             ? T_Comp[CurInstr.Info.Kind]
@@ -837,13 +1137,18 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
 
         if (comp == NULL)
             LoadCPSR();
+        else if (i == instrsCount - 1 && !CurInstr.Info.Branches())
+            LinkableExit = CanLinkTo(Num, R15 - (Thumb ? 2 : 4));
     }
 
-    RegCache.Flush();
+    RegCache.FlushExit();
 
     if (ConstantCycles)
         ADD(32, MDisp(RCPU, offsetof(ARM, Cycles)), Imm32(ConstantCycles));
-    JMP((u8*)ARM_Ret, true);
+    if (LinkableExit)
+        Comp_LinkableExit();
+    else
+        JMP((u8*)ARM_Ret, true);
 
 #ifdef JIT_PROFILING_ENABLED
     CreateMethod("JIT_Block_%d_%d_%08X", (void*)res, Num, Thumb, instrs[0].Addr);
@@ -855,6 +1160,9 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
 
     fclose(codeout);*/
 
+    SegmentNearUsed[CurSegment] = GetWritableCodePtr() - (NearStart + CurSegment * SegmentNearSize);
+    SegmentFarUsed[CurSegment] = FarCode - (FarStart + CurSegment * SegmentFarSize);
+
     return res;
 }
 
@@ -29,7 +29,9 @@
 #include <jitprofiling.h>
 #endif
 
+#include <stdio.h>
 #include <unordered_map>
+#include <vector>
 
 namespace ARMJIT
 {
@@ -83,7 +85,19 @@ public:
 
     void Reset();
 
-    JitBlockEntry CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, bool hasMemoryInstr);
+    // the part of the code memory which is used, clears it
+    void SetCodeMemorySize(u32 size);
+    u32 GetCodeMemorySize() { return NearSize + FarSize; }
+    u32 GetCodeMemoryUsed();
+
+    // whether there's too little space left in the current code segment to compile another block
+    bool IsFull();
+    u32 CodeSegment(u32 offset);
+    u32 GetCurrentCodeSegment() { return CurSegment; }
+    // throws away everything in the segment and continues compiling there
+    void StartCodeSegment(u32 segment);
+    // if hotCounter isn't NULL, the block counts its executions down there
+    JitBlockEntry CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, bool hasMemoryInstr, u16* hotCounter);
 
     void LoadReg(int reg, Gen::X64Reg nativeReg);
     void SaveReg(int reg, Gen::X64Reg nativeReg);
@@ -181,6 +195,7 @@ public:
     void Comp_RetriveFlags(bool sign, bool retriveCV, bool carryUsed);
 
     void Comp_SpecialBranchBehaviour(bool taken);
+    void Comp_LinkableExit();
 
 
     Gen::OpArg Comp_RegShiftImm(int op, int amount, Gen::OpArg rm, bool S, bool& carryUsed);
@@ -234,6 +249,18 @@ public:
 
     u8* RewriteMemAccess(u8* pc);
 
+    void Comp_FastMemBase(Gen::X64Reg reg);
+
+    bool SaveCode(FILE* file);
+    bool LoadCode(FILE* file);
+    // whether offset..offset+size lies within the code of one segment
+    bool IsUsedCode(u32 offset, u32 size);
+    bool IsPatchFunc(void* func);
+
+    // returns the offset of the code the exit jumps to when unlinked
+    u32 LinkExit(u32 site, JitBlockEntry target);
+    void UnlinkExit(u32 site, u32 unlinked);
+
 #ifdef JIT_PROFILING_ENABLED
     void CreateMethod(const char* namefmt, void* start, ...);
 #endif
@@ -250,11 +277,19 @@ public:
     void* PatchedLoadFuncs[2][2][3][2][16];
 
     std::unordered_map<u8*, LoadStorePatch> LoadStorePatches;
+    // locations of the fast memory base pointers, per CPU
+    std::vector<u32> FastMemRelocs[2];
 
     u8* ResetStart;
     u32 CodeMemSize;
+    u32 MaxCodeMemSize;
+
+    u32 CurSegment;
+    u32 SegmentNearSize, SegmentFarSize;
+    u32 SegmentNearUsed[NumCodeSegments], SegmentFarUsed[NumCodeSegments];
 
     bool Exit;
+    bool LinkableExit;
     bool IrregularCycles;
 
     void* ReadBanked;
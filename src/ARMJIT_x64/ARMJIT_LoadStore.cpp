@@ -18,6 +18,8 @@
 
 #include "ARMJIT_Compiler.h"
 
+#include <algorithm>
+
 using namespace Gen;
 
 namespace ARMJIT
@@ -48,6 +50,16 @@ u8* Compiler::RewriteMemAccess(u8* pc)
         if (remainingSize > 0)
             emitter.NOP(remainingSize);
 
+        // the fast memory base loaded in there is gone as well,
+        // so it mustn't be relocated when the code is loaded from disk
+        u32 start = pc + (ptrdiff_t)patch.Offset - ResetStart;
+        for (int i = 0; i < 2; i++)
+        {
+            FastMemRelocs[i].erase(std::remove_if(FastMemRelocs[i].begin(), FastMemRelocs[i].end(),
+                [start, &patch](u32 offset) { return offset >= start && offset < start + patch.Size; }),
+                FastMemRelocs[i].end());
+        }
+
         return pc + (ptrdiff_t)patch.Offset;
     }
 
@@ -67,38 +79,31 @@ u8* Compiler::RewriteMemAccess(u8* pc)
 
 bool Compiler::Comp_MemLoadLiteral(int size, bool signExtend, int rd, u32 addr)
 {
-    u32 localAddr = LocaliseCodeAddress(Num, addr);
-
-    int invalidLiteralIdx = InvalidLiterals.Find(localAddr);
-    if (invalidLiteralIdx != -1)
+    // it was read while tracing, unless it's overwritten inside the block
+    if (!CurInstr.LoadsLiteral)
     {
         return false;
     }
 
     Comp_AddCycles_CDI();
 
-    u32 val;
-    // make sure arm7 bios is accessible
-    u32 tmpR15 = CurCPU->R[15];
-    CurCPU->R[15] = R15;
+    u32 val = CurInstr.LiteralValue;
     if (size == 32)
     {
-        CurCPU->DataRead32(addr & ~0x3, &val);
         val = ::ROR(val, (addr & 0x3) << 3);
     }
     else if (size == 16)
     {
-        CurCPU->DataRead16(addr & ~0x1, &val);
+        val = (val >> ((addr & 0x2) << 3)) & 0xFFFF;
         if (signExtend)
             val = ((s32)val << 16) >> 16;
     }
     else
     {
-        CurCPU->DataRead8(addr, &val);
+        val = (val >> ((addr & 0x3) << 3)) & 0xFF;
         if (signExtend)
             val = ((s32)val << 24) >> 24;
     }
-    CurCPU->R[15] = tmpR15;
 
     MOV(32, MapReg(rd), Imm32(val));
 
@@ -198,7 +203,7 @@ void Compiler::Comp_MemAccess(int rd, int rn, const Op2& op2, int size, int flag
         ? ARMJIT_Memory::ClassifyAddress9(CurInstr.DataRegion)
         : ARMJIT_Memory::ClassifyAddress7(CurInstr.DataRegion);
 
-    if (ARMJIT::FastMemory && ((!Thumb && CurInstr.Cond() != 0xE) || ARMJIT_Memory::IsFastmemCompatible(expectedTarget)))
+    if (ARMJIT::FastMemory && ((!Thumb && CurInstr.Cond() != 0xE) || ARMJIT_Memory::IsFastmemCompatible(expectedTarget, flags & memop_Store)))
     {
         if (rdMapped.IsImm())
         {
@@ -216,7 +221,7 @@ void Compiler::Comp_MemAccess(int rd, int rn, const Op2& op2, int size, int flag
 
         assert(patch.PatchFunc != NULL);
 
-        MOV(64, R(RSCRATCH), ImmPtr(Num == 0 ? ARMJIT_Memory::FastMem9Start : ARMJIT_Memory::FastMem7Start));
+        Comp_FastMemBase(RSCRATCH);
 
         X64Reg maskedAddr = RSCRATCH3;
         if (size > 8)
@@ -430,7 +435,7 @@ s32 Compiler::Comp_MemAccessBlock(int rn, BitSet16 regs, bool store, bool preinc
         Comp_AddCycles_CD();
 
     bool compileFastPath = FastMemory
-        && !usermode && (CurInstr.Cond() < 0xE || ARMJIT_Memory::IsFastmemCompatible(expectedTarget));
+        && !usermode && (CurInstr.Cond() < 0xE || ARMJIT_Memory::IsFastmemCompatible(expectedTarget, store));
 
     // we need to make sure that the stack stays aligned to 16 bytes
 #ifdef _WIN32
@@ -453,7 +458,7 @@ s32 Compiler::Comp_MemAccessBlock(int rn, BitSet16 regs, bool store, bool preinc
         u8* fastPathStart = GetWritableCodePtr();
         u8* loadStoreAddr[16];
 
-        MOV(64, R(RSCRATCH2), ImmPtr(Num == 0 ? ARMJIT_Memory::FastMem9Start : ARMJIT_Memory::FastMem7Start));
+        Comp_FastMemBase(RSCRATCH2);
         ADD(64, R(RSCRATCH2), R(RSCRATCH4));
 
         u32 offset = 0;
@@ -142,6 +142,10 @@ void ARMv5::UpdateITCMSetting()
     {
         ITCMSize = 0;
     }
+
+#ifdef JIT_ENABLED
+    ARMJIT::UnlinkAllBlocks();
+#endif
 }
 
 
@@ -1514,6 +1514,7 @@ void ARM9Write8(u32 addr, u8 val)
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
         *(u8*)&NDS::MainRAM[addr & NDS::MainRAMMask] = val;
+        NDS::MainRAMDirty[(addr & NDS::MainRAMMask) / NDS::StateDirtyPageSize] = true;
         return;
     }
 
@@ -1606,6 +1607,7 @@ void ARM9Write16(u32 addr, u16 val)
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
         *(u16*)&NDS::MainRAM[addr & NDS::MainRAMMask] = val;
+        NDS::MainRAMDirty[(addr & NDS::MainRAMMask) / NDS::StateDirtyPageSize] = true;
         return;
     }
 
@@ -1698,6 +1700,7 @@ void ARM9Write32(u32 addr, u32 val)
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
         *(u32*)&NDS::MainRAM[addr & NDS::MainRAMMask] = val;
+        NDS::MainRAMDirty[(addr & NDS::MainRAMMask) / NDS::StateDirtyPageSize] = true;
         return;
     }
 
@@ -2006,6 +2009,7 @@ void ARM7Write8(u32 addr, u8 val)
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
         *(u8*)&NDS::MainRAM[addr & NDS::MainRAMMask] = val;
+        NDS::MainRAMDirty[(addr & NDS::MainRAMMask) / NDS::StateDirtyPageSize] = true;
         return;
     }
 
@@ -2103,6 +2107,7 @@ void ARM7Write16(u32 addr, u16 val)
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
         *(u16*)&NDS::MainRAM[addr & NDS::MainRAMMask] = val;
+        NDS::MainRAMDirty[(addr & NDS::MainRAMMask) / NDS::StateDirtyPageSize] = true;
         return;
     }
 
@@ -2200,6 +2205,7 @@ void ARM7Write32(u32 addr, u32 val)
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
         *(u32*)&NDS::MainRAM[addr & NDS::MainRAMMask] = val;
+        NDS::MainRAMDirty[(addr & NDS::MainRAMMask) / NDS::StateDirtyPageSize] = true;
         return;
     }
 
@@ -20,9 +20,11 @@
 #include <string.h>
 #include "NDS.h"
 #include "GPU.h"
+#include "Profiler.h"
 
 #ifdef JIT_ENABLED
 #include "ARMJIT.h"
+#include "ARMJIT_Memory.h"
 #endif
 
 #include "GPU2D_Soft.h"
@@ -45,16 +47,16 @@ u16 DispStat[2], VMatch[2];
 u8 Palette[2*1024];
 u8 OAM[2*1024];
 
-u8 VRAM_A[128*1024];
-u8 VRAM_B[128*1024];
-u8 VRAM_C[128*1024];
-u8 VRAM_D[128*1024];
-u8 VRAM_E[ 64*1024];
-u8 VRAM_F[ 16*1024];
-u8 VRAM_G[ 16*1024];
-u8 VRAM_H[ 32*1024];
-u8 VRAM_I[ 16*1024];
-u8* const VRAM[9]     = {VRAM_A,  VRAM_B,  VRAM_C,  VRAM_D,  VRAM_E, VRAM_F, VRAM_G, VRAM_H, VRAM_I};
+u8* VRAM_A;
+u8* VRAM_B;
+u8* VRAM_C;
+u8* VRAM_D;
+u8* VRAM_E;
+u8* VRAM_F;
+u8* VRAM_G;
+u8* VRAM_H;
+u8* VRAM_I;
+u8* VRAM[9];
 u32 const VRAMMask[9] = {0x1FFFF, 0x1FFFF, 0x1FFFF, 0x1FFFF, 0xFFFF, 0x3FFF, 0x3FFF, 0x7FFF, 0x3FFF};
 
 u8 VRAMCNT[9];
@@ -86,6 +88,11 @@ int FrontBuffer;
 u32* Framebuffer[2][2];
 int Renderer = 0;
 
+int FrameSkip = 0;
+int FrameSkipCount;
+bool SkipFrame;
+bool SkipNextFrame;
+
 GPU2D::Unit GPU2D_A(0);
 GPU2D::Unit GPU2D_B(1);
 
@@ -126,6 +133,7 @@ VRAMTrackingSet<512*1024, 128*1024> VRAMDirty_Texture;
 VRAMTrackingSet<128*1024, 16*1024> VRAMDirty_TexPal;
 
 NonStupidBitField<128*1024/VRAMDirtyGranularity> VRAMDirty[9];
+NonStupidBitField<128*1024/VRAMDirtyGranularity> VRAMStateDirty[9];
 
 u8 VRAMFlat_ABG[512*1024];
 u8 VRAMFlat_BBG[128*1024];
@@ -149,6 +157,22 @@ std::unique_ptr<GLCompositor> CurGLCompositor = {};
 
 bool Init()
 {
+#ifndef JIT_ENABLED
+    // with the JIT the banks are part of the fastmem memory
+    // and were already set up by ARMJIT_Memory
+    for (int i = 0; i < 9; i++)
+        VRAM[i] = new u8[VRAMMask[i] + 1];
+#endif
+    VRAM_A = VRAM[0];
+    VRAM_B = VRAM[1];
+    VRAM_C = VRAM[2];
+    VRAM_D = VRAM[3];
+    VRAM_E = VRAM[4];
+    VRAM_F = VRAM[5];
+    VRAM_G = VRAM[6];
+    VRAM_H = VRAM[7];
+    VRAM_I = VRAM[8];
+
     GPU2D_Renderer = std::make_unique<GPU2D::SoftRenderer>();
     if (!GPU3D::Init()) return false;
 
@@ -169,6 +193,11 @@ void DeInit()
     if (Framebuffer[0][1]) delete[] Framebuffer[0][1];
     if (Framebuffer[1][0]) delete[] Framebuffer[1][0];
     if (Framebuffer[1][1]) delete[] Framebuffer[1][1];
+
+#ifndef JIT_ENABLED
+    for (int i = 0; i < 9; i++)
+        delete[] VRAM[i];
+#endif
 }
 
 void ResetVRAMCache()
@@ -223,6 +252,9 @@ void Reset()
     memset(VRAM_H, 0,  32*1024);
     memset(VRAM_I, 0,  16*1024);
 
+    for (int i = 0; i < 9; i++)
+        memset(VRAMStateDirty[i].Data, 0xFF, sizeof(VRAMStateDirty[i].Data));
+
     memset(VRAMCNT, 0, 9);
     VRAMSTAT = 0;
 
@@ -270,6 +302,10 @@ void Reset()
     GPU2D_B.Reset();
     GPU3D::Reset();
 
+    FrameSkipCount = 0;
+    SkipFrame = false;
+    SkipNextFrame = false;
+
     int backbuf = FrontBuffer ? 0 : 1;
     GPU2D_Renderer->SetFramebuffer(Framebuffer[backbuf][1], Framebuffer[backbuf][0]);
 
@@ -318,15 +354,19 @@ void DoSavestate(Savestate* file)
     file->VarArray(Palette, 2*1024);
     file->VarArray(OAM, 2*1024);
 
-    file->VarArray(VRAM_A, 128*1024);
-    file->VarArray(VRAM_B, 128*1024);
-    file->VarArray(VRAM_C, 128*1024);
-    file->VarArray(VRAM_D, 128*1024);
-    file->VarArray(VRAM_E,  64*1024);
-    file->VarArray(VRAM_F,  16*1024);
-    file->VarArray(VRAM_G,  16*1024);
-    file->VarArray(VRAM_H,  32*1024);
-    file->VarArray(VRAM_I,  16*1024);
+    // also pick up the writes the renderers haven't looked at yet
+    for (int i = 0; i < 9; i++)
+        VRAMStateDirty[i] |= VRAMDirty[i];
+
+    file->VarArrayTracked(VRAM_A, 128*1024, VRAMStateDirty[0].Data, VRAMDirtyGranularity);
+    file->VarArrayTracked(VRAM_B, 128*1024, VRAMStateDirty[1].Data, VRAMDirtyGranularity);
+    file->VarArrayTracked(VRAM_C, 128*1024, VRAMStateDirty[2].Data, VRAMDirtyGranularity);
+    file->VarArrayTracked(VRAM_D, 128*1024, VRAMStateDirty[3].Data, VRAMDirtyGranularity);
+    file->VarArrayTracked(VRAM_E,  64*1024, VRAMStateDirty[4].Data, VRAMDirtyGranularity);
+    file->VarArrayTracked(VRAM_F,  16*1024, VRAMStateDirty[5].Data, VRAMDirtyGranularity);
+    file->VarArrayTracked(VRAM_G,  16*1024, VRAMStateDirty[6].Data, VRAMDirtyGranularity);
+    file->VarArrayTracked(VRAM_H,  32*1024, VRAMStateDirty[7].Data, VRAMDirtyGranularity);
+    file->VarArrayTracked(VRAM_I,  16*1024, VRAMStateDirty[8].Data, VRAMDirtyGranularity);
 
     file->VarArray(VRAMCNT, 9);
     file->Var8(&VRAMSTAT);
@@ -368,6 +408,11 @@ void DoSavestate(Savestate* file)
     ResetVRAMCache();
 }
 
+void SetFrameSkip(int num)
+{
+    FrameSkip = num > 0 ? num : 0;
+}
+
 void AssignFramebuffers()
 {
     int backbuf = FrontBuffer ? 0 : 1;
@@ -589,6 +634,10 @@ void MapVRAM_AB(u32 bank, u8 cnt)
             break;
         }
     }
+
+#ifdef JIT_ENABLED
+    ARMJIT_Memory::RemapVRAM();
+#endif
 }
 
 void MapVRAM_CD(u32 bank, u8 cnt)
@@ -678,6 +727,10 @@ void MapVRAM_CD(u32 bank, u8 cnt)
             break;
         }
     }
+
+#ifdef JIT_ENABLED
+    ARMJIT_Memory::RemapVRAM();
+#endif
 }
 
 void MapVRAM_E(u32 bank, u8 cnt)
@@ -742,6 +795,10 @@ void MapVRAM_E(u32 bank, u8 cnt)
             break;
         }
     }
+
+#ifdef JIT_ENABLED
+    ARMJIT_Memory::RemapVRAM();
+#endif
 }
 
 void MapVRAM_FG(u32 bank, u8 cnt)
@@ -842,6 +899,10 @@ void MapVRAM_FG(u32 bank, u8 cnt)
             break;
         }
     }
+
+#ifdef JIT_ENABLED
+    ARMJIT_Memory::RemapVRAM();
+#endif
 }
 
 void MapVRAM_H(u32 bank, u8 cnt)
@@ -904,6 +965,10 @@ void MapVRAM_H(u32 bank, u8 cnt)
             break;
         }
     }
+
+#ifdef JIT_ENABLED
+    ARMJIT_Memory::RemapVRAM();
+#endif
 }
 
 void MapVRAM_I(u32 bank, u8 cnt)
@@ -974,6 +1039,10 @@ void MapVRAM_I(u32 bank, u8 cnt)
             break;
         }
     }
+
+#ifdef JIT_ENABLED
+    ARMJIT_Memory::RemapVRAM();
+#endif
 }
 
 
@@ -1027,6 +1096,12 @@ void StartFrame()
     // * if we have display FIFO DMA
     RunFIFO = GPU2D_A.UsesFIFO() || NDS::DMAsInMode(0, 0x04);
 
+    // the 3D scene and the first sprites of a frame are drawn during the
+    // previous one, so whether a frame is skipped is decided a frame ahead
+    SkipFrame = SkipNextFrame;
+    FrameSkipCount = SkipFrame ? (FrameSkipCount + 1) : 0;
+    SkipNextFrame = FrameSkipCount < FrameSkip;
+
     TotalScanlines = 0;
     StartScanline(0);
 }
@@ -1038,6 +1113,8 @@ void StartHBlank(u32 line)
 
     if (VCount < 192)
     {
+        PROFILER_ENTER(PROFILER_STAGE(Stage_GPU2D));
+
         // draw
         // note: this should start 48 cycles after the scanline start
         if (line < 192)
@@ -1047,22 +1124,32 @@ void StartHBlank(u32 line)
         }
 
         // sprites are pre-rendered one scanline in advance
+        // in skipped frames, engine A is still drawn if it's captured
         if (line < 191)
         {
-            GPU2D_Renderer->DrawSprites(line+1, &GPU2D_A);
-            GPU2D_Renderer->DrawSprites(line+1, &GPU2D_B);
+            if (!SkipFrame || GPU2D_A.CaptureLatch)
+                GPU2D_Renderer->DrawSprites(line+1, &GPU2D_A);
+            if (!SkipFrame)
+                GPU2D_Renderer->DrawSprites(line+1, &GPU2D_B);
         }
 
+        PROFILER_LEAVE();
+
         NDS::CheckDMAs(0, 0x02);
     }
     else if (VCount == 215)
     {
-        GPU3D::VCount215();
+        if (SkipNextFrame)
+            GPU3D::SkipRender();
+        else
+            GPU3D::VCount215();
     }
-    else if (VCount == 262)
+    else if (VCount == 262 && !SkipNextFrame)
     {
+        PROFILER_ENTER(PROFILER_STAGE(Stage_GPU2D));
         GPU2D_Renderer->DrawSprites(0, &GPU2D_A);
         GPU2D_Renderer->DrawSprites(0, &GPU2D_B);
+        PROFILER_LEAVE();
     }
 
     if (DispStat[0] & (1<<4)) NDS::SetIRQ(0, NDS::IRQ_HBlank);
@@ -1076,8 +1163,11 @@ void StartHBlank(u32 line)
 
 void FinishFrame(u32 lines)
 {
-    FrontBuffer = FrontBuffer ? 0 : 1;
-    AssignFramebuffers();
+    if (!SkipFrame)
+    {
+        FrontBuffer = FrontBuffer ? 0 : 1;
+        AssignFramebuffers();
+    }
 
     TotalScanlines = lines;
 
@@ -1178,7 +1268,7 @@ void StartScanline(u32 line)
 
 #ifdef OGLRENDERER_ENABLED
             // Need a better way to identify the openGL renderer in particular
-            if (GPU3D::CurrentRenderer->Accelerated)
+            if (GPU3D::CurrentRenderer->Accelerated && !SkipFrame)
                 CurGLCompositor->RenderFrame();
 #endif
         }
@@ -1267,6 +1357,7 @@ NonStupidBitField<Size/VRAMDirtyGranularity> VRAMTrackingSet<Size, MappingGranul
     {
         u32 num = __builtin_ctz(banksToBeZeroed);
         banksToBeZeroed &= ~(1 << num);
+        VRAMStateDirty[num] |= VRAMDirty[num];
         VRAMDirty[num].Clear();
     }
 
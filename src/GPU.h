@@ -42,17 +42,18 @@ extern u8 VRAMSTAT;
 extern u8 Palette[2*1024];
 extern u8 OAM[2*1024];
 
-extern u8 VRAM_A[128*1024];
-extern u8 VRAM_B[128*1024];
-extern u8 VRAM_C[128*1024];
-extern u8 VRAM_D[128*1024];
-extern u8 VRAM_E[ 64*1024];
-extern u8 VRAM_F[ 16*1024];
-extern u8 VRAM_G[ 16*1024];
-extern u8 VRAM_H[ 32*1024];
-extern u8 VRAM_I[ 16*1024];
-
-extern u8* const VRAM[9];
+extern u8* VRAM_A;
+extern u8* VRAM_B;
+extern u8* VRAM_C;
+extern u8* VRAM_D;
+extern u8* VRAM_E;
+extern u8* VRAM_F;
+extern u8* VRAM_G;
+extern u8* VRAM_H;
+extern u8* VRAM_I;
+
+extern u8* VRAM[9];
+extern u32 const VRAMMask[9];
 
 extern u32 VRAMMap_LCDC;
 extern u32 VRAMMap_ABG[0x20];
@@ -75,14 +76,22 @@ extern u8* VRAMPtr_BOBJ[0x8];
 extern int FrontBuffer;
 extern u32* Framebuffer[2][2];
 
+// set while running a frame that isn't drawn, see SetFrameSkip().
+// FrontBuffer isn't swapped after those, it keeps the last frame that was drawn
+extern bool SkipFrame;
+
 extern GPU2D::Unit GPU2D_A;
 extern GPU2D::Unit GPU2D_B;
 
+extern std::unique_ptr<GPU2D::Renderer2D> GPU2D_Renderer;
+
 extern int Renderer;
 
 const u32 VRAMDirtyGranularity = 512;
 
 extern NonStupidBitField<128*1024/VRAMDirtyGranularity> VRAMDirty[9];
+// same, but only cleared by incremental savestates
+extern NonStupidBitField<128*1024/VRAMDirtyGranularity> VRAMStateDirty[9];
 
 template <u32 Size, u32 MappingGranularity>
 struct VRAMTrackingSet
@@ -157,6 +166,7 @@ extern std::unique_ptr<GLCompositor> CurGLCompositor;
 struct RenderSettings
 {
     bool Soft_Threaded;
+    int Soft_ThreadCount;
 
     int GL_ScaleFactor;
     bool GL_BetterPolygons;
@@ -176,6 +186,11 @@ void ResetRenderer();
 
 void SetRenderSettings(int renderer, RenderSettings& settings);
 
+// only draw one frame out of every num+1. the 2D and 3D rendering is skipped
+// for the other frames, except for what a display capture needs.
+// 0 draws every frame. the change applies from the frame after the next one
+void SetFrameSkip(int num);
+
 
 u8* GetUniqueBankPtr(u32 mask, u32 offset);
 
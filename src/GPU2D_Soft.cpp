@@ -19,12 +19,222 @@
 #include "GPU2D_Soft.h"
 #include "GPU.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define GPU2D_SIMD
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define GPU2D_SIMD
+#endif
+
 namespace GPU2D
 {
 
+#ifdef GPU2D_SIMD
+
+// the few vector operations the compositor needs, on four 32-bit lanes.
+// Mul16 and Min16 only work for values that fit in 15 bits, which is all
+// the compositor ever deals with (6-bit color channels, factors up to 32).
+
+#if defined(__SSE2__)
+
+typedef __m128i u32x4;
+
+inline u32x4 Load(const u32* ptr) { return _mm_loadu_si128((const __m128i*)ptr); }
+inline void Store(u32* ptr, u32x4 val) { _mm_storeu_si128((__m128i*)ptr, val); }
+inline u32x4 Splat(u32 val) { return _mm_set1_epi32(val); }
+inline u32x4 LoadBytes(const u8* ptr)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i val = _mm_cvtsi32_si128(*(const u32*)ptr);
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(val, zero), zero);
+}
+
+inline u32x4 And(u32x4 a, u32x4 b) { return _mm_and_si128(a, b); }
+inline u32x4 Or(u32x4 a, u32x4 b) { return _mm_or_si128(a, b); }
+inline u32x4 AndNot(u32x4 a, u32x4 b) { return _mm_andnot_si128(b, a); } // a & ~b
+inline u32x4 Add(u32x4 a, u32x4 b) { return _mm_add_epi32(a, b); }
+inline u32x4 Sub(u32x4 a, u32x4 b) { return _mm_sub_epi32(a, b); }
+inline u32x4 Mul16(u32x4 a, u32x4 b) { return _mm_mullo_epi16(a, b); }
+inline u32x4 Min16(u32x4 a, u32x4 b) { return _mm_min_epi16(a, b); }
+template <int n> inline u32x4 ShiftLeft(u32x4 a) { return _mm_slli_epi32(a, n); }
+template <int n> inline u32x4 ShiftRight(u32x4 a) { return _mm_srli_epi32(a, n); }
+
+inline u32x4 Equal(u32x4 a, u32x4 b) { return _mm_cmpeq_epi32(a, b); }
+inline u32x4 Select(u32x4 mask, u32x4 a, u32x4 b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+inline bool Any(u32x4 mask) { return _mm_movemask_epi8(mask) != 0; }
+
+#else
+
+typedef uint32x4_t u32x4;
+
+inline u32x4 Load(const u32* ptr) { return vld1q_u32(ptr); }
+inline void Store(u32* ptr, u32x4 val) { vst1q_u32(ptr, val); }
+inline u32x4 Splat(u32 val) { return vdupq_n_u32(val); }
+inline u32x4 LoadBytes(const u8* ptr)
+{
+    uint8x8_t val = vreinterpret_u8_u32(vld1_dup_u32((const u32*)ptr));
+    return vmovl_u16(vget_low_u16(vmovl_u8(val)));
+}
+
+inline u32x4 And(u32x4 a, u32x4 b) { return vandq_u32(a, b); }
+inline u32x4 Or(u32x4 a, u32x4 b) { return vorrq_u32(a, b); }
+inline u32x4 AndNot(u32x4 a, u32x4 b) { return vbicq_u32(a, b); } // a & ~b
+inline u32x4 Add(u32x4 a, u32x4 b) { return vaddq_u32(a, b); }
+inline u32x4 Sub(u32x4 a, u32x4 b) { return vsubq_u32(a, b); }
+inline u32x4 Mul16(u32x4 a, u32x4 b) { return vmulq_u32(a, b); }
+inline u32x4 Min16(u32x4 a, u32x4 b) { return vminq_u32(a, b); }
+template <int n> inline u32x4 ShiftLeft(u32x4 a) { return vshlq_n_u32(a, n); }
+template <int n> inline u32x4 ShiftRight(u32x4 a) { return vshrq_n_u32(a, n); }
+
+inline u32x4 Equal(u32x4 a, u32x4 b) { return vceqq_u32(a, b); }
+inline u32x4 Select(u32x4 mask, u32x4 a, u32x4 b) { return vbslq_u32(mask, a, b); }
+inline bool Any(u32x4 mask)
+{
+    uint32x2_t val = vorr_u32(vget_low_u32(mask), vget_high_u32(mask));
+    return vget_lane_u64(vreinterpret_u64_u32(val), 0) != 0;
+}
+
+#endif
+
+inline u32x4 TestBits(u32x4 a, u32 bits)
+{
+    return Equal(And(a, Splat(bits)), Splat(bits));
+}
+
+// all of these work on the channels split in separate registers
+
+inline u32x4 BlendChannel4(u32x4 c1, u32x4 c2, u32x4 eva, u32x4 evb)
+{
+    u32x4 c = ShiftRight<4>(Add(Add(Mul16(c1, eva), Mul16(c2, evb)), Splat(0x8)));
+    return Min16(c, Splat(0x3F));
+}
+
+inline u32x4 BlendChannel5(u32x4 c1, u32x4 c2, u32x4 eva, u32x4 evb)
+{
+    u32x4 c = ShiftRight<5>(Add(Add(Mul16(c1, eva), Mul16(c2, evb)), Splat(0x10)));
+    return Min16(c, Splat(0x3F));
+}
+
+inline u32x4 BrightnessUpChannel(u32x4 c, u32x4 factor, u32x4 bias)
+{
+    return Add(c, ShiftRight<4>(Add(Mul16(Sub(Splat(0x3F), c), factor), bias)));
+}
+
+inline u32x4 BrightnessDownChannel(u32x4 c, u32x4 factor, u32x4 bias)
+{
+    return Sub(c, ShiftRight<4>(Add(Mul16(c, factor), bias)));
+}
+
+template <int shift> inline u32x4 Channel(u32x4 val)
+{
+    return And(ShiftRight<shift>(val), Splat(0x3F));
+}
+
+template <> inline u32x4 Channel<0>(u32x4 val)
+{
+    return And(val, Splat(0x3F));
+}
+
+inline u32x4 Combine(u32x4 r, u32x4 g, u32x4 b)
+{
+    return Or(Or(r, ShiftLeft<8>(g)), Or(ShiftLeft<16>(b), Splat(0xFF000000)));
+}
+
+// these match the scalar versions below, for four pixels at once
+
+inline u32x4 ColorBrightnessUpVec(u32x4 val, u32x4 factor, u32x4 bias)
+{
+    return Combine(BrightnessUpChannel(Channel<0>(val), factor, bias),
+                   BrightnessUpChannel(Channel<8>(val), factor, bias),
+                   BrightnessUpChannel(Channel<16>(val), factor, bias));
+}
+
+inline u32x4 ColorBrightnessDownVec(u32x4 val, u32x4 factor, u32x4 bias)
+{
+    return Combine(BrightnessDownChannel(Channel<0>(val), factor, bias),
+                   BrightnessDownChannel(Channel<8>(val), factor, bias),
+                   BrightnessDownChannel(Channel<16>(val), factor, bias));
+}
+
+inline u32x4 ColorCompositeVec(Unit* unit, const u8* windowmask, u32x4 val1, u32x4 val2)
+{
+    u32x4 flag1 = ShiftRight<24>(val1);
+    u32x4 flag2 = ShiftRight<24>(val2);
+
+    u32x4 blendCnt = Splat(unit->BlendCnt);
+
+    u32x4 target2 = Select(TestBits(flag2, 0x80), Splat(0x1000),
+                    Select(TestBits(flag2, 0x40), Splat(0x0100), ShiftLeft<8>(flag2)));
+    u32x4 isTarget2 = AndNot(Splat(0xFFFFFFFF), Equal(And(blendCnt, target2), Splat(0)));
+
+    u32x4 isSprite = TestBits(flag1, 0x80);
+    u32x4 is3D = TestBits(flag1, 0x40);
+
+    // sprite blending
+    u32x4 blend4 = And(isSprite, isTarget2);
+    u32x4 spriteAlpha = And(blend4, is3D);
+
+    // 3D layer blending
+    u32x4 blend5 = AndNot(And(is3D, isTarget2), isSprite);
+
+    // regular color effects
+    u32x4 target1 = Select(isSprite, Splat(0x10), Select(is3D, Splat(0x01), flag1));
+    u32x4 effect = AndNot(Splat(0xFFFFFFFF), Or(Equal(And(blendCnt, target1), Splat(0)),
+                                                Equal(And(LoadBytes(windowmask), Splat(0x20)), Splat(0))));
+    effect = AndNot(effect, Or(blend4, blend5));
+
+    u32x4 brightUp = Splat(0);
+    u32x4 brightDown = Splat(0);
+    switch ((unit->BlendCnt >> 6) & 0x3)
+    {
+    case 1: blend4 = Or(blend4, And(effect, isTarget2)); break;
+    case 2: brightUp = effect; break;
+    case 3: brightDown = effect; break;
+    }
+
+    u32x4 ret = val1;
+
+    if (Any(blend4))
+    {
+        u32x4 eva = Select(spriteAlpha, And(flag1, Splat(0x1F)), Splat(unit->EVA));
+        u32x4 evb = Select(spriteAlpha, Sub(Splat(16), eva), Splat(unit->EVB));
+
+        u32x4 color = Combine(BlendChannel4(Channel<0>(val1), Channel<0>(val2), eva, evb),
+                              BlendChannel4(Channel<8>(val1), Channel<8>(val2), eva, evb),
+                              BlendChannel4(Channel<16>(val1), Channel<16>(val2), eva, evb));
+        ret = Select(blend4, color, ret);
+    }
+
+    if (Any(blend5))
+    {
+        u32x4 eva = Add(And(flag1, Splat(0x1F)), Splat(1));
+        u32x4 evb = Sub(Splat(32), eva);
+
+        u32x4 color = Combine(BlendChannel5(Channel<0>(val1), Channel<0>(val2), eva, evb),
+                              BlendChannel5(Channel<8>(val1), Channel<8>(val2), eva, evb),
+                              BlendChannel5(Channel<16>(val1), Channel<16>(val2), eva, evb));
+
+        // full opacity leaves the pixel untouched
+        blend5 = AndNot(blend5, Equal(eva, Splat(32)));
+        ret = Select(blend5, color, ret);
+    }
+
+    if (Any(brightUp))
+        ret = Select(brightUp, ColorBrightnessUpVec(val1, Splat(unit->EVY), Splat(0x8)), ret);
+    if (Any(brightDown))
+        ret = Select(brightDown, ColorBrightnessDownVec(val1, Splat(unit->EVY), Splat(0x7)), ret);
+
+    return ret;
+}
+
+#endif
+
 SoftRenderer::SoftRenderer()
     : Renderer2D()
 {
+    ScalarCompositing = false;
+
     // initialize mosaic table
     for (int m = 0; m < 16; m++)
     {
@@ -171,6 +381,24 @@ void SoftRenderer::DrawScanline(u32 line, Unit* unit)
     int n3dline = line;
     line = GPU::VCount;
 
+    // frames that aren't shown are only drawn for a display capture
+    if (GPU::SkipFrame)
+    {
+        if (CurUnit->Num == 0 && line == 0 && (CurUnit->CaptureCnt & (1<<31)))
+        {
+            // the 3D scene and the first sprites were skipped along with the frame
+            GPU3D::RenderSkippedFrame();
+            DrawSprites(0, CurUnit);
+        }
+        else if (CurUnit->Num != 0 || !CurUnit->CaptureLatch)
+        {
+            // after a restart, the renderer may have a frame going anyway
+            if (CurUnit->Num == 0 && !GPU3D::CurrentRenderer->Accelerated && !GPU3D::RenderSkipped)
+                GPU3D::GetLine(n3dline);
+            return;
+        }
+    }
+
     if (CurUnit->Num == 0)
     {
         auto bgDirty = GPU::VRAMDirty_ABG.DeriveState(GPU::VRAMMap_ABG);
@@ -326,7 +554,12 @@ void SoftRenderer::DrawScanline(u32 line, Unit* unit)
             u32 factor = masterBrightness & 0x1F;
             if (factor > 16) factor = 16;
 
-            for (int i = 0; i < 256; i++)
+            int i = 0;
+#ifdef GPU2D_SIMD
+            for (; i < 256 && !ScalarCompositing; i+=4)
+                Store(&dst[i], ColorBrightnessUpVec(Load(&dst[i]), Splat(factor), Splat(0x0)));
+#endif
+            for (; i < 256; i++)
             {
                 dst[i] = ColorBrightnessUp(dst[i], factor, 0x0);
             }
@@ -337,7 +570,12 @@ void SoftRenderer::DrawScanline(u32 line, Unit* unit)
             u32 factor = masterBrightness & 0x1F;
             if (factor > 16) factor = 16;
 
-            for (int i = 0; i < 256; i++)
+            int i = 0;
+#ifdef GPU2D_SIMD
+            for (; i < 256 && !ScalarCompositing; i+=4)
+                Store(&dst[i], ColorBrightnessDownVec(Load(&dst[i]), Splat(factor), Splat(0xF)));
+#endif
+            for (; i < 256; i++)
             {
                 dst[i] = ColorBrightnessDown(dst[i], factor, 0xF);
             }
@@ -347,7 +585,23 @@ void SoftRenderer::DrawScanline(u32 line, Unit* unit)
     // convert to 32-bit BGRA
     // note: 32-bit RGBA would be more straightforward, but
     // BGRA seems to be more compatible (Direct2D soft, cairo...)
-    for (int i = 0; i < 256; i+=2)
+    int i = 0;
+#ifdef GPU2D_SIMD
+    for (; i < 256 && !ScalarCompositing; i+=4)
+    {
+        u32x4 c = Load(&dst[i]);
+        u32x4 r = ShiftLeft<2>(Channel<0>(c));
+        u32x4 g = ShiftLeft<2>(Channel<8>(c));
+        u32x4 b = ShiftLeft<2>(Channel<16>(c));
+
+        r = Or(r, ShiftRight<6>(r));
+        g = Or(g, ShiftRight<6>(g));
+        b = Or(b, ShiftRight<6>(b));
+
+        Store(&dst[i], Combine(b, g, r));
+    }
+#endif
+    for (; i < 256; i+=2)
     {
         u64 c = *(u64*)&dst[i];
 
@@ -367,6 +621,8 @@ void SoftRenderer::VBlankEnd(Unit* unitA, Unit* unitB)
     {
         if ((unitA->CaptureCnt & (1<<31)) && (((unitA->CaptureCnt >> 29) & 0x3) != 1))
         {
+            // the 3D scene may have been skipped along with the frame
+            GPU3D::RenderSkippedFrame();
             reinterpret_cast<GPU3D::GLRenderer*>(GPU3D::CurrentRenderer.get())->PrepareCaptureFrame();
         }
     }
@@ -796,7 +1052,17 @@ void SoftRenderer::DrawScanline_BGOBJ(u32 line)
 
     if (!GPU3D::CurrentRenderer->Accelerated)
     {
-        for (int i = 0; i < 256; i++)
+        int i = 0;
+#ifdef GPU2D_SIMD
+        for (; i < 256 && !ScalarCompositing; i+=4)
+        {
+            u32x4 val1 = Load(&BGOBJLine[i]);
+            u32x4 val2 = Load(&BGOBJLine[256+i]);
+
+            Store(&BGOBJLine[i], ColorCompositeVec(CurUnit, &WindowMask[i], val1, val2));
+        }
+#endif
+        for (; i < 256; i++)
         {
             u32 val1 = BGOBJLine[i];
             u32 val2 = BGOBJLine[256+i];
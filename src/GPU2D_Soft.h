@@ -32,6 +32,9 @@ public:
     void DrawScanline(u32 line, Unit* unit) override;
     void DrawSprites(u32 line, Unit* unit) override;
     void VBlankEnd(Unit* unitA, Unit* unitB) override;
+
+    // do the final compositing with the scalar code, for checking the vector path against it
+    bool ScalarCompositing;
 private:
     alignas(8) u32 BGOBJLine[256*3];
     u32* _3DLine;
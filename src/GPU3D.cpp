@@ -21,7 +21,15 @@
 #include <algorithm>
 #include "NDS.h"
 #include "GPU.h"
+#include "GPU3D_Capture.h"
 #include "FIFO.h"
+#include "Profiler.h"
+
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 
 // 3D engine notes
@@ -135,22 +143,13 @@ const u8 CmdNumParams[256] =
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
-typedef union
-{
-    u64 _contents;
-    struct
-    {
-        u32 Param;
-        u8 Command;
-    };
-
-} CmdFIFOEntry;
-
 FIFO<CmdFIFOEntry, 256> CmdFIFO;
 FIFO<CmdFIFOEntry, 4> CmdPIPE;
 
 FIFO<CmdFIFOEntry, 64> CmdStallQueue;
 
+std::vector<CmdFIFOEntry>* CmdCapture = nullptr;
+
 u32 NumCommands, CurCommand, ParamCount, TotalParams;
 
 bool GeometryEnabled;
@@ -179,6 +178,7 @@ u8 RenderFogDensityTable[34];
 u32 RenderClearAttr1, RenderClearAttr2;
 
 bool RenderFrameIdentical;
+bool RenderSkipped;
 
 u16 RenderXPos;
 
@@ -383,6 +383,7 @@ void Reset()
     RenderXPos = 0;
 
     AbortFrame = false;
+    RenderSkipped = false;
 }
 
 void DoSavestate(Savestate* file)
@@ -632,6 +633,8 @@ void DoSavestate(Savestate* file)
 
 void SetEnabled(bool geometry, bool rendering)
 {
+    if (GPU3D_Capture::Recording) GPU3D_Capture::SetEnabled(geometry, rendering);
+
     GeometryEnabled = geometry;
     RenderingEnabled = rendering;
 
@@ -661,31 +664,91 @@ void MatrixLoad4x3(s32* m, s32* s)
     m[12] = s[9]; m[13] = s[10]; m[14] = s[11]; m[15] = 0x1000;
 }
 
+// fixed-point transforms of a vector by the first n rows of a matrix
+//
+// Transform<shift, n>(out, v, m) computes, for every column c,
+//   out[c] = (v[0]*m[c] + v[1]*m[4+c] + ... + v[n-1]*m[(n-1)*4+c]) >> shift
+// with 64-bit products and sums, truncated to 32 bits like everywhere else.
+// only bits shift..shift+31 of the sums are kept, so the vector versions are
+// free to shift them either way.
+//
+// plain SSE2 has no signed 32x32->64 multiply, and working around that is
+// slower than the scalar code, so x86 only gets a vector version with SSE4.1.
+
+#if defined(__SSE4_1__)
+
+template <int shift, int n>
+inline void Transform(s32* out, const s32* v, const s32* m)
+{
+    __m128i even = _mm_setzero_si128();
+    __m128i odd = _mm_setzero_si128();
+    for (int k = 0; k < n; k++)
+    {
+        __m128i factor = _mm_set1_epi32(v[k]);
+        __m128i row = _mm_loadu_si128((const __m128i*)&m[k*4]);
+        even = _mm_add_epi64(even, _mm_mul_epi32(factor, row));
+        odd = _mm_add_epi64(odd, _mm_mul_epi32(factor, _mm_srli_epi64(row, 32)));
+    }
+
+    even = _mm_srli_epi64(even, shift);
+    odd = _mm_slli_epi64(_mm_srli_epi64(odd, shift), 32);
+    _mm_storeu_si128((__m128i*)out, _mm_blend_epi16(even, odd, 0xCC));
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+template <int shift, int n>
+inline void Transform(s32* out, const s32* v, const s32* m)
+{
+    int32x4_t row = vld1q_s32(&m[0]);
+    int64x2_t lo = vmull_n_s32(vget_low_s32(row), v[0]);
+    int64x2_t hi = vmull_n_s32(vget_high_s32(row), v[0]);
+    for (int k = 1; k < n; k++)
+    {
+        row = vld1q_s32(&m[k*4]);
+        lo = vmlal_n_s32(lo, vget_low_s32(row), v[k]);
+        hi = vmlal_n_s32(hi, vget_high_s32(row), v[k]);
+    }
+
+    if constexpr (shift == 0)
+        vst1q_s32(out, vcombine_s32(vmovn_s64(lo), vmovn_s64(hi)));
+    else
+        vst1q_s32(out, vcombine_s32(vshrn_n_s64(lo, shift), vshrn_n_s64(hi, shift)));
+}
+
+#else
+
+template <int shift, int n>
+inline s32 TransformColumn(const s32* v, const s32* m)
+{
+    s64 sum = (s64)v[0]*m[0];
+    if (n > 1) sum += (s64)v[1]*m[4];
+    if (n > 2) sum += (s64)v[2]*m[8];
+    if (n > 3) sum += (s64)v[3]*m[12];
+    return sum >> shift;
+}
+
+template <int shift, int n>
+inline void Transform(s32* out, const s32* v, const s32* m)
+{
+    out[0] = TransformColumn<shift, n>(v, &m[0]);
+    out[1] = TransformColumn<shift, n>(v, &m[1]);
+    out[2] = TransformColumn<shift, n>(v, &m[2]);
+    out[3] = TransformColumn<shift, n>(v, &m[3]);
+}
+
+#endif
+
 void MatrixMult4x4(s32* m, s32* s)
 {
     s32 tmp[16];
     memcpy(tmp, m, 16*4);
 
     // m = s*m
-    m[0] = ((s64)s[0]*tmp[0] + (s64)s[1]*tmp[4] + (s64)s[2]*tmp[8] + (s64)s[3]*tmp[12]) >> 12;
-    m[1] = ((s64)s[0]*tmp[1] + (s64)s[1]*tmp[5] + (s64)s[2]*tmp[9] + (s64)s[3]*tmp[13]) >> 12;
-    m[2] = ((s64)s[0]*tmp[2] + (s64)s[1]*tmp[6] + (s64)s[2]*tmp[10] + (s64)s[3]*tmp[14]) >> 12;
-    m[3] = ((s64)s[0]*tmp[3] + (s64)s[1]*tmp[7] + (s64)s[2]*tmp[11] + (s64)s[3]*tmp[15]) >> 12;
-
-    m[4] = ((s64)s[4]*tmp[0] + (s64)s[5]*tmp[4] + (s64)s[6]*tmp[8] + (s64)s[7]*tmp[12]) >> 12;
-    m[5] = ((s64)s[4]*tmp[1] + (s64)s[5]*tmp[5] + (s64)s[6]*tmp[9] + (s64)s[7]*tmp[13]) >> 12;
-    m[6] = ((s64)s[4]*tmp[2] + (s64)s[5]*tmp[6] + (s64)s[6]*tmp[10] + (s64)s[7]*tmp[14]) >> 12;
-    m[7] = ((s64)s[4]*tmp[3] + (s64)s[5]*tmp[7] + (s64)s[6]*tmp[11] + (s64)s[7]*tmp[15]) >> 12;
-
-    m[8] = ((s64)s[8]*tmp[0] + (s64)s[9]*tmp[4] + (s64)s[10]*tmp[8] + (s64)s[11]*tmp[12]) >> 12;
-    m[9] = ((s64)s[8]*tmp[1] + (s64)s[9]*tmp[5] + (s64)s[10]*tmp[9] + (s64)s[11]*tmp[13]) >> 12;
-    m[10] = ((s64)s[8]*tmp[2] + (s64)s[9]*tmp[6] + (s64)s[10]*tmp[10] + (s64)s[11]*tmp[14]) >> 12;
-    m[11] = ((s64)s[8]*tmp[3] + (s64)s[9]*tmp[7] + (s64)s[10]*tmp[11] + (s64)s[11]*tmp[15]) >> 12;
-
-    m[12] = ((s64)s[12]*tmp[0] + (s64)s[13]*tmp[4] + (s64)s[14]*tmp[8] + (s64)s[15]*tmp[12]) >> 12;
-    m[13] = ((s64)s[12]*tmp[1] + (s64)s[13]*tmp[5] + (s64)s[14]*tmp[9] + (s64)s[15]*tmp[13]) >> 12;
-    m[14] = ((s64)s[12]*tmp[2] + (s64)s[13]*tmp[6] + (s64)s[14]*tmp[10] + (s64)s[15]*tmp[14]) >> 12;
-    m[15] = ((s64)s[12]*tmp[3] + (s64)s[13]*tmp[7] + (s64)s[14]*tmp[11] + (s64)s[15]*tmp[15]) >> 12;
+    Transform<12, 4>(&m[0], &s[0], tmp);
+    Transform<12, 4>(&m[4], &s[4], tmp);
+    Transform<12, 4>(&m[8], &s[8], tmp);
+    Transform<12, 4>(&m[12], &s[12], tmp);
 }
 
 void MatrixMult4x3(s32* m, s32* s)
@@ -693,26 +756,13 @@ void MatrixMult4x3(s32* m, s32* s)
     s32 tmp[16];
     memcpy(tmp, m, 16*4);
 
+    s32 last[4] = {s[9], s[10], s[11], 0x1000};
+
     // m = s*m
-    m[0] = ((s64)s[0]*tmp[0] + (s64)s[1]*tmp[4] + (s64)s[2]*tmp[8]) >> 12;
-    m[1] = ((s64)s[0]*tmp[1] + (s64)s[1]*tmp[5] + (s64)s[2]*tmp[9]) >> 12;
-    m[2] = ((s64)s[0]*tmp[2] + (s64)s[1]*tmp[6] + (s64)s[2]*tmp[10]) >> 12;
-    m[3] = ((s64)s[0]*tmp[3] + (s64)s[1]*tmp[7] + (s64)s[2]*tmp[11]) >> 12;
-
-    m[4] = ((s64)s[3]*tmp[0] + (s64)s[4]*tmp[4] + (s64)s[5]*tmp[8]) >> 12;
-    m[5] = ((s64)s[3]*tmp[1] + (s64)s[4]*tmp[5] + (s64)s[5]*tmp[9]) >> 12;
-    m[6] = ((s64)s[3]*tmp[2] + (s64)s[4]*tmp[6] + (s64)s[5]*tmp[10]) >> 12;
-    m[7] = ((s64)s[3]*tmp[3] + (s64)s[4]*tmp[7] + (s64)s[5]*tmp[11]) >> 12;
-
-    m[8] = ((s64)s[6]*tmp[0] + (s64)s[7]*tmp[4] + (s64)s[8]*tmp[8]) >> 12;
-    m[9] = ((s64)s[6]*tmp[1] + (s64)s[7]*tmp[5] + (s64)s[8]*tmp[9]) >> 12;
-    m[10] = ((s64)s[6]*tmp[2] + (s64)s[7]*tmp[6] + (s64)s[8]*tmp[10]) >> 12;
-    m[11] = ((s64)s[6]*tmp[3] + (s64)s[7]*tmp[7] + (s64)s[8]*tmp[11]) >> 12;
-
-    m[12] = ((s64)s[9]*tmp[0] + (s64)s[10]*tmp[4] + (s64)s[11]*tmp[8] + (s64)0x1000*tmp[12]) >> 12;
-    m[13] = ((s64)s[9]*tmp[1] + (s64)s[10]*tmp[5] + (s64)s[11]*tmp[9] + (s64)0x1000*tmp[13]) >> 12;
-    m[14] = ((s64)s[9]*tmp[2] + (s64)s[10]*tmp[6] + (s64)s[11]*tmp[10] + (s64)0x1000*tmp[14]) >> 12;
-    m[15] = ((s64)s[9]*tmp[3] + (s64)s[10]*tmp[7] + (s64)s[11]*tmp[11] + (s64)0x1000*tmp[15]) >> 12;
+    Transform<12, 3>(&m[0], &s[0], tmp);
+    Transform<12, 3>(&m[4], &s[3], tmp);
+    Transform<12, 3>(&m[8], &s[6], tmp);
+    Transform<12, 4>(&m[12], last, tmp);
 }
 
 void MatrixMult3x3(s32* m, s32* s)
@@ -721,46 +771,27 @@ void MatrixMult3x3(s32* m, s32* s)
     memcpy(tmp, m, 12*4);
 
     // m = s*m
-    m[0] = ((s64)s[0]*tmp[0] + (s64)s[1]*tmp[4] + (s64)s[2]*tmp[8]) >> 12;
-    m[1] = ((s64)s[0]*tmp[1] + (s64)s[1]*tmp[5] + (s64)s[2]*tmp[9]) >> 12;
-    m[2] = ((s64)s[0]*tmp[2] + (s64)s[1]*tmp[6] + (s64)s[2]*tmp[10]) >> 12;
-    m[3] = ((s64)s[0]*tmp[3] + (s64)s[1]*tmp[7] + (s64)s[2]*tmp[11]) >> 12;
-
-    m[4] = ((s64)s[3]*tmp[0] + (s64)s[4]*tmp[4] + (s64)s[5]*tmp[8]) >> 12;
-    m[5] = ((s64)s[3]*tmp[1] + (s64)s[4]*tmp[5] + (s64)s[5]*tmp[9]) >> 12;
-    m[6] = ((s64)s[3]*tmp[2] + (s64)s[4]*tmp[6] + (s64)s[5]*tmp[10]) >> 12;
-    m[7] = ((s64)s[3]*tmp[3] + (s64)s[4]*tmp[7] + (s64)s[5]*tmp[11]) >> 12;
-
-    m[8] = ((s64)s[6]*tmp[0] + (s64)s[7]*tmp[4] + (s64)s[8]*tmp[8]) >> 12;
-    m[9] = ((s64)s[6]*tmp[1] + (s64)s[7]*tmp[5] + (s64)s[8]*tmp[9]) >> 12;
-    m[10] = ((s64)s[6]*tmp[2] + (s64)s[7]*tmp[6] + (s64)s[8]*tmp[10]) >> 12;
-    m[11] = ((s64)s[6]*tmp[3] + (s64)s[7]*tmp[7] + (s64)s[8]*tmp[11]) >> 12;
+    Transform<12, 3>(&m[0], &s[0], tmp);
+    Transform<12, 3>(&m[4], &s[3], tmp);
+    Transform<12, 3>(&m[8], &s[6], tmp);
 }
 
 void MatrixScale(s32* m, s32* s)
 {
-    m[0] = ((s64)s[0]*m[0]) >> 12;
-    m[1] = ((s64)s[0]*m[1]) >> 12;
-    m[2] = ((s64)s[0]*m[2]) >> 12;
-    m[3] = ((s64)s[0]*m[3]) >> 12;
-
-    m[4] = ((s64)s[1]*m[4]) >> 12;
-    m[5] = ((s64)s[1]*m[5]) >> 12;
-    m[6] = ((s64)s[1]*m[6]) >> 12;
-    m[7] = ((s64)s[1]*m[7]) >> 12;
-
-    m[8] = ((s64)s[2]*m[8]) >> 12;
-    m[9] = ((s64)s[2]*m[9]) >> 12;
-    m[10] = ((s64)s[2]*m[10]) >> 12;
-    m[11] = ((s64)s[2]*m[11]) >> 12;
+    Transform<12, 1>(&m[0], &s[0], &m[0]);
+    Transform<12, 1>(&m[4], &s[1], &m[4]);
+    Transform<12, 1>(&m[8], &s[2], &m[8]);
 }
 
 void MatrixTranslate(s32* m, s32* s)
 {
-    m[12] += ((s64)s[0]*m[0] + (s64)s[1]*m[4] + (s64)s[2]*m[8]) >> 12;
-    m[13] += ((s64)s[0]*m[1] + (s64)s[1]*m[5] + (s64)s[2]*m[9]) >> 12;
-    m[14] += ((s64)s[0]*m[2] + (s64)s[1]*m[6] + (s64)s[2]*m[10]) >> 12;
-    m[15] += ((s64)s[0]*m[3] + (s64)s[1]*m[7] + (s64)s[2]*m[11]) >> 12;
+    s32 trans[4];
+    Transform<12, 3>(trans, s, m);
+
+    m[12] += trans[0];
+    m[13] += trans[1];
+    m[14] += trans[2];
+    m[15] += trans[3];
 }
 
 void UpdateClipMatrix()
@@ -1423,14 +1454,11 @@ void SubmitPolygon()
 
 void SubmitVertex()
 {
-    s64 vertex[4] = {(s64)CurVertex[0], (s64)CurVertex[1], (s64)CurVertex[2], 0x1000};
+    s32 vertex[4] = {CurVertex[0], CurVertex[1], CurVertex[2], 0x1000};
     Vertex* vertextrans = &TempVertexBuffer[VertexNumInPoly];
 
     UpdateClipMatrix();
-    vertextrans->Position[0] = (vertex[0]*ClipMatrix[0] + vertex[1]*ClipMatrix[4] + vertex[2]*ClipMatrix[8] + vertex[3]*ClipMatrix[12]) >> 12;
-    vertextrans->Position[1] = (vertex[0]*ClipMatrix[1] + vertex[1]*ClipMatrix[5] + vertex[2]*ClipMatrix[9] + vertex[3]*ClipMatrix[13]) >> 12;
-    vertextrans->Position[2] = (vertex[0]*ClipMatrix[2] + vertex[1]*ClipMatrix[6] + vertex[2]*ClipMatrix[10] + vertex[3]*ClipMatrix[14]) >> 12;
-    vertextrans->Position[3] = (vertex[0]*ClipMatrix[3] + vertex[1]*ClipMatrix[7] + vertex[2]*ClipMatrix[11] + vertex[3]*ClipMatrix[15]) >> 12;
+    Transform<12, 4>(vertextrans->Position, vertex, ClipMatrix);
 
     // this probably shouldn't be.
     // the way color is handled during clipping needs investigation. TODO
@@ -1440,8 +1468,10 @@ void SubmitVertex()
 
     if ((TexParam >> 30) == 3)
     {
-        vertextrans->TexCoords[0] = ((vertex[0]*TexMatrix[0] + vertex[1]*TexMatrix[4] + vertex[2]*TexMatrix[8]) >> 24) + RawTexCoords[0];
-        vertextrans->TexCoords[1] = ((vertex[0]*TexMatrix[1] + vertex[1]*TexMatrix[5] + vertex[2]*TexMatrix[9]) >> 24) + RawTexCoords[1];
+        s32 texcoords[4];
+        Transform<24, 3>(texcoords, vertex, TexMatrix);
+        vertextrans->TexCoords[0] = texcoords[0] + RawTexCoords[0];
+        vertextrans->TexCoords[1] = texcoords[1] + RawTexCoords[1];
     }
     else
     {
@@ -1521,16 +1551,22 @@ void SubmitVertex()
 
 void CalculateLighting()
 {
+    s32 normal[3] = {Normal[0], Normal[1], Normal[2]};
+
     if ((TexParam >> 30) == 2)
     {
-        TexCoords[0] = RawTexCoords[0] + (((s64)Normal[0]*TexMatrix[0] + (s64)Normal[1]*TexMatrix[4] + (s64)Normal[2]*TexMatrix[8]) >> 21);
-        TexCoords[1] = RawTexCoords[1] + (((s64)Normal[0]*TexMatrix[1] + (s64)Normal[1]*TexMatrix[5] + (s64)Normal[2]*TexMatrix[9]) >> 21);
+        s32 texcoords[4];
+        Transform<21, 3>(texcoords, normal, TexMatrix);
+        TexCoords[0] = RawTexCoords[0] + texcoords[0];
+        TexCoords[1] = RawTexCoords[1] + texcoords[1];
     }
 
-    s32 normaltrans[3];
-    normaltrans[0] = (Normal[0]*VecMatrix[0] + Normal[1]*VecMatrix[4] + Normal[2]*VecMatrix[8]) >> 12;
-    normaltrans[1] = (Normal[0]*VecMatrix[1] + Normal[1]*VecMatrix[5] + Normal[2]*VecMatrix[9]) >> 12;
-    normaltrans[2] = (Normal[0]*VecMatrix[2] + Normal[1]*VecMatrix[6] + Normal[2]*VecMatrix[10]) >> 12;
+    // the normal is transformed with 32-bit math, the sums are truncated before being shifted
+    s32 normaltrans[4];
+    Transform<0, 3>(normaltrans, normal, VecMatrix);
+    normaltrans[0] >>= 12;
+    normaltrans[1] >>= 12;
+    normaltrans[2] >>= 12;
 
     VertexColor[0] = MatEmission[0];
     VertexColor[1] = MatEmission[1];
@@ -1626,14 +1662,8 @@ void BoxTest(u32* params)
     UpdateClipMatrix();
     for (int i = 0; i < 8; i++)
     {
-        s32 x = cube[i].Position[0];
-        s32 y = cube[i].Position[1];
-        s32 z = cube[i].Position[2];
-
-        cube[i].Position[0] = ((s64)x*ClipMatrix[0] + (s64)y*ClipMatrix[4] + (s64)z*ClipMatrix[8] + (s64)0x1000*ClipMatrix[12]) >> 12;
-        cube[i].Position[1] = ((s64)x*ClipMatrix[1] + (s64)y*ClipMatrix[5] + (s64)z*ClipMatrix[9] + (s64)0x1000*ClipMatrix[13]) >> 12;
-        cube[i].Position[2] = ((s64)x*ClipMatrix[2] + (s64)y*ClipMatrix[6] + (s64)z*ClipMatrix[10] + (s64)0x1000*ClipMatrix[14]) >> 12;
-        cube[i].Position[3] = ((s64)x*ClipMatrix[3] + (s64)y*ClipMatrix[7] + (s64)z*ClipMatrix[11] + (s64)0x1000*ClipMatrix[15]) >> 12;
+        s32 vertex[4] = {cube[i].Position[0], cube[i].Position[1], cube[i].Position[2], 0x1000};
+        Transform<12, 4>(cube[i].Position, vertex, ClipMatrix);
     }
 
     // front face (-Z)
@@ -1693,13 +1723,10 @@ void BoxTest(u32* params)
 
 void PosTest()
 {
-    s64 vertex[4] = {(s64)CurVertex[0], (s64)CurVertex[1], (s64)CurVertex[2], 0x1000};
+    s32 vertex[4] = {CurVertex[0], CurVertex[1], CurVertex[2], 0x1000};
 
     UpdateClipMatrix();
-    PosTestResult[0] = (vertex[0]*ClipMatrix[0] + vertex[1]*ClipMatrix[4] + vertex[2]*ClipMatrix[8] + vertex[3]*ClipMatrix[12]) >> 12;
-    PosTestResult[1] = (vertex[0]*ClipMatrix[1] + vertex[1]*ClipMatrix[5] + vertex[2]*ClipMatrix[9] + vertex[3]*ClipMatrix[13]) >> 12;
-    PosTestResult[2] = (vertex[0]*ClipMatrix[2] + vertex[1]*ClipMatrix[6] + vertex[2]*ClipMatrix[10] + vertex[3]*ClipMatrix[14]) >> 12;
-    PosTestResult[3] = (vertex[0]*ClipMatrix[3] + vertex[1]*ClipMatrix[7] + vertex[2]*ClipMatrix[11] + vertex[3]*ClipMatrix[15]) >> 12;
+    Transform<12, 4>(PosTestResult, vertex, ClipMatrix);
 
     AddCycles(5);
 }
@@ -2481,6 +2508,37 @@ void Run()
 }
 
 
+void SetCmdCapture(std::vector<CmdFIFOEntry>* capture)
+{
+    CmdCapture = capture;
+}
+
+u32 ReplayCommands(const CmdFIFOEntry* cmds, u32 count)
+{
+    // finish whatever was queued first, the commands have to run in order
+    while (!CmdPIPE.IsEmpty() && !FlushRequest)
+        ExecuteCommand();
+
+    // command timings don't matter here, this only keeps the counter from overflowing
+    CycleCount = 0;
+
+    u32 i = 0;
+    while (i < count && !FlushRequest)
+    {
+        CmdPIPE.Write(cmds[i]);
+        if (cmds[i].Command == 0x11 || cmds[i].Command == 0x12)
+            NumPushPopCommands++;
+        else if (cmds[i].Command == 0x70 || cmds[i].Command == 0x71 || cmds[i].Command == 0x72)
+            NumTestCommands++;
+
+        ExecuteCommand();
+        i++;
+    }
+
+    return i;
+}
+
+
 void CheckFIFOIRQ()
 {
     bool irq = false;
@@ -2502,11 +2560,17 @@ void CheckFIFODMA()
 
 void VCount144()
 {
+    if (RenderSkipped) return;
+
+    PROFILER_ENTER(PROFILER_STAGE(Stage_GPU3DRender));
     CurrentRenderer->VCount144();
+    PROFILER_LEAVE();
 }
 
 void RestartFrame()
 {
+    // the renderer starts over with a frame queued
+    RenderSkipped = false;
     CurrentRenderer->RestartFrame();
 }
 
@@ -2525,6 +2589,8 @@ bool YSort(Polygon* a, Polygon* b)
 
 void VBlank()
 {
+    if (GPU3D_Capture::Recording) GPU3D_Capture::VBlank();
+
     if (GeometryEnabled)
     {
         if (RenderingEnabled)
@@ -2602,13 +2668,31 @@ void VBlank()
 
 void VCount215()
 {
+    if (GPU3D_Capture::Recording) GPU3D_Capture::RenderFrame();
+
+    RenderSkipped = false;
+
+    PROFILER_ENTER(PROFILER_STAGE(Stage_GPU3DRender));
     CurrentRenderer->RenderFrame();
+    PROFILER_LEAVE();
+}
+
+void SkipRender()
+{
+    RenderSkipped = true;
+}
+
+void RenderSkippedFrame()
+{
+    if (RenderSkipped) VCount215();
 }
 
 void SetRenderXPos(u16 xpos)
 {
     if (!RenderingEnabled) return;
 
+    if (GPU3D_Capture::Recording) GPU3D_Capture::SetRenderXPos(xpos);
+
     RenderXPos = xpos & 0x01FF;
 }
 
@@ -2616,9 +2700,11 @@ u32 ScrolledLine[256];
 
 u32* GetLine(int line)
 {
-    if (!AbortFrame)
+    if (!AbortFrame && !RenderSkipped)
     {
+        PROFILER_ENTER(PROFILER_STAGE(Stage_GPU3DRender));
         u32* rawline = CurrentRenderer->GetLine(line);
+        PROFILER_LEAVE();
 
         if (RenderXPos == 0) return rawline;
 
@@ -2671,6 +2757,7 @@ void WriteToGXFIFO(u32 val)
             CmdFIFOEntry entry;
             entry.Command = CurCommand & 0xFF;
             entry.Param = val;
+            if (CmdCapture) CmdCapture->push_back(entry);
             CmdFIFOWrite(entry);
         }
 
@@ -2830,6 +2917,8 @@ void Write8(u32 addr, u8 val)
     if (!RenderingEnabled && addr >= 0x04000320 && addr < 0x04000400) return;
     if (!GeometryEnabled  && addr >= 0x04000400 && addr < 0x04000700) return;
 
+    if (GPU3D_Capture::Recording) GPU3D_Capture::RegisterWrite(addr, val, 8);
+
     switch (addr)
     {
     case 0x04000340:
@@ -2880,6 +2969,8 @@ void Write16(u32 addr, u16 val)
     if (!RenderingEnabled && addr >= 0x04000320 && addr < 0x04000400) return;
     if (!GeometryEnabled  && addr >= 0x04000400 && addr < 0x04000700) return;
 
+    if (GPU3D_Capture::Recording) GPU3D_Capture::RegisterWrite(addr, val, 16);
+
     switch (addr)
     {
     case 0x04000060:
@@ -2967,6 +3058,10 @@ void Write32(u32 addr, u32 val)
     if (!RenderingEnabled && addr >= 0x04000320 && addr < 0x04000400) return;
     if (!GeometryEnabled  && addr >= 0x04000400 && addr < 0x04000700) return;
 
+    // the commands are recorded on their own
+    if (GPU3D_Capture::Recording && (addr < 0x04000400 || addr >= 0x040005CC))
+        GPU3D_Capture::RegisterWrite(addr, val, 32);
+
     switch (addr)
     {
     case 0x04000060:
@@ -3026,6 +3121,7 @@ void Write32(u32 addr, u32 val)
         CmdFIFOEntry entry;
         entry.Command = (addr & 0x1FC) >> 2;
         entry.Param = val;
+        if (CmdCapture) CmdCapture->push_back(entry);
         CmdFIFOWrite(entry);
         return;
     }
@@ -21,6 +21,7 @@
 
 #include <array>
 #include <memory>
+#include <vector>
 
 #include "GPU.h"
 #include "Savestate.h"
@@ -100,6 +101,17 @@ extern u32 RenderNumPolygons;
 
 extern bool AbortFrame;
 
+typedef union
+{
+    u64 _contents;
+    struct
+    {
+        u32 Param;
+        u8 Command;
+    };
+
+} CmdFIFOEntry;
+
 extern u64 Timestamp;
 
 bool Init();
@@ -123,11 +135,25 @@ void VCount215();
 
 void RestartFrame();
 
+// while frames are skipped, the 3D scene is only rendered if a display capture
+// needs it. RenderSkippedFrame() renders it late, when one turns out to
+extern bool RenderSkipped;
+void SkipRender();
+void RenderSkippedFrame();
+
 void SetRenderXPos(u16 xpos);
 u32* GetLine(int line);
 
 void WriteToGXFIFO(u32 val);
 
+// used to run the geometry engine on its own, see GPU3D_Capture.h.
+// while a capture buffer is set, every command written to the GXFIFO or to
+// the command ports is appended to it. ReplayCommands() runs commands without
+// any timing, until a buffer swap is pending. it returns how many it ran, the
+// rest has to wait for VBlank().
+void SetCmdCapture(std::vector<CmdFIFOEntry>* capture);
+u32 ReplayCommands(const CmdFIFOEntry* cmds, u32 count);
+
 u8 Read8(u32 addr);
 u16 Read16(u32 addr);
 u32 Read32(u32 addr);
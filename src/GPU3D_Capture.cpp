@@ -0,0 +1,245 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <memory>
+#include <vector>
+
+#include "GPU3D_Capture.h"
+#include "GPU.h"
+#include "GPU3D.h"
+#include "MemorySavestate.h"
+#include "Platform.h"
+
+namespace GPU3D
+{
+extern bool GeometryEnabled;
+extern bool RenderingEnabled;
+}
+
+namespace GPU3D_Capture
+{
+
+// the geometry engine state is saved with its vertex and polygon RAM
+const u32 StateSize = 4 * 1024 * 1024;
+
+// banks A-G can hold textures or texture palettes
+const int NumTexBanks = 7;
+
+bool Recording = false;
+
+FILE* File = nullptr;
+
+std::vector<GPU3D::CmdFIFOEntry> Commands;
+
+// what the player has of the texture banks so far
+std::unique_ptr<u8[]> VRAMShadow[NumTexBanks];
+u8 VRAMCNTShadow[NumTexBanks];
+
+
+void Write8(u8 val)
+{
+    fwrite(&val, 1, 1, File);
+}
+
+void Write16(u16 val)
+{
+    fwrite(&val, 2, 1, File);
+}
+
+void Write32(u32 val)
+{
+    fwrite(&val, 4, 1, File);
+}
+
+// commands are written in batches, those have to go out before anything else
+void FlushCommands()
+{
+    if (Commands.empty()) return;
+
+    Write8(Record_Commands);
+    Write32((u32)Commands.size());
+    for (const GPU3D::CmdFIFOEntry& entry : Commands)
+    {
+        Write8(entry.Command);
+        Write32(entry.Param);
+    }
+
+    Commands.clear();
+}
+
+void SyncVRAM()
+{
+    for (int bank = 0; bank < NumTexBanks; bank++)
+    {
+        u8 cnt = GPU::VRAMCNT[bank];
+        if (cnt != VRAMCNTShadow[bank])
+        {
+            Write8(Record_VRAMCNT);
+            Write8(bank);
+            Write8(cnt);
+            VRAMCNTShadow[bank] = cnt;
+        }
+
+        // only what's mapped for the 3D engine is of interest
+        if ((cnt & 0x87) != 0x83) continue;
+
+        u8* vram = GPU::VRAM[bank];
+        u8* shadow = VRAMShadow[bank].get();
+        u32 size = GPU::VRAMMask[bank] + 1;
+
+        u32 addr = 0;
+        while (addr < size)
+        {
+            if (!memcmp(&vram[addr], &shadow[addr], GPU::VRAMDirtyGranularity))
+            {
+                addr += GPU::VRAMDirtyGranularity;
+                continue;
+            }
+
+            u32 start = addr;
+            while (addr < size && memcmp(&vram[addr], &shadow[addr], GPU::VRAMDirtyGranularity))
+                addr += GPU::VRAMDirtyGranularity;
+
+            Write8(Record_VRAM);
+            Write8(bank);
+            Write32(start);
+            Write32(addr - start);
+            fwrite(&vram[start], addr - start, 1, File);
+            memcpy(&shadow[start], &vram[start], addr - start);
+        }
+    }
+}
+
+
+bool Start(const std::string& path)
+{
+    if (Recording) Stop();
+
+    File = Platform::OpenFile(path, "wb");
+    if (!File)
+    {
+        printf("GX capture: could not open %s\n", path.c_str());
+        return false;
+    }
+
+    std::unique_ptr<u8[]> state = std::make_unique<u8[]>(StateSize);
+    u32 statelen;
+    {
+        MemorySavestate savestate(state.get(), true);
+        GPU3D::DoSavestate(&savestate);
+        statelen = savestate.Length();
+    }
+
+    Write32(Magic);
+    Write32(Version);
+    Write32(statelen);
+    fwrite(state.get(), statelen, 1, File);
+
+    // the player starts from a console that was just reset
+    for (int bank = 0; bank < NumTexBanks; bank++)
+    {
+        u32 size = GPU::VRAMMask[bank] + 1;
+        VRAMShadow[bank] = std::make_unique<u8[]>(size);
+        memset(VRAMShadow[bank].get(), 0, size);
+        VRAMCNTShadow[bank] = 0;
+    }
+
+    Recording = true;
+    SetEnabled(GPU3D::GeometryEnabled, GPU3D::RenderingEnabled);
+    GPU3D::SetCmdCapture(&Commands);
+    return true;
+}
+
+void Stop()
+{
+    if (!Recording) return;
+
+    GPU3D::SetCmdCapture(nullptr);
+    FlushCommands();
+    fclose(File);
+    File = nullptr;
+
+    for (int bank = 0; bank < NumTexBanks; bank++)
+        VRAMShadow[bank] = nullptr;
+
+    Recording = false;
+}
+
+
+void RegisterWrite(u32 addr, u32 val, int size)
+{
+    FlushCommands();
+
+    switch (size)
+    {
+    case 8:
+        Write8(Record_Write8);
+        Write32(addr);
+        Write8(val);
+        break;
+    case 16:
+        Write8(Record_Write16);
+        Write32(addr);
+        Write16(val);
+        break;
+    case 32:
+        Write8(Record_Write32);
+        Write32(addr);
+        Write32(val);
+        break;
+    }
+}
+
+void SetEnabled(bool geometry, bool rendering)
+{
+    FlushCommands();
+
+    Write8(Record_Enable);
+    Write8(geometry);
+    Write8(rendering);
+}
+
+void SetRenderXPos(u16 xpos)
+{
+    FlushCommands();
+
+    Write8(Record_RenderXPos);
+    Write16(xpos);
+}
+
+void VBlank()
+{
+    FlushCommands();
+
+    Write8(Record_VBlank);
+}
+
+void RenderFrame()
+{
+    FlushCommands();
+
+    // textures are only looked at when rendering, so this is enough
+    SyncVRAM();
+
+    Write8(Record_RenderFrame);
+}
+
+}
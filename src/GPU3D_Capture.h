@@ -0,0 +1,68 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef GPU3D_CAPTURE_H
+#define GPU3D_CAPTURE_H
+
+#include <string>
+
+#include "types.h"
+
+// records everything the 3D engine gets from the rest of the console, so that
+// the geometry engine and the renderers can be run without the CPUs.
+// a capture starts with the GPU3D savestate, then a list of records:
+// the commands sent to the GXFIFO, the 3D register writes, the texture VRAM
+// changes and the points where VBlank and the frame rendering happen.
+// see frontend/bench/gxreplay.cpp for the player.
+namespace GPU3D_Capture
+{
+
+const u32 Magic = 0x4358474D; // MGXC
+const u32 Version = 1;
+
+enum
+{
+    Record_Commands = 0,    // u32 count, then count times u8 command + u32 param
+    Record_Write8,          // u32 addr, u8 val
+    Record_Write16,         // u32 addr, u16 val
+    Record_Write32,         // u32 addr, u32 val
+    Record_Enable,          // u8 geometry, u8 rendering
+    Record_RenderXPos,      // u16 xpos
+    Record_VRAMCNT,         // u8 bank, u8 cnt
+    Record_VRAM,            // u8 bank, u32 offset, u32 length, data
+    Record_VBlank,
+    Record_RenderFrame,
+
+    Record_MAX
+};
+
+extern bool Recording;
+
+bool Start(const std::string& path);
+void Stop();
+
+// called by GPU3D while recording
+void RegisterWrite(u32 addr, u32 val, int size);
+void SetEnabled(bool geometry, bool rendering);
+void SetRenderXPos(u16 xpos);
+void VBlank();
+void RenderFrame();
+
+}
+
+#endif // GPU3D_CAPTURE_H
@@ -24,6 +24,17 @@
 #include "NDS.h"
 #include "GPU.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+#define GPU3D_SIMD
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define GPU3D_SIMD
+#endif
+
 
 namespace GPU3D
 {
@@ -40,12 +51,48 @@ void SoftRenderer::StopRenderThread()
         Platform::Thread_Wait(RenderThread);
         Platform::Thread_Free(RenderThread);
     }
+
+    StopBandThreads();
+}
+
+void SoftRenderer::StopBandThreads()
+{
+    if (BandThreadsRunning.load(std::memory_order_relaxed))
+    {
+        BandThreadsRunning = false;
+        for (int i = 1; i < NumBands; i++)
+            Platform::Semaphore_Post(Sema_BandStart[i]);
+
+        for (int i = 1; i < NumBands; i++)
+        {
+            Platform::Thread_Wait(BandThread[i]);
+            Platform::Thread_Free(BandThread[i]);
+
+            delete[] BandPolygonList[i];
+            BandPolygonList[i] = nullptr;
+        }
+    }
+}
+
+void SoftRenderer::SetupBandThreads()
+{
+    if (NumBands < 2 || BandThreadsRunning.load(std::memory_order_relaxed))
+        return;
+
+    BandThreadsRunning = true;
+    for (int i = 1; i < NumBands; i++)
+    {
+        BandPolygonList[i] = new RendererPolygon[2048];
+        BandThread[i] = Platform::Thread_Create(std::bind(&SoftRenderer::BandThreadFunc, this, i));
+    }
 }
 
 void SoftRenderer::SetupRenderThread()
 {
     if (Threaded)
     {
+        SetupBandThreads();
+
         if (!RenderThreadRunning.load(std::memory_order_relaxed))
         {
             RenderThreadRunning = true;
@@ -62,6 +109,13 @@ void SoftRenderer::SetupRenderThread()
         Platform::Semaphore_Reset(Sema_RenderStart);
         Platform::Semaphore_Reset(Sema_ScanlineCount);
 
+        for (int i = 0; i < MaxRenderThreads; i++)
+        {
+            Platform::Semaphore_Reset(Sema_BandDone[i]);
+            Platform::Semaphore_Reset(Sema_BandFirstLine[i]);
+            Platform::Semaphore_Reset(Sema_BandLastLine[i]);
+        }
+
         Platform::Semaphore_Post(Sema_RenderStart);
     }
     else
@@ -74,7 +128,7 @@ void SoftRenderer::SetupRenderThread()
 SoftRenderer::SoftRenderer()
     : Renderer3D(false)
 {
-
+    ScalarSpans = false;
 }
 
 bool SoftRenderer::Init()
@@ -83,10 +137,26 @@ bool SoftRenderer::Init()
     Sema_RenderDone = Platform::Semaphore_Create();
     Sema_ScanlineCount = Platform::Semaphore_Create();
 
+    for (int i = 0; i < MaxRenderThreads; i++)
+    {
+        Sema_BandStart[i] = Platform::Semaphore_Create();
+        Sema_BandDone[i] = Platform::Semaphore_Create();
+        Sema_BandFirstLine[i] = Platform::Semaphore_Create();
+        Sema_BandLastLine[i] = Platform::Semaphore_Create();
+        BandPolygonList[i] = nullptr;
+    }
+
+    ScanlineLock = Platform::Mutex_Create();
+
     Threaded = false;
     RenderThreadRunning = false;
     RenderThreadRendering = false;
 
+    NumBands = 1;
+    BandThreadsRunning = false;
+
+    TexCacheTexels = 0;
+
     return true;
 }
 
@@ -97,6 +167,16 @@ void SoftRenderer::DeInit()
     Platform::Semaphore_Free(Sema_RenderStart);
     Platform::Semaphore_Free(Sema_RenderDone);
     Platform::Semaphore_Free(Sema_ScanlineCount);
+
+    for (int i = 0; i < MaxRenderThreads; i++)
+    {
+        Platform::Semaphore_Free(Sema_BandStart[i]);
+        Platform::Semaphore_Free(Sema_BandDone[i]);
+        Platform::Semaphore_Free(Sema_BandFirstLine[i]);
+        Platform::Semaphore_Free(Sema_BandLastLine[i]);
+    }
+
+    Platform::Mutex_Free(ScanlineLock);
 }
 
 void SoftRenderer::Reset()
@@ -107,22 +187,365 @@ void SoftRenderer::Reset()
 
     PrevIsShadowMask = false;
 
+    TexCache.clear();
+    TexCacheTexels = 0;
+
     SetupRenderThread();
 }
 
 void SoftRenderer::SetRenderSettings(GPU::RenderSettings& settings)
 {
     Threaded = settings.Soft_Threaded;
+
+    int numbands = std::clamp(settings.Soft_ThreadCount, 1, MaxRenderThreads);
+    if (numbands != NumBands)
+    {
+        StopRenderThread();
+        NumBands = numbands;
+    }
+
     SetupRenderThread();
 }
 
-void SoftRenderer::TextureLookup(u32 texparam, u32 texpal, s16 s, s16 t, u16* color, u8* alpha)
+u64 SoftRenderer::TexCacheKey(u32 texparam, u32 texpal)
+{
+    // the repeat/flip bits and the texture coordinate transform mode
+    // don't change how the texture is decoded
+    texparam &= 0x3FF0FFFF;
+    if (((texparam >> 26) & 0x7) == 7)
+        texpal = 0;
+
+    return texparam | ((u64)texpal << 32);
+}
+
+template <u32 Size>
+bool IsRangeDirty(NonStupidBitField<Size>& dirty, u32 addr, u32 size)
+{
+    if (size == 0)
+        return false;
+
+    u32 first = addr / GPU::VRAMDirtyGranularity;
+    u32 last = (addr + size - 1) / GPU::VRAMDirtyGranularity;
+    for (u32 i = first; i <= last; i++)
+    {
+        if (dirty[i & (Size - 1)])
+            return true;
+    }
+    return false;
+}
+
+void SoftRenderer::InvalidateTexCache(NonStupidBitField<512*1024/GPU::VRAMDirtyGranularity>& textureDirty,
+    NonStupidBitField<128*1024/GPU::VRAMDirtyGranularity>& texPalDirty)
+{
+    for (auto it = TexCache.begin(); it != TexCache.end();)
+    {
+        TexCacheEntry& entry = it->second;
+        if (IsRangeDirty(textureDirty, entry.TexAddr, entry.TexSize)
+            || IsRangeDirty(textureDirty, entry.Slot1Addr, entry.Slot1Size)
+            || IsRangeDirty(texPalDirty, entry.PalAddr, entry.PalSize))
+        {
+            TexCacheTexels -= entry.NumTexels;
+            it = TexCache.erase(it);
+        }
+        else
+            it++;
+    }
+}
+
+void SoftRenderer::UpdateTexCache(Polygon** polygons, int npolys)
+{
+    if (!(RenderDispCnt & (1<<0)))
+        return;
+
+    // entries are only thrown away between frames
+    // so that the polygons of this frame can keep pointers to them
+    if (TexCacheTexels > TexCacheMaxTexels)
+    {
+        TexCache.clear();
+        TexCacheTexels = 0;
+    }
+
+    for (int i = 0; i < npolys; i++)
+    {
+        Polygon* polygon = polygons[i];
+        if (polygon->Degenerate || ((polygon->TexParam >> 26) & 0x7) == 0)
+            continue;
+
+        TexCacheEntry& entry = TexCache[TexCacheKey(polygon->TexParam, polygon->TexPalette)];
+        if (!entry.Texels)
+            DecodeTexture(entry, polygon->TexParam, polygon->TexPalette);
+    }
+}
+
+void SoftRenderer::DecodeTexture(TexCacheEntry& entry, u32 texparam, u32 texpal)
 {
     u32 vramaddr = (texparam & 0xFFFF) << 3;
 
     s32 width = 8 << ((texparam >> 20) & 0x7);
     s32 height = 8 << ((texparam >> 23) & 0x7);
 
+    entry.NumTexels = width * height;
+    entry.Texels = std::make_unique<u32[]>(entry.NumTexels);
+    TexCacheTexels += entry.NumTexels;
+
+    entry.TexAddr = vramaddr;
+    entry.Slot1Addr = 0;
+    entry.Slot1Size = 0;
+    entry.PalAddr = 0;
+    entry.PalSize = 0;
+
+    u32* texels = entry.Texels.get();
+
+    u8 alpha0;
+    if (texparam & (1<<29)) alpha0 = 0;
+    else                    alpha0 = 31;
+
+    switch ((texparam >> 26) & 0x7)
+    {
+    case 1: // A3I5
+        {
+            texpal <<= 4;
+            entry.TexSize = width * height;
+            entry.PalAddr = texpal;
+            entry.PalSize = 32*2;
+
+            for (s32 i = 0; i < width * height; i++)
+            {
+                u8 pixel = ReadVRAM_Texture<u8>(vramaddr + i);
+
+                u16 color = ReadVRAM_TexPal<u16>(texpal + ((pixel&0x1F)<<1));
+                u8 alpha = ((pixel >> 3) & 0x1C) + (pixel >> 6);
+                texels[i] = color | (alpha << 16);
+            }
+        }
+        break;
+
+    case 2: // 4-color
+        {
+            texpal <<= 3;
+            entry.TexSize = (width * height) >> 2;
+            entry.PalAddr = texpal;
+            entry.PalSize = 4*2;
+
+            for (s32 i = 0; i < width * height; i++)
+            {
+                u8 pixel = ReadVRAM_Texture<u8>(vramaddr + (i >> 2));
+                pixel >>= ((i & 0x3) << 1);
+                pixel &= 0x3;
+
+                u16 color = ReadVRAM_TexPal<u16>(texpal + (pixel<<1));
+                u8 alpha = (pixel==0) ? alpha0 : 31;
+                texels[i] = color | (alpha << 16);
+            }
+        }
+        break;
+
+    case 3: // 16-color
+        {
+            texpal <<= 4;
+            entry.TexSize = (width * height) >> 1;
+            entry.PalAddr = texpal;
+            entry.PalSize = 16*2;
+
+            for (s32 i = 0; i < width * height; i++)
+            {
+                u8 pixel = ReadVRAM_Texture<u8>(vramaddr + (i >> 1));
+                if (i & 0x1) pixel >>= 4;
+                else         pixel &= 0xF;
+
+                u16 color = ReadVRAM_TexPal<u16>(texpal + (pixel<<1));
+                u8 alpha = (pixel==0) ? alpha0 : 31;
+                texels[i] = color | (alpha << 16);
+            }
+        }
+        break;
+
+    case 4: // 256-color
+        {
+            texpal <<= 4;
+            entry.TexSize = width * height;
+            entry.PalAddr = texpal;
+            entry.PalSize = 256*2;
+
+            for (s32 i = 0; i < width * height; i++)
+            {
+                u8 pixel = ReadVRAM_Texture<u8>(vramaddr + i);
+
+                u16 color = ReadVRAM_TexPal<u16>(texpal + (pixel<<1));
+                u8 alpha = (pixel==0) ? alpha0 : 31;
+                texels[i] = color | (alpha << 16);
+            }
+        }
+        break;
+
+    case 5: // compressed
+        {
+            texpal <<= 4;
+            entry.TexSize = (width * height) >> 2;
+            entry.PalAddr = texpal;
+
+            u32 slot1min = UINT32_MAX, slot1max = 0;
+            u32 palmax = 0;
+
+            for (s32 t = 0; t < height; t++)
+            {
+                for (s32 s = 0; s < width; s++)
+                {
+                    u32 texeladdr = vramaddr + ((t & 0x3FC) * (width>>2)) + (s & 0x3FC);
+                    texeladdr += (t & 0x3);
+
+                    u32 slot1addr = 0x20000 + ((texeladdr & 0x1FFFC) >> 1);
+                    if (texeladdr >= 0x40000)
+                        slot1addr += 0x10000;
+
+                    slot1min = std::min(slot1min, slot1addr);
+                    slot1max = std::max(slot1max, slot1addr);
+
+                    u8 val = ReadVRAM_Texture<u8>(texeladdr);
+                    val >>= (2 * (s & 0x3));
+
+                    u16 palinfo = ReadVRAM_Texture<u16>(slot1addr);
+                    u32 paloffset = (palinfo & 0x3FFF) << 2;
+
+                    palmax = std::max(palmax, paloffset);
+
+                    u16 color;
+                    u8 alpha;
+                    switch (val & 0x3)
+                    {
+                    case 0:
+                        color = ReadVRAM_TexPal<u16>(texpal + paloffset);
+                        alpha = 31;
+                        break;
+
+                    case 1:
+                        color = ReadVRAM_TexPal<u16>(texpal + paloffset + 2);
+                        alpha = 31;
+                        break;
+
+                    case 2:
+                        if ((palinfo >> 14) == 1)
+                        {
+                            u16 color0 = ReadVRAM_TexPal<u16>(texpal + paloffset);
+                            u16 color1 = ReadVRAM_TexPal<u16>(texpal + paloffset + 2);
+
+                            u32 r0 = color0 & 0x001F;
+                            u32 g0 = color0 & 0x03E0;
+                            u32 b0 = color0 & 0x7C00;
+                            u32 r1 = color1 & 0x001F;
+                            u32 g1 = color1 & 0x03E0;
+                            u32 b1 = color1 & 0x7C00;
+
+                            u32 r = (r0 + r1) >> 1;
+                            u32 g = ((g0 + g1) >> 1) & 0x03E0;
+                            u32 b = ((b0 + b1) >> 1) & 0x7C00;
+
+                            color = r | g | b;
+                        }
+                        else if ((palinfo >> 14) == 3)
+                        {
+                            u16 color0 = ReadVRAM_TexPal<u16>(texpal + paloffset);
+                            u16 color1 = ReadVRAM_TexPal<u16>(texpal + paloffset + 2);
+
+                            u32 r0 = color0 & 0x001F;
+                            u32 g0 = color0 & 0x03E0;
+                            u32 b0 = color0 & 0x7C00;
+                            u32 r1 = color1 & 0x001F;
+                            u32 g1 = color1 & 0x03E0;
+                            u32 b1 = color1 & 0x7C00;
+
+                            u32 r = (r0*5 + r1*3) >> 3;
+                            u32 g = ((g0*5 + g1*3) >> 3) & 0x03E0;
+                            u32 b = ((b0*5 + b1*3) >> 3) & 0x7C00;
+
+                            color = r | g | b;
+                        }
+                        else
+                            color = ReadVRAM_TexPal<u16>(texpal + paloffset + 4);
+                        alpha = 31;
+                        break;
+
+                    case 3:
+                        if ((palinfo >> 14) == 2)
+                        {
+                            color = ReadVRAM_TexPal<u16>(texpal + paloffset + 6);
+                            alpha = 31;
+                        }
+                        else if ((palinfo >> 14) == 3)
+                        {
+                            u16 color0 = ReadVRAM_TexPal<u16>(texpal + paloffset);
+                            u16 color1 = ReadVRAM_TexPal<u16>(texpal + paloffset + 2);
+
+                            u32 r0 = color0 & 0x001F;
+                            u32 g0 = color0 & 0x03E0;
+                            u32 b0 = color0 & 0x7C00;
+                            u32 r1 = color1 & 0x001F;
+                            u32 g1 = color1 & 0x03E0;
+                            u32 b1 = color1 & 0x7C00;
+
+                            u32 r = (r0*3 + r1*5) >> 3;
+                            u32 g = ((g0*3 + g1*5) >> 3) & 0x03E0;
+                            u32 b = ((b0*3 + b1*5) >> 3) & 0x7C00;
+
+                            color = r | g | b;
+                            alpha = 31;
+                        }
+                        else
+                        {
+                            color = 0;
+                            alpha = 0;
+                        }
+                        break;
+                    }
+
+                    texels[t * width + s] = color | (alpha << 16);
+                }
+            }
+
+            entry.Slot1Addr = slot1min;
+            entry.Slot1Size = slot1max + 2 - slot1min;
+            entry.PalSize = palmax + 4*2;
+        }
+        break;
+
+    case 6: // A5I3
+        {
+            texpal <<= 4;
+            entry.TexSize = width * height;
+            entry.PalAddr = texpal;
+            entry.PalSize = 8*2;
+
+            for (s32 i = 0; i < width * height; i++)
+            {
+                u8 pixel = ReadVRAM_Texture<u8>(vramaddr + i);
+
+                u16 color = ReadVRAM_TexPal<u16>(texpal + ((pixel&0x7)<<1));
+                u8 alpha = (pixel >> 3);
+                texels[i] = color | (alpha << 16);
+            }
+        }
+        break;
+
+    case 7: // direct color
+        {
+            entry.TexSize = (width * height) << 1;
+
+            for (s32 i = 0; i < width * height; i++)
+            {
+                u16 color = ReadVRAM_Texture<u16>(vramaddr + (i << 1));
+                u8 alpha = (color & 0x8000) ? 31 : 0;
+                texels[i] = color | (alpha << 16);
+            }
+        }
+        break;
+    }
+}
+
+void SoftRenderer::TextureLookup(const u32* texels, u32 texparam, s16 s, s16 t, u16* color, u8* alpha)
+{
+    s32 width = 8 << ((texparam >> 20) & 0x7);
+    s32 height = 8 << ((texparam >> 23) & 0x7);
+
     s >>= 4;
     t >>= 4;
 
@@ -162,185 +585,304 @@ void SoftRenderer::TextureLookup(u32 texparam, u32 texpal, s16 s, s16 t, u16* co
         else if (t >= height) t = height-1;
     }
 
-    u8 alpha0;
-    if (texparam & (1<<29)) alpha0 = 0;
-    else                    alpha0 = 31;
+    u32 texel = texels[(t * width) + s];
+    *color = texel & 0xFFFF;
+    *alpha = texel >> 16;
+}
 
-    switch ((texparam >> 26) & 0x7)
-    {
-    case 1: // A3I5
-        {
-            vramaddr += ((t * width) + s);
-            u8 pixel = ReadVRAM_Texture<u8>(vramaddr);
+#ifdef GPU3D_SIMD
 
-            texpal <<= 4;
-            *color = ReadVRAM_TexPal<u16>(texpal + ((pixel&0x1F)<<1));
-            *alpha = ((pixel >> 3) & 0x1C) + (pixel >> 6);
-        }
-        break;
+// vector operations for the span interpolation, on four 32-bit lanes
 
-    case 2: // 4-color
-        {
-            vramaddr += (((t * width) + s) >> 2);
-            u8 pixel = ReadVRAM_Texture<u8>(vramaddr);
-            pixel >>= ((s & 0x3) << 1);
-            pixel &= 0x3;
+#if defined(__SSE2__)
 
-            texpal <<= 3;
-            *color = ReadVRAM_TexPal<u16>(texpal + (pixel<<1));
-            *alpha = (pixel==0) ? alpha0 : 31;
-        }
-        break;
+typedef __m128i s32x4;
 
-    case 3: // 16-color
-        {
-            vramaddr += (((t * width) + s) >> 1);
-            u8 pixel = ReadVRAM_Texture<u8>(vramaddr);
-            if (s & 0x1) pixel >>= 4;
-            else         pixel &= 0xF;
+inline s32x4 Load(const u32* ptr) { return _mm_loadu_si128((const __m128i*)ptr); }
+inline void Store(s32* ptr, s32x4 val) { _mm_storeu_si128((__m128i*)ptr, val); }
+inline void Store(u32* ptr, s32x4 val) { _mm_storeu_si128((__m128i*)ptr, val); }
+inline s32x4 Splat(s32 val) { return _mm_set1_epi32(val); }
+inline s32x4 Ramp(s32 val) { return _mm_setr_epi32(val, val+1, val+2, val+3); }
 
-            texpal <<= 4;
-            *color = ReadVRAM_TexPal<u16>(texpal + (pixel<<1));
-            *alpha = (pixel==0) ? alpha0 : 31;
-        }
-        break;
+inline s32x4 And(s32x4 a, s32x4 b) { return _mm_and_si128(a, b); }
+inline s32x4 Or(s32x4 a, s32x4 b) { return _mm_or_si128(a, b); }
+inline s32x4 Add(s32x4 a, s32x4 b) { return _mm_add_epi32(a, b); }
+inline s32x4 Sub(s32x4 a, s32x4 b) { return _mm_sub_epi32(a, b); }
+template <int n> inline s32x4 ShiftRight(s32x4 a) { return _mm_srli_epi32(a, n); }
 
-    case 4: // 256-color
-        {
-            vramaddr += ((t * width) + s);
-            u8 pixel = ReadVRAM_Texture<u8>(vramaddr);
+inline s32x4 Equal(s32x4 a, s32x4 b) { return _mm_cmpeq_epi32(a, b); }
+inline s32x4 LessThan(s32x4 a, s32x4 b) { return _mm_cmplt_epi32(a, b); }
+inline s32x4 LessEqualUnsigned(s32x4 a, s32x4 b)
+{
+    __m128i sign = _mm_set1_epi32(0x80000000);
+    return _mm_andnot_si128(_mm_cmpgt_epi32(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign)), _mm_set1_epi32(-1));
+}
+// one bit per lane
+inline u32 Mask(s32x4 mask) { return _mm_movemask_ps(_mm_castsi128_ps(mask)); }
 
-            texpal <<= 4;
-            *color = ReadVRAM_TexPal<u16>(texpal + (pixel<<1));
-            *alpha = (pixel==0) ? alpha0 : 31;
-        }
-        break;
+// low 32 bits of the 64-bit products of the unsigned lanes, shifted right by n
+template <int n> inline s32x4 MulShift(s32x4 a, s32x4 b)
+{
+    __m128i even = _mm_srli_epi64(_mm_mul_epu32(a, b), n);
+    __m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32)), n);
+    return _mm_or_si128(_mm_and_si128(even, _mm_set_epi32(0, -1, 0, -1)), _mm_slli_epi64(odd, 32));
+}
 
-    case 5: // compressed
-        {
-            vramaddr += ((t & 0x3FC) * (width>>2)) + (s & 0x3FC);
-            vramaddr += (t & 0x3);
+inline s32x4 Mul(s32x4 a, s32x4 b)
+{
+#ifdef __SSE4_1__
+    return _mm_mullo_epi32(a, b);
+#else
+    return MulShift<0>(a, b);
+#endif
+}
 
-            u32 slot1addr = 0x20000 + ((vramaddr & 0x1FFFC) >> 1);
-            if (vramaddr >= 0x40000)
-                slot1addr += 0x10000;
+// low 32 bits of (acc + i*step) >> n for each lane i, all the sums have to be positive
+template <int n> inline s32x4 Ramp64Shift(s64 acc, s64 step)
+{
+    __m128 lo = _mm_castsi128_ps(_mm_srli_epi64(_mm_set_epi64x(acc + step, acc), n));
+    __m128 hi = _mm_castsi128_ps(_mm_srli_epi64(_mm_set_epi64x(acc + 3*step, acc + 2*step), n));
+    return _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+}
 
-            u8 val = ReadVRAM_Texture<u8>(vramaddr);
-            val >>= (2 * (s & 0x3));
+// (x * numscale) / (x * w0 + xrem * w1) rounded towards zero, or 0 if the divisor is 0
+// all the values involved are exact in double precision, which makes this match the
+// 64-bit integer division of the scalar path as long as the result stays small
+inline s32x4 PerspectiveFactor(s32x4 x, s32x4 xrem, double numscale, double w0, double w1)
+{
+    __m128d x01 = _mm_cvtepi32_pd(x);
+    __m128d x23 = _mm_cvtepi32_pd(_mm_unpackhi_epi64(x, x));
+    __m128d r01 = _mm_cvtepi32_pd(xrem);
+    __m128d r23 = _mm_cvtepi32_pd(_mm_unpackhi_epi64(xrem, xrem));
 
-            u16 palinfo = ReadVRAM_Texture<u16>(slot1addr);
-            u32 paloffset = (palinfo & 0x3FFF) << 2;
-            texpal <<= 4;
+    __m128d den01 = _mm_add_pd(_mm_mul_pd(x01, _mm_set1_pd(w0)), _mm_mul_pd(r01, _mm_set1_pd(w1)));
+    __m128d den23 = _mm_add_pd(_mm_mul_pd(x23, _mm_set1_pd(w0)), _mm_mul_pd(r23, _mm_set1_pd(w1)));
 
-            switch (val & 0x3)
-            {
-            case 0:
-                *color = ReadVRAM_TexPal<u16>(texpal + paloffset);
-                *alpha = 31;
-                break;
-
-            case 1:
-                *color = ReadVRAM_TexPal<u16>(texpal + paloffset + 2);
-                *alpha = 31;
-                break;
-
-            case 2:
-                if ((palinfo >> 14) == 1)
-                {
-                    u16 color0 = ReadVRAM_TexPal<u16>(texpal + paloffset);
-                    u16 color1 = ReadVRAM_TexPal<u16>(texpal + paloffset + 2);
+    __m128d q01 = _mm_div_pd(_mm_mul_pd(x01, _mm_set1_pd(numscale)), den01);
+    __m128d q23 = _mm_div_pd(_mm_mul_pd(x23, _mm_set1_pd(numscale)), den23);
+    q01 = _mm_andnot_pd(_mm_cmpeq_pd(den01, _mm_setzero_pd()), q01);
+    q23 = _mm_andnot_pd(_mm_cmpeq_pd(den23, _mm_setzero_pd()), q23);
 
-                    u32 r0 = color0 & 0x001F;
-                    u32 g0 = color0 & 0x03E0;
-                    u32 b0 = color0 & 0x7C00;
-                    u32 r1 = color1 & 0x001F;
-                    u32 g1 = color1 & 0x03E0;
-                    u32 b1 = color1 & 0x7C00;
+    return _mm_unpacklo_epi64(_mm_cvttpd_epi32(q01), _mm_cvttpd_epi32(q23));
+}
 
-                    u32 r = (r0 + r1) >> 1;
-                    u32 g = ((g0 + g1) >> 1) & 0x03E0;
-                    u32 b = ((b0 + b1) >> 1) & 0x7C00;
+#else
 
-                    *color = r | g | b;
-                }
-                else if ((palinfo >> 14) == 3)
-                {
-                    u16 color0 = ReadVRAM_TexPal<u16>(texpal + paloffset);
-                    u16 color1 = ReadVRAM_TexPal<u16>(texpal + paloffset + 2);
+typedef int32x4_t s32x4;
 
-                    u32 r0 = color0 & 0x001F;
-                    u32 g0 = color0 & 0x03E0;
-                    u32 b0 = color0 & 0x7C00;
-                    u32 r1 = color1 & 0x001F;
-                    u32 g1 = color1 & 0x03E0;
-                    u32 b1 = color1 & 0x7C00;
+inline s32x4 Load(const u32* ptr) { return vreinterpretq_s32_u32(vld1q_u32(ptr)); }
+inline void Store(s32* ptr, s32x4 val) { vst1q_s32(ptr, val); }
+inline void Store(u32* ptr, s32x4 val) { vst1q_u32(ptr, vreinterpretq_u32_s32(val)); }
+inline s32x4 Splat(s32 val) { return vdupq_n_s32(val); }
+inline s32x4 Ramp(s32 val)
+{
+    static const s32 offsets[4] = {0, 1, 2, 3};
+    return vaddq_s32(vdupq_n_s32(val), vld1q_s32(offsets));
+}
 
-                    u32 r = (r0*5 + r1*3) >> 3;
-                    u32 g = ((g0*5 + g1*3) >> 3) & 0x03E0;
-                    u32 b = ((b0*5 + b1*3) >> 3) & 0x7C00;
+inline s32x4 And(s32x4 a, s32x4 b) { return vandq_s32(a, b); }
+inline s32x4 Or(s32x4 a, s32x4 b) { return vorrq_s32(a, b); }
+inline s32x4 Add(s32x4 a, s32x4 b) { return vaddq_s32(a, b); }
+inline s32x4 Sub(s32x4 a, s32x4 b) { return vsubq_s32(a, b); }
+template <int n> inline s32x4 ShiftRight(s32x4 a) { return vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(a), n)); }
+
+inline s32x4 Equal(s32x4 a, s32x4 b) { return vreinterpretq_s32_u32(vceqq_s32(a, b)); }
+inline s32x4 LessThan(s32x4 a, s32x4 b) { return vreinterpretq_s32_u32(vcltq_s32(a, b)); }
+inline s32x4 LessEqualUnsigned(s32x4 a, s32x4 b) { return vreinterpretq_s32_u32(vcleq_u32(vreinterpretq_u32_s32(a), vreinterpretq_u32_s32(b))); }
+// one bit per lane
+inline u32 Mask(s32x4 mask)
+{
+    static const u32 bits[4] = {1, 2, 4, 8};
+    return vaddvq_u32(vandq_u32(vreinterpretq_u32_s32(mask), vld1q_u32(bits)));
+}
 
-                    *color = r | g | b;
-                }
-                else
-                    *color = ReadVRAM_TexPal<u16>(texpal + paloffset + 4);
-                *alpha = 31;
-                break;
+inline s32x4 Mul(s32x4 a, s32x4 b) { return vmulq_s32(a, b); }
 
-            case 3:
-                if ((palinfo >> 14) == 2)
-                {
-                    *color = ReadVRAM_TexPal<u16>(texpal + paloffset + 6);
-                    *alpha = 31;
-                }
-                else if ((palinfo >> 14) == 3)
-                {
-                    u16 color0 = ReadVRAM_TexPal<u16>(texpal + paloffset);
-                    u16 color1 = ReadVRAM_TexPal<u16>(texpal + paloffset + 2);
-
-                    u32 r0 = color0 & 0x001F;
-                    u32 g0 = color0 & 0x03E0;
-                    u32 b0 = color0 & 0x7C00;
-                    u32 r1 = color1 & 0x001F;
-                    u32 g1 = color1 & 0x03E0;
-                    u32 b1 = color1 & 0x7C00;
-
-                    u32 r = (r0*3 + r1*5) >> 3;
-                    u32 g = ((g0*3 + g1*5) >> 3) & 0x03E0;
-                    u32 b = ((b0*3 + b1*5) >> 3) & 0x7C00;
-
-                    *color = r | g | b;
-                    *alpha = 31;
-                }
-                else
-                {
-                    *color = 0;
-                    *alpha = 0;
-                }
-                break;
-            }
+// low 32 bits of the 64-bit products of the unsigned lanes, shifted right by n
+template <int n> inline s32x4 MulShift(s32x4 a, s32x4 b)
+{
+    uint32x4_t ua = vreinterpretq_u32_s32(a);
+    uint32x4_t ub = vreinterpretq_u32_s32(b);
+    uint64x2_t lo = vshrq_n_u64(vmull_u32(vget_low_u32(ua), vget_low_u32(ub)), n);
+    uint64x2_t hi = vshrq_n_u64(vmull_high_u32(ua, ub), n);
+    return vreinterpretq_s32_u32(vcombine_u32(vmovn_u64(lo), vmovn_u64(hi)));
+}
+
+// low 32 bits of (acc + i*step) >> n for each lane i, all the sums have to be positive
+template <int n> inline s32x4 Ramp64Shift(s64 acc, s64 step)
+{
+    const u64 sums[4] = {(u64)acc, (u64)(acc + step), (u64)(acc + 2*step), (u64)(acc + 3*step)};
+    uint64x2_t lo = vshrq_n_u64(vld1q_u64(&sums[0]), n);
+    uint64x2_t hi = vshrq_n_u64(vld1q_u64(&sums[2]), n);
+    return vreinterpretq_s32_u32(vcombine_u32(vmovn_u64(lo), vmovn_u64(hi)));
+}
+
+// (x * numscale) / (x * w0 + xrem * w1) rounded towards zero, or 0 if the divisor is 0
+// all the values involved are exact in double precision, which makes this match the
+// 64-bit integer division of the scalar path as long as the result stays small
+inline s32x4 PerspectiveFactor(s32x4 x, s32x4 xrem, double numscale, double w0, double w1)
+{
+    float64x2_t x01 = vcvtq_f64_s64(vmovl_s32(vget_low_s32(x)));
+    float64x2_t x23 = vcvtq_f64_s64(vmovl_high_s32(x));
+    float64x2_t r01 = vcvtq_f64_s64(vmovl_s32(vget_low_s32(xrem)));
+    float64x2_t r23 = vcvtq_f64_s64(vmovl_high_s32(xrem));
+
+    float64x2_t den01 = vaddq_f64(vmulq_n_f64(x01, w0), vmulq_n_f64(r01, w1));
+    float64x2_t den23 = vaddq_f64(vmulq_n_f64(x23, w0), vmulq_n_f64(r23, w1));
+
+    int64x2_t q01 = vcvtq_s64_f64(vdivq_f64(vmulq_n_f64(x01, numscale), den01));
+    int64x2_t q23 = vcvtq_s64_f64(vdivq_f64(vmulq_n_f64(x23, numscale), den23));
+    q01 = vbicq_s64(q01, vreinterpretq_s64_u64(vceqzq_f64(den01)));
+    q23 = vbicq_s64(q23, vreinterpretq_s64_u64(vceqzq_f64(den23)));
+
+    return vcombine_s32(vmovn_s64(q01), vmovn_s64(q23));
+}
+
+#endif
+
+// does the same as Interpolator<0>::SetX() and Interpolate() over a span,
+// for four consecutive pixels at once
+// everything that stays the same along the span is worked out beforehand by Setup()
+class SoftRenderer::SpanInterpolator
+{
+public:
+    // the perspective factor needs to stay within 0-256 for the division to be exact
+    static bool Compatible(Interpolator<0>& interp, s32 z0, s32 z1, bool wbuffer)
+    {
+        if (interp.xdiff <= 0 || interp.xdiff >= 0x800)
+            return false;
+
+        // W-buffering always uses the perspective factor, which isn't calculated in linear mode
+        if (interp.linear)
+            return !wbuffer || z0 == z1;
+
+        return interp.w0n >= 0 && interp.w0n <= interp.w0d && interp.w0d < 0x10000
+            && interp.w1d >= 0 && interp.w1d < 0x10000;
+    }
+
+    // SetX() only sets the factors for perspective correct spans, nothing
+    // reads them otherwise but the compiler can't tell
+    SpanInterpolator(Interpolator<0>& interp)
+        : Interp(interp), X(0), Factor(Splat(0)), InvFactor(Splat(1<<8))
+    {
+    }
+
+    enum
+    {
+        attr_Flat = 0,
+        attr_Factor,
+        attr_FactorWide,
+        attr_Linear,
+        attr_LinearZ,
+    };
+
+    struct Attribute
+    {
+        int Mode;
+        bool Inverse;
+        s32x4 Base, Disp;
+        s64 Step, Offset;
+    };
+
+    Attribute Setup(s32 y0, s32 y1)
+    {
+        Attribute attr;
+        attr.Inverse = y0 > y1;
+        attr.Base = Splat(std::min(y0, y1));
+
+        if (y0 == y1)
+        {
+            attr.Mode = attr_Flat;
         }
-        break;
+        else if (!Interp.linear)
+        {
+            attr.Mode = attr_Factor;
+            attr.Disp = Splat(std::max(y0, y1) - std::min(y0, y1));
+        }
+        else
+        {
+            // the 64-bit products grow by the same amount with every pixel
+            attr.Mode = attr_Linear;
+            SetupLinear(attr, (s64)(std::max(y0, y1) - std::min(y0, y1)) * Interp.xrecip, 3<<24);
+        }
+        return attr;
+    }
 
-    case 6: // A5I3
+    Attribute SetupZ(s32 z0, s32 z1, bool wbuffer)
+    {
+        Attribute attr;
+        attr.Inverse = z0 > z1;
+        attr.Base = Splat(std::min(z0, z1));
+
+        if (z0 == z1)
         {
-            vramaddr += ((t * width) + s);
-            u8 pixel = ReadVRAM_Texture<u8>(vramaddr);
+            attr.Mode = attr_Flat;
+        }
+        else if (wbuffer)
+        {
+            attr.Mode = attr_FactorWide;
+            attr.Disp = Splat(std::max(z0, z1) - std::min(z0, z1));
+        }
+        else
+        {
+            attr.Mode = attr_LinearZ;
+            SetupLinear(attr, (s64)((std::max(z0, z1) - std::min(z0, z1)) >> 9) * Interp.xrecip_z, 0);
+        }
+        return attr;
+    }
 
-            texpal <<= 4;
-            *color = ReadVRAM_TexPal<u16>(texpal + ((pixel&0x7)<<1));
-            *alpha = (pixel >> 3);
+    void SetX(s32 x)
+    {
+        X = x - Interp.x0;
+        if (!Interp.linear)
+        {
+            s32x4 xs = Ramp(X);
+            Factor = PerspectiveFactor(xs, Sub(Splat(Interp.xdiff), xs),
+                                       (double)Interp.w0n * (1<<Interp.shift), Interp.w0d, Interp.w1d);
+            InvFactor = Sub(Splat(1<<8), Factor);
         }
-        break;
+    }
 
-    case 7: // direct color
+    s32x4 Interpolate(const Attribute& attr)
+    {
+        switch (attr.Mode)
         {
-            vramaddr += (((t * width) + s) << 1);
-            *color = ReadVRAM_Texture<u16>(vramaddr);
-            *alpha = (*color & 0x8000) ? 31 : 0;
+        case attr_Flat:
+            return attr.Base;
+        case attr_Factor:
+            return Add(attr.Base, ShiftRight<8>(Mul(attr.Disp, attr.Inverse ? InvFactor : Factor)));
+        case attr_FactorWide:
+            return Add(attr.Base, MulShift<8>(attr.Disp, attr.Inverse ? InvFactor : Factor));
+        case attr_Linear:
+            return Add(attr.Base, Ramp64Shift<30>((attr.Step * X) + attr.Offset, attr.Step));
+        case attr_LinearZ:
+            return Add(attr.Base, Ramp64Shift<13>((attr.Step * X) + attr.Offset, attr.Step));
         }
-        break;
+        return attr.Base;
     }
-}
+
+private:
+    void SetupLinear(Attribute& attr, s64 step, s64 bias)
+    {
+        // going from the other end of the span, the factor is xdiff-x instead of x
+        if (attr.Inverse)
+        {
+            attr.Step = -step;
+            attr.Offset = (step * Interp.xdiff) + bias;
+        }
+        else
+        {
+            attr.Step = step;
+            attr.Offset = bias;
+        }
+    }
+
+    Interpolator<0>& Interp;
+    s32 X;
+    s32x4 Factor, InvFactor;
+};
+
+#endif
 
 // depth test is 'less or equal' instead of 'less than' under the following conditions:
 // * when drawing a front-facing pixel over an opaque back-facing pixel
@@ -422,7 +964,7 @@ u32 AlphaBlend(u32 srccolor, u32 dstcolor, u32 alpha)
     return srcR | (srcG << 8) | (srcB << 16) | (dstalpha << 24);
 }
 
-u32 SoftRenderer::RenderPixel(Polygon* polygon, u8 vr, u8 vg, u8 vb, s16 s, s16 t)
+u32 SoftRenderer::RenderPixel(Polygon* polygon, const u32* texels, u8 vr, u8 vg, u8 vb, s16 s, s16 t)
 {
     u8 r, g, b, a;
 
@@ -459,7 +1001,7 @@ u32 SoftRenderer::RenderPixel(Polygon* polygon, u8 vr, u8 vg, u8 vb, s16 s, s16
         u8 tr, tg, tb;
 
         u16 tcolor; u8 talpha;
-        TextureLookup(polygon->TexParam, polygon->TexPalette, s, t, &tcolor, &talpha);
+        TextureLookup(texels, polygon->TexParam, s, t, &tcolor, &talpha);
 
         tr = (tcolor << 1) & 0x3E; if (tr) tr++;
         tg = (tcolor >> 4) & 0x3E; if (tg) tg++;
@@ -632,6 +1174,10 @@ void SoftRenderer::SetupPolygon(SoftRenderer::RendererPolygon* rp, Polygon* poly
 
     rp->PolyData = polygon;
 
+    rp->Texels = NULL;
+    if ((RenderDispCnt & (1<<0)) && (((polygon->TexParam >> 26) & 0x7) != 0))
+        rp->Texels = TexCache.find(TexCacheKey(polygon->TexParam, polygon->TexPalette))->second.Texels.get();
+
     rp->CurVL = vtop;
     rp->CurVR = vtop;
 
@@ -906,8 +1452,6 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
     else
         fnDepthTest = DepthTest_LessThan;
 
-    PrevIsShadowMask = false;
-
     if (polygon->YTop != polygon->YBottom)
     {
         if (y >= polygon->Vertices[rp->NextVL]->FinalPosition[1] && rp->CurVL != polygon->VBottom)
@@ -1079,7 +1623,7 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
         s16 s = interpX.Interpolate(sl, sr);
         s16 t = interpX.Interpolate(tl, tr);
 
-        u32 color = RenderPixel(polygon, vr>>3, vg>>3, vb>>3, s, t);
+        u32 color = RenderPixel(polygon, rp->Texels, vr>>3, vg>>3, vb>>3, s, t);
         u8 alpha = color >> 24;
 
         // alpha test
@@ -1133,6 +1677,15 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
     if (xlimit > xend+1) xlimit = xend+1;
     if (xlimit > 256) xlimit = 256;
 
+#ifdef GPU3D_SIMD
+    if (!(wireframe && !edge) && !polygon->IsShadow && !ScalarSpans
+        && SpanInterpolator::Compatible(interpX, zl, zr, polygon->WBuffer))
+    {
+        x = RenderPolygonSpan(rp, y, x, xlimit, interpX, zl, zr, rl, rr, gl, gr, bl, br, sl, sr, tl, tr,
+                              fnDepthTest, polyattr, edge);
+    }
+#endif
+
     if (wireframe && !edge) x = xlimit;
     else
     for (; x < xlimit; x++)
@@ -1175,7 +1728,7 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
         s16 s = interpX.Interpolate(sl, sr);
         s16 t = interpX.Interpolate(tl, tr);
 
-        u32 color = RenderPixel(polygon, vr>>3, vg>>3, vb>>3, s, t);
+        u32 color = RenderPixel(polygon, rp->Texels, vr>>3, vg>>3, vb>>3, s, t);
         u8 alpha = color >> 24;
 
         // alpha test
@@ -1250,7 +1803,7 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
         s16 s = interpX.Interpolate(sl, sr);
         s16 t = interpX.Interpolate(tl, tr);
 
-        u32 color = RenderPixel(polygon, vr>>3, vg>>3, vb>>3, s, t);
+        u32 color = RenderPixel(polygon, rp->Texels, vr>>3, vg>>3, vb>>3, s, t);
         u8 alpha = color >> 24;
 
         // alpha test
@@ -1302,6 +1855,120 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
     rp->XR = rp->SlopeR.Step();
 }
 
+s32 SoftRenderer::RenderPolygonSpan(RendererPolygon* rp, s32 y, s32 x, s32 xlimit, Interpolator<0>& interpX,
+    s32 zl, s32 zr, s32 rl, s32 rr, s32 gl, s32 gr, s32 bl, s32 br, s32 sl, s32 sr, s32 tl, s32 tr,
+    bool (*fnDepthTest)(s32 dstz, s32 z, u32 dstattr), u32 polyattr, int edge)
+{
+#ifdef GPU3D_SIMD
+    // the inside of a polygon, four pixels at a time
+    // does the same as the scalar loop, and leaves the remaining pixels to it
+
+    Polygon* polygon = rp->PolyData;
+
+    SpanInterpolator interp(interpX);
+    SpanInterpolator::Attribute attrz = interp.SetupZ(zl, zr, polygon->WBuffer);
+    SpanInterpolator::Attribute attrr = interp.Setup(rl, rr);
+    SpanInterpolator::Attribute attrg = interp.Setup(gl, gr);
+    SpanInterpolator::Attribute attrb = interp.Setup(bl, br);
+    SpanInterpolator::Attribute attrs = interp.Setup(sl, sr);
+    SpanInterpolator::Attribute attrt = interp.Setup(tl, tr);
+
+    for (; x+4 <= xlimit; x += 4)
+    {
+        u32 pixeladdr = FirstPixelOffset + (y*ScanlineWidth) + x;
+
+        interp.SetX(x);
+        s32x4 z = interp.Interpolate(attrz);
+        s32x4 dstz = Load(&DepthBuffer[pixeladdr]);
+        s32x4 dstattr = Load(&AttrBuffer[pixeladdr]);
+
+        // the pixels don't depend on each other, so all of them can be depth tested first
+        // and the other attributes only need to be interpolated if any of them passes
+        s32x4 pass;
+        if (polygon->Attr & (1<<14))
+        {
+            if (polygon->WBuffer)
+                pass = LessEqualUnsigned(Add(Sub(dstz, z), Splat(0xFF)), Splat(0x1FE));
+            else
+                pass = LessEqualUnsigned(Add(Sub(dstz, z), Splat(0x200)), Splat(0x400));
+        }
+        else if (polygon->FacingView)
+        {
+            s32x4 backopaque = Equal(And(dstattr, Splat(0x00400010)), Splat(0x00000010));
+            pass = Or(LessThan(z, dstz), And(backopaque, Equal(z, dstz)));
+        }
+        else
+            pass = LessThan(z, dstz);
+
+        u32 drawmask = Mask(pass);
+        u32 bottommask = 0;
+
+        // if depth test against the topmost pixel fails, test
+        // against the pixel underneath
+        u32 edgemask = Mask(Equal(And(dstattr, Splat(0x3)), Splat(0))) ^ 0xF;
+        s32 zs[4];
+        Store(zs, z);
+        for (u32 retry = edgemask & ~drawmask; retry; retry &= retry-1)
+        {
+            int i = __builtin_ctz(retry);
+            u32 addr = pixeladdr + i + BufferSize;
+            if (fnDepthTest(DepthBuffer[addr], zs[i], AttrBuffer[addr]))
+                bottommask |= (1 << i);
+        }
+        drawmask |= bottommask;
+
+        if (!drawmask) continue;
+
+        s32 vr[4], vg[4], vb[4], s[4], t[4];
+        Store(vr, interp.Interpolate(attrr));
+        Store(vg, interp.Interpolate(attrg));
+        Store(vb, interp.Interpolate(attrb));
+        Store(s, interp.Interpolate(attrs));
+        Store(t, interp.Interpolate(attrt));
+
+        u32 dstattrs[4];
+        Store(dstattrs, dstattr);
+
+        for (; drawmask; drawmask &= drawmask-1)
+        {
+            int i = __builtin_ctz(drawmask);
+            u32 addr = pixeladdr + i;
+            if (bottommask & (1 << i))
+            {
+                addr += BufferSize;
+                dstattrs[i] = AttrBuffer[addr];
+            }
+
+            u32 color = RenderPixel(polygon, rp->Texels, (u32)vr[i]>>3, (u32)vg[i]>>3, (u32)vb[i]>>3, (s16)s[i], (s16)t[i]);
+            u8 alpha = color >> 24;
+
+            // alpha test
+            if (alpha <= RenderAlphaRef) continue;
+
+            if (alpha == 31)
+            {
+                u32 attr = polyattr | edge;
+                DepthBuffer[addr] = zs[i];
+                ColorBuffer[addr] = color;
+                AttrBuffer[addr] = attr;
+            }
+            else
+            {
+                s32 zt = zs[i];
+                if (!(polygon->Attr & (1<<11))) zt = -1;
+                PlotTranslucentPixel(addr, color, zt, polyattr, polygon->IsShadow);
+
+                // blend with bottom pixel too, if needed
+                if ((dstattrs[i] & 0x3) && (addr < BufferSize))
+                    PlotTranslucentPixel(addr+BufferSize, color, zt, polyattr, polygon->IsShadow);
+            }
+        }
+    }
+#endif
+
+    return x;
+}
+
 void SoftRenderer::RenderScanline(s32 y, int npolys)
 {
     for (int i = 0; i < npolys; i++)
@@ -1314,7 +1981,10 @@ void SoftRenderer::RenderScanline(s32 y, int npolys)
             if (polygon->IsShadowMask)
                 RenderShadowMaskScanline(rp, y);
             else
+            {
+                PrevIsShadowMask = false;
                 RenderPolygonScanline(rp, y);
+            }
         }
     }
 }
@@ -1618,6 +2288,8 @@ void SoftRenderer::ClearBuffers()
 
 void SoftRenderer::RenderPolygons(bool threaded, Polygon** polygons, int npolys)
 {
+    UpdateTexCache(polygons, npolys);
+
     int j = 0;
     for (int i = 0; i < npolys; i++)
     {
@@ -1642,6 +2314,137 @@ void SoftRenderer::RenderPolygons(bool threaded, Polygon** polygons, int npolys)
         Platform::Semaphore_Post(Sema_ScanlineCount);
 }
 
+bool SoftRenderer::CanRenderBanded(Polygon** polygons, int npolys)
+{
+    if (!BandThreadsRunning.load(std::memory_order_relaxed))
+        return false;
+
+    // shadow masks leave their marks in the stencil buffer, which is
+    // shared between scanlines. those can't be rendered out of order.
+    for (int i = 0; i < npolys; i++)
+    {
+        if (polygons[i]->IsShadowMask && !polygons[i]->Degenerate)
+            return false;
+    }
+
+    return true;
+}
+
+void SoftRenderer::RenderPolygonsBanded(Polygon** polygons, int npolys)
+{
+    UpdateTexCache(polygons, npolys);
+
+    memset(ScanlineFinished, 0, sizeof(ScanlineFinished));
+    ScanlinesPosted = 0;
+
+    for (int i = 1; i < NumBands; i++)
+        Platform::Semaphore_Post(Sema_BandStart[i]);
+
+    bool rendered = RenderBand(0, polygons, npolys);
+
+    for (int i = 1; i < NumBands; i++)
+        Platform::Semaphore_Wait(Sema_BandDone[i]);
+
+    // keep the same state the single-threaded renderer would leave behind
+    if (rendered)
+        PrevIsShadowMask = false;
+}
+
+bool SoftRenderer::RenderBand(int band, Polygon** polygons, int npolys)
+{
+    s32 ystart = (band * 192) / NumBands;
+    s32 yend = ((band + 1) * 192) / NumBands;
+
+    RendererPolygon* polylist = band ? BandPolygonList[band] : PolygonList;
+
+    // only keep the polygons that cover this band, in their original order.
+    // polygons starting above the band have their edges set up directly at
+    // the first scanline of the band, which yields the same slope state as
+    // stepping through all the scanlines above it.
+    int j = 0;
+    for (int i = 0; i < npolys; i++)
+    {
+        Polygon* polygon = polygons[i];
+        if (polygon->Degenerate) continue;
+        if (polygon->YTop >= yend) continue;
+        if (polygon->YTop == polygon->YBottom)
+        {
+            if (polygon->YTop < ystart) continue;
+        }
+        else if (polygon->YBottom <= ystart) continue;
+
+        RendererPolygon* rp = &polylist[j++];
+        SetupPolygon(rp, polygon);
+        if (polygon->YTop < ystart)
+        {
+            SetupPolygonLeftEdge(rp, ystart);
+            SetupPolygonRightEdge(rp, ystart);
+        }
+    }
+
+    // the final pass for a given scanline reads the scanlines above and below it.
+    // the first scanline of a band is finished last, once the previous band
+    // is completely done with its last scanline.
+    for (s32 y = ystart; y < yend; y++)
+    {
+        for (int i = 0; i < j; i++)
+        {
+            RendererPolygon* rp = &polylist[i];
+            Polygon* polygon = rp->PolyData;
+
+            if (y >= polygon->YTop && (y < polygon->YBottom || (y == polygon->YTop && polygon->YBottom == polygon->YTop)))
+                RenderPolygonScanline(rp, y);
+        }
+
+        if (y == ystart)
+        {
+            if (band > 0)
+                Platform::Semaphore_Post(Sema_BandFirstLine[band]);
+        }
+        else if (band == 0 || (y-1) > ystart)
+        {
+            ScanlineFinalPass(y-1);
+            FinishBandScanline(y-1);
+        }
+    }
+
+    if (band < NumBands-1)
+        Platform::Semaphore_Wait(Sema_BandFirstLine[band+1]);
+
+    ScanlineFinalPass(yend-1);
+    FinishBandScanline(yend-1);
+
+    if (band < NumBands-1)
+        Platform::Semaphore_Post(Sema_BandLastLine[band]);
+
+    if (band > 0)
+    {
+        Platform::Semaphore_Wait(Sema_BandLastLine[band-1]);
+
+        ScanlineFinalPass(ystart);
+        FinishBandScanline(ystart);
+    }
+
+    return j > 0;
+}
+
+void SoftRenderer::FinishBandScanline(s32 y)
+{
+    // scanlines are finished out of order, but GetLine() expects them in order
+    Platform::Mutex_Lock(ScanlineLock);
+
+    ScanlineFinished[y] = true;
+
+    int start = ScanlinesPosted;
+    while (ScanlinesPosted < 192 && ScanlineFinished[ScanlinesPosted])
+        ScanlinesPosted++;
+
+    if (ScanlinesPosted > start)
+        Platform::Semaphore_Post(Sema_ScanlineCount, ScanlinesPosted - start);
+
+    Platform::Mutex_Unlock(ScanlineLock);
+}
+
 void SoftRenderer::VCount144()
 {
     if (RenderThreadRunning.load(std::memory_order_relaxed) && !GPU3D::AbortFrame)
@@ -1658,6 +2461,9 @@ void SoftRenderer::RenderFrame()
 
     FrameIdentical = !(textureChanged || texPalChanged) && RenderFrameIdentical;
 
+    if (textureChanged || texPalChanged)
+        InvalidateTexCache(textureDirty, texPalDirty);
+
     if (RenderThreadRunning.load(std::memory_order_relaxed))
     {
         Platform::Semaphore_Post(Sema_RenderStart);
@@ -1686,6 +2492,11 @@ void SoftRenderer::RenderThreadFunc()
         {
             Platform::Semaphore_Post(Sema_ScanlineCount, 192);
         }
+        else if (CanRenderBanded(&RenderPolygonRAM[0], RenderNumPolygons))
+        {
+            ClearBuffers();
+            RenderPolygonsBanded(&RenderPolygonRAM[0], RenderNumPolygons);
+        }
         else
         {
             ClearBuffers();
@@ -1697,6 +2508,19 @@ void SoftRenderer::RenderThreadFunc()
     }
 }
 
+void SoftRenderer::BandThreadFunc(int band)
+{
+    for (;;)
+    {
+        Platform::Semaphore_Wait(Sema_BandStart[band]);
+        if (!BandThreadsRunning) return;
+
+        RenderBand(band, &RenderPolygonRAM[0], RenderNumPolygons);
+
+        Platform::Semaphore_Post(Sema_BandDone[band]);
+    }
+}
+
 u32* SoftRenderer::GetLine(int line)
 {
     if (RenderThreadRunning.load(std::memory_order_relaxed))
@@ -22,6 +22,8 @@
 #include "Platform.h"
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <unordered_map>
 
 namespace GPU3D
 {
@@ -43,6 +45,9 @@ public:
 
     void SetupRenderThread();
     void StopRenderThread();
+
+    // render all spans with the scalar code, for checking the vector path against it
+    bool ScalarSpans;
 private:
     // Notes on the interpolator:
     //
@@ -62,6 +67,8 @@ private:
     // interpolation, avoiding precision loss from the aforementioned approximation.
     // Which is desirable when using the GPU to draw 2D graphics.
 
+    class SpanInterpolator;
+
     template<int dir>
     class Interpolator
     {
@@ -215,6 +222,8 @@ private:
         }
 
     private:
+        friend class SpanInterpolator;
+
         s32 x0, x1, xdiff, x;
 
         int shift;
@@ -453,24 +462,60 @@ private:
         u32 CurVL, CurVR;
         u32 NextVL, NextVR;
 
+        const u32* Texels;
+    };
+
+    // textures decoded to 16-bit color (bit 0-15) and 5-bit alpha (bit 16-20)
+    // an entry is thrown away as soon as the VRAM it was decoded from is modified
+    struct TexCacheEntry
+    {
+        u32 TexAddr, TexSize;
+        // palette indices of compressed textures
+        u32 Slot1Addr, Slot1Size;
+        u32 PalAddr, PalSize;
+
+        u32 NumTexels;
+        std::unique_ptr<u32[]> Texels;
     };
 
+    static constexpr u32 TexCacheMaxTexels = 4*1024*1024;
+
+    std::unordered_map<u64, TexCacheEntry> TexCache;
+    u32 TexCacheTexels;
+
+    static u64 TexCacheKey(u32 texparam, u32 texpal);
+    void InvalidateTexCache(NonStupidBitField<512*1024/GPU::VRAMDirtyGranularity>& textureDirty,
+        NonStupidBitField<128*1024/GPU::VRAMDirtyGranularity>& texPalDirty);
+    void UpdateTexCache(Polygon** polygons, int npolys);
+    void DecodeTexture(TexCacheEntry& entry, u32 texparam, u32 texpal);
+
     RendererPolygon PolygonList[2048];
-    void TextureLookup(u32 texparam, u32 texpal, s16 s, s16 t, u16* color, u8* alpha);
-    u32 RenderPixel(Polygon* polygon, u8 vr, u8 vg, u8 vb, s16 s, s16 t);
+    void TextureLookup(const u32* texels, u32 texparam, s16 s, s16 t, u16* color, u8* alpha);
+    u32 RenderPixel(Polygon* polygon, const u32* texels, u8 vr, u8 vg, u8 vb, s16 s, s16 t);
     void PlotTranslucentPixel(u32 pixeladdr, u32 color, u32 z, u32 polyattr, u32 shadow);
     void SetupPolygonLeftEdge(RendererPolygon* rp, s32 y);
     void SetupPolygonRightEdge(RendererPolygon* rp, s32 y);
     void SetupPolygon(RendererPolygon* rp, Polygon* polygon);
     void RenderShadowMaskScanline(RendererPolygon* rp, s32 y);
     void RenderPolygonScanline(RendererPolygon* rp, s32 y);
+    s32 RenderPolygonSpan(RendererPolygon* rp, s32 y, s32 x, s32 xlimit, Interpolator<0>& interpX,
+        s32 zl, s32 zr, s32 rl, s32 rr, s32 gl, s32 gr, s32 bl, s32 br, s32 sl, s32 sr, s32 tl, s32 tr,
+        bool (*fnDepthTest)(s32 dstz, s32 z, u32 dstattr), u32 polyattr, int edge);
     void RenderScanline(s32 y, int npolys);
     u32 CalculateFogDensity(u32 pixeladdr);
     void ScanlineFinalPass(s32 y);
     void ClearBuffers();
     void RenderPolygons(bool threaded, Polygon** polygons, int npolys);
 
+    bool CanRenderBanded(Polygon** polygons, int npolys);
+    void RenderPolygonsBanded(Polygon** polygons, int npolys);
+    bool RenderBand(int band, Polygon** polygons, int npolys);
+    void FinishBandScanline(s32 y);
+
     void RenderThreadFunc();
+    void BandThreadFunc(int band);
+    void SetupBandThreads();
+    void StopBandThreads();
 
     // buffer dimensions are 258x194 to add a offscreen 1px border
     // which simplifies edge marking tests
@@ -512,5 +557,27 @@ private:
     Platform::Semaphore* Sema_RenderStart;
     Platform::Semaphore* Sema_RenderDone;
     Platform::Semaphore* Sema_ScanlineCount;
+
+    // banded rendering
+    // the frame is split into horizontal bands of scanlines, each band is
+    // rasterized by its own thread. the render thread takes care of band 0
+    // and of dispatching the other bands.
+    // frames with shadow mask polygons are always rendered in one band, as
+    // the stencil buffer carries state from one scanline to the next
+
+    static constexpr int MaxRenderThreads = 16;
+
+    int NumBands;
+    RendererPolygon* BandPolygonList[MaxRenderThreads];
+    Platform::Thread* BandThread[MaxRenderThreads];
+    std::atomic_bool BandThreadsRunning;
+    Platform::Semaphore* Sema_BandStart[MaxRenderThreads];
+    Platform::Semaphore* Sema_BandDone[MaxRenderThreads];
+    Platform::Semaphore* Sema_BandFirstLine[MaxRenderThreads];
+    Platform::Semaphore* Sema_BandLastLine[MaxRenderThreads];
+
+    Platform::Mutex* ScanlineLock;
+    bool ScanlineFinished[192];
+    int ScanlinesPosted;
 };
 }
\ No newline at end of file
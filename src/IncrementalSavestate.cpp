@@ -0,0 +1,200 @@
+/*
+    Copyright 2016-2021 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#include "IncrementalSavestate.h"
+
+/*
+    Incremental savestates
+
+    The buffer always holds a regular memory savestate, this only changes how
+    it's written. When the tracked arrays (main RAM, WRAM, VRAM) end up at the
+    same place as in the state previously saved or loaded through the context,
+    only their dirty pages are copied over, the rest is left as is. Everything
+    else is small and is written as usual.
+
+    Each save also records which pages of the buffer it touched, so that users
+    of the buffer (rewind, netplay, autosaves) only have to look at those.
+*/
+
+IncrementalSavestateContext* LastContext = nullptr;
+
+void IncrementalSavestateContext::Invalidate()
+{
+    Valid = false;
+}
+
+bool IncrementalSavestateContext::PageChanged(u32 page)
+{
+    if ((page >> 6) >= ChangedPages.size())
+        return true;
+
+    return ChangedPages[page >> 6] & (1ULL << (page & 0x3F));
+}
+
+void IncrementalSavestateContext::ClearChangedPages()
+{
+    std::fill(ChangedPages.begin(), ChangedPages.end(), 0);
+}
+
+IncrementalSavestate::IncrementalSavestate(u8* buffer, bool save, IncrementalSavestateContext* context)
+    : MemorySavestate(buffer, save)
+{
+    Context = context;
+    ArrayIndex = 0;
+
+    Incremental = save && !Error
+        && context->Valid
+        && context->Buffer == buffer
+        && LastContext == context;
+}
+
+IncrementalSavestate::~IncrementalSavestate()
+{
+    if (Error)
+    {
+        Context->Valid = false;
+        return;
+    }
+
+    u32 numpages = (BufferPos + IncrementalSavestateContext::PageSize - 1) / IncrementalSavestateContext::PageSize;
+    if (Context->ChangedPages.size() < (numpages + 0x3F) >> 6)
+        Context->ChangedPages.resize((numpages + 0x3F) >> 6, 0);
+
+    for (u32 i = 0; i < numpages; i++)
+    {
+        bool unchanged = Saving
+            && (i >> 6) < UnchangedPages.size()
+            && (UnchangedPages[i >> 6] & (1ULL << (i & 0x3F)));
+
+        if (!unchanged)
+            Context->ChangedPages[i >> 6] |= 1ULL << (i & 0x3F);
+    }
+
+    Context->Buffer = Buffer;
+    Context->Valid = true;
+    Context->Arrays.resize(ArrayIndex);
+    LastContext = Context;
+}
+
+void IncrementalSavestate::VarArrayTracked(void* data, u32 len, u64* dirty, u32 pagesize)
+{
+    if (Error)
+    {
+        return;
+    }
+
+    IncrementalSavestateContext::TrackedArray array = {data, BufferPos, len};
+
+    bool incremental = false;
+    if (Saving && Incremental && ArrayIndex < Context->Arrays.size())
+    {
+        IncrementalSavestateContext::TrackedArray& prev = Context->Arrays[ArrayIndex];
+        incremental = prev.Data == data && prev.Offset == BufferPos && prev.Length == len;
+    }
+
+    if (incremental)
+    {
+        SetPagesUnchanged(BufferPos, len, true);
+        CopyPages((u8*)data, len, dirty, pagesize);
+        BufferSeek(BufferPos + len);
+    }
+    else
+    {
+        VarArray(data, len);
+
+        // either way the memory now matches the buffer
+        if (dirty)
+        {
+            u32 numpages = (len + pagesize - 1) / pagesize;
+            memset(dirty, 0, ((numpages + 0x3F) >> 6) * sizeof(u64));
+        }
+    }
+
+    if (ArrayIndex >= Context->Arrays.size())
+        Context->Arrays.push_back(array);
+    else
+        Context->Arrays[ArrayIndex] = array;
+    ArrayIndex++;
+}
+
+void IncrementalSavestate::CopyPages(u8* data, u32 len, u64* dirty, u32 pagesize)
+{
+    u8* dst = &Buffer[BufferPos];
+    u32 numpages = (len + pagesize - 1) / pagesize;
+
+    for (u32 i = 0; i < numpages; i += 64)
+    {
+        u64 pages;
+        if (dirty)
+        {
+            pages = dirty[i >> 6];
+            if (numpages - i < 64)
+                pages &= (1ULL << (numpages - i)) - 1;
+            dirty[i >> 6] &= ~pages;
+        }
+        else
+        {
+            // no tracking, compare against what's in the buffer
+            pages = 0;
+            for (u32 j = 0; j < 64 && i + j < numpages; j++)
+            {
+                u32 start = (i + j) * pagesize;
+                if (memcmp(&dst[start], &data[start], std::min(pagesize, len - start)))
+                    pages |= 1ULL << j;
+            }
+        }
+
+        while (pages)
+        {
+            u32 start = (i + __builtin_ctzll(pages)) * pagesize;
+            u32 size = std::min(pagesize, len - start);
+            pages &= pages - 1;
+
+            memcpy(&dst[start], &data[start], size);
+            SetPagesUnchanged(BufferPos + start, size, false);
+        }
+    }
+}
+
+void IncrementalSavestate::SetPagesUnchanged(u32 offset, u32 len, bool unchanged)
+{
+    const u32 pagesize = IncrementalSavestateContext::PageSize;
+
+    if (unchanged)
+    {
+        // only the pages completely covered by the range
+        u32 start = (offset + pagesize - 1) / pagesize;
+        u32 end = (offset + len) / pagesize;
+        if (UnchangedPages.size() < (end + 0x3F) >> 6)
+            UnchangedPages.resize((end + 0x3F) >> 6, 0);
+
+        for (u32 i = start; i < end; i++)
+            UnchangedPages[i >> 6] |= 1ULL << (i & 0x3F);
+    }
+    else
+    {
+        u32 start = offset / pagesize;
+        u32 end = std::min((u32)(UnchangedPages.size() << 6), (offset + len + pagesize - 1) / pagesize);
+
+        for (u32 i = start; i < end; i++)
+            UnchangedPages[i >> 6] &= ~(1ULL << (i & 0x3F));
+    }
+}
@@ -0,0 +1,81 @@
+/*
+    Copyright 2016-2021 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef INCREMENTALSAVESTATE_H
+#define INCREMENTALSAVESTATE_H
+
+#include <vector>
+
+#include "MemorySavestate.h"
+
+// what is known about a buffer between the incremental savestates made in it.
+// there's only one set of dirty bitmaps in the core, so only the context
+// used last can save incrementally, the others fall back to a full save.
+class IncrementalSavestateContext
+{
+public:
+    static const u32 PageSize = 0x1000;
+
+    // to be called when the buffer was modified by something else
+    void Invalidate();
+
+    // whether a page of the buffer was rewritten since the last ClearChangedPages()
+    bool PageChanged(u32 page);
+    void ClearChangedPages();
+
+private:
+    friend class IncrementalSavestate;
+
+    struct TrackedArray
+    {
+        void* Data;
+        u32 Offset;
+        u32 Length;
+    };
+
+    u8* Buffer = nullptr;
+    bool Valid = false;
+
+    std::vector<TrackedArray> Arrays;
+    std::vector<u64> ChangedPages;
+};
+
+// memory savestate which doesn't rewrite the tracked arrays as a whole if the
+// buffer still holds the state last saved or loaded through its context, but
+// only copies the pages which were written to since.
+class IncrementalSavestate : public MemorySavestate
+{
+public:
+    IncrementalSavestate(u8* buffer, bool save, IncrementalSavestateContext* context);
+    ~IncrementalSavestate() override;
+
+    void VarArrayTracked(void* data, u32 len, u64* dirty, u32 pagesize) override;
+
+private:
+    void CopyPages(u8* data, u32 len, u64* dirty, u32 pagesize);
+    void SetPagesUnchanged(u32 offset, u32 len, bool unchanged);
+
+    IncrementalSavestateContext* Context;
+    bool Incremental;
+    u32 ArrayIndex;
+
+    // buffer pages which weren't touched by this save
+    std::vector<u64> UnchangedPages;
+};
+
+#endif // INCREMENTALSAVESTATE_H
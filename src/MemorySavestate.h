@@ -34,7 +34,9 @@ public:
     void Bool32(bool* var) override;
     void VarArray(void* data, u32 len) override;
 
-private:
+    u32 Length() { return BufferPos; }
+
+protected:
     const int HEADER_SIZE = 0x4;
 
     void BufferWrite(const void* data, u32 length);
@@ -33,6 +33,7 @@
 #include "AREngine.h"
 #include "Platform.h"
 #include "FreeBIOS.h"
+#include "Profiler.h"
 
 #ifdef JIT_ENABLED
 #include "ARMJIT.h"
@@ -105,6 +106,9 @@ u64 SysTimestamp;
 
 SchedEvent SchedList[Event_MAX];
 u32 SchedListMask;
+u8 SchedHeap[Event_MAX];
+u8 SchedHeapPos[Event_MAX];
+u32 SchedHeapSize;
 
 u32 CPUStop;
 
@@ -123,6 +127,10 @@ MemRegion SWRAM_ARM7;
 
 u8* ARM7WRAM;
 
+NonStupidBitField<MainRAMMaxSize/StateDirtyPageSize> MainRAMDirty;
+NonStupidBitField<SharedWRAMSize/StateDirtyPageSize> SharedWRAMDirty;
+NonStupidBitField<ARM7WRAMSize/StateDirtyPageSize> ARM7WRAMDirty;
+
 u16 ExMemCnt[2];
 
 // TODO: these belong in NDSCart!
@@ -179,6 +187,8 @@ void RunTimer(u32 tid, s32 cycles);
 void UpdateWifiTimings();
 void SetWifiWaitCnt(u16 val);
 void SetGBASlotTimings();
+void ResetSchedHeap();
+void Reschedule(u64 target);
 
 
 bool Init()
@@ -215,6 +225,10 @@ bool Init()
 
     if (!AREngine::Init()) return false;
 
+#ifdef PROFILER_ENABLED
+    if (!Profiler::Init()) return false;
+#endif
+
     return true;
 }
 
@@ -241,6 +255,10 @@ void DeInit()
     DSi::DeInit();
 
     AREngine::DeInit();
+
+#ifdef PROFILER_ENABLED
+    Profiler::DeInit();
+#endif
 }
 
 
@@ -592,6 +610,10 @@ void Reset()
     memset(SharedWRAM, 0, 0x8000);
     memset(ARM7WRAM, 0, 0x10000);
 
+    memset(MainRAMDirty.Data, 0xFF, sizeof(MainRAMDirty.Data));
+    memset(SharedWRAMDirty.Data, 0xFF, sizeof(SharedWRAMDirty.Data));
+    memset(ARM7WRAMDirty.Data, 0xFF, sizeof(ARM7WRAMDirty.Data));
+
     MapSharedWRAM(0);
 
     ExMemCnt[0] = 0x4000;
@@ -645,6 +667,7 @@ void Reset()
 
     memset(SchedList, 0, sizeof(SchedList));
     SchedListMask = 0;
+    ResetSchedHeap();
 
     KeyInput = 0x007F03FF;
     KeyCnt = 0;
@@ -700,6 +723,102 @@ void Stop()
         DSi::Stop();
 }
 
+// the pending events are kept in a binary heap ordered by timestamp (ties are
+// broken by ID), so finding the next one doesn't need to go over all of them
+
+bool SchedEventBefore(u32 a, u32 b)
+{
+    if (SchedList[a].Timestamp != SchedList[b].Timestamp)
+        return SchedList[a].Timestamp < SchedList[b].Timestamp;
+
+    return a < b;
+}
+
+void SchedHeapSiftUp(u32 pos)
+{
+    u8 id = SchedHeap[pos];
+
+    while (pos > 0)
+    {
+        u32 parent = (pos - 1) >> 1;
+        if (!SchedEventBefore(id, SchedHeap[parent]))
+            break;
+
+        SchedHeap[pos] = SchedHeap[parent];
+        SchedHeapPos[SchedHeap[pos]] = pos;
+        pos = parent;
+    }
+
+    SchedHeap[pos] = id;
+    SchedHeapPos[id] = pos;
+}
+
+void SchedHeapSiftDown(u32 pos)
+{
+    u8 id = SchedHeap[pos];
+
+    for (;;)
+    {
+        u32 child = (pos << 1) + 1;
+        if (child >= SchedHeapSize)
+            break;
+        if (child+1 < SchedHeapSize && SchedEventBefore(SchedHeap[child+1], SchedHeap[child]))
+            child++;
+        if (!SchedEventBefore(SchedHeap[child], id))
+            break;
+
+        SchedHeap[pos] = SchedHeap[child];
+        SchedHeapPos[SchedHeap[pos]] = pos;
+        pos = child;
+    }
+
+    SchedHeap[pos] = id;
+    SchedHeapPos[id] = pos;
+}
+
+void SchedHeapInsert(u32 id)
+{
+    SchedHeap[SchedHeapSize] = id;
+    SchedHeapSiftUp(SchedHeapSize++);
+}
+
+void SchedHeapRemove(u32 id)
+{
+    u32 pos = SchedHeapPos[id];
+    if (pos == 0xFF) return;
+
+    SchedHeapPos[id] = 0xFF;
+    SchedHeapSize--;
+    if (pos == SchedHeapSize) return;
+
+    u8 last = SchedHeap[SchedHeapSize];
+    SchedHeap[pos] = last;
+    SchedHeapSiftUp(pos);
+    SchedHeapSiftDown(SchedHeapPos[last]);
+}
+
+void ResetSchedHeap()
+{
+    SchedHeapSize = 0;
+    memset(SchedHeapPos, 0xFF, sizeof(SchedHeapPos));
+
+    for (int i = 0; i < Event_MAX; i++)
+    {
+        if (SchedListMask & (1<<i))
+            SchedHeapInsert(i);
+    }
+}
+
+// puts an event in the slot for its ID, which has to be free
+void AddEvent(u32 id, SchedEvent& evt)
+{
+    SchedList[id] = evt;
+    SchedListMask |= (1<<id);
+    SchedHeapInsert(id);
+
+    Reschedule(evt.Timestamp);
+}
+
 bool DoSavestate_Scheduler(Savestate* file)
 {
     // this is a bit of a hack
@@ -816,9 +935,16 @@ bool DoSavestate(Savestate* file)
             return false;
     }
 
-    file->VarArray(MainRAM, MainRAMMaxSize);
-    file->VarArray(SharedWRAM, SharedWRAMSize);
-    file->VarArray(ARM7WRAM, ARM7WRAMSize);
+    bool tracked = true;
+#ifdef JIT_ENABLED
+    // fastmem writes don't go through the dirty tracking
+    if (EnableJIT && ARMJIT::FastMemory)
+        tracked = false;
+#endif
+
+    file->VarArrayTracked(MainRAM, MainRAMMaxSize, tracked ? MainRAMDirty.Data : nullptr, StateDirtyPageSize);
+    file->VarArrayTracked(SharedWRAM, SharedWRAMSize, tracked ? SharedWRAMDirty.Data : nullptr, StateDirtyPageSize);
+    file->VarArrayTracked(ARM7WRAM, ARM7WRAMSize, tracked ? ARM7WRAMDirty.Data : nullptr, StateDirtyPageSize);
 
     //file->VarArray(ARM9BIOS, 0x1000);
     //file->VarArray(ARM7BIOS, 0x4000);
@@ -870,6 +996,8 @@ bool DoSavestate(Savestate* file)
 
     if (!DoSavestate_Scheduler(file)) return false;
     file->Var32(&SchedListMask);
+    if (!file->Saving)
+        ResetSchedHeap();
     file->Var64(&ARM9Timestamp);
     file->Var64(&ARM9Target);
     file->Var64(&ARM7Timestamp);
@@ -954,6 +1082,17 @@ bool LoadCart(const u8* romdata, u32 romlen, const u8* savedata, u32 savelen)
     return true;
 }
 
+bool LoadCart(FILE* romfile, u32 romlen, const u8* savedata, u32 savelen)
+{
+    if (!NDSCart::LoadROM(romfile, romlen))
+        return false;
+
+    if (savedata && savelen)
+        NDSCart::LoadSave(savedata, savelen);
+
+    return true;
+}
+
 void LoadSave(const u8* savedata, u32 savelen)
 {
     if (savedata && savelen)
@@ -1000,19 +1139,8 @@ void LoadBIOS()
 u64 NextTarget()
 {
     u64 minEvent = UINT64_MAX;
-
-    u32 mask = SchedListMask;
-    for (int i = 0; i < Event_MAX; i++)
-    {
-        if (!mask) break;
-        if (mask & 0x1)
-        {
-            if (SchedList[i].Timestamp < minEvent)
-                minEvent = SchedList[i].Timestamp;
-        }
-
-        mask >>= 1;
-    }
+    if (SchedHeapSize)
+        minEvent = SchedList[SchedHeap[0]].Timestamp;
 
     u64 max = SysTimestamp + kMaxIterationCycles;
 
@@ -1026,20 +1154,25 @@ void RunSystem(u64 timestamp)
 {
     SysTimestamp = timestamp;
 
+    // the events are run in the order of their IDs, not in the order of their
+    // timestamps. like before the heap, this goes over the events which were
+    // pending when it started and runs those which are due by then, even if
+    // one run before cancelled them
     u32 mask = SchedListMask;
-    for (int i = 0; i < Event_MAX; i++)
+    while (mask)
     {
-        if (!mask) break;
-        if (mask & 0x1)
-        {
-            if (SchedList[i].Timestamp <= SysTimestamp)
-            {
-                SchedListMask &= ~(1<<i);
-                SchedList[i].Func(SchedList[i].Param);
-            }
-        }
+        int i = __builtin_ctz(mask);
+        mask &= (mask - 1);
+
+        if (SchedList[i].Timestamp > SysTimestamp)
+            continue;
 
-        mask >>= 1;
+        PROFILER_SWITCH(PROFILER_EVENT(i));
+        PROFILER_CYCLES(PROFILER_EVENT(i), SysTimestamp - SchedList[i].Timestamp);
+
+        SchedListMask &= ~(1<<i);
+        SchedHeapRemove(i);
+        SchedList[i].Func(SchedList[i].Param);
     }
 }
 
@@ -1052,6 +1185,10 @@ u32 RunFrame()
     bool runFrame = Running && !(CPUStop & 0x40000000);
     if (runFrame)
     {
+#ifdef PROFILER_ENABLED
+        Profiler::BeginFrame();
+#endif
+
         GPU::StartFrame();
 
         while (Running && GPU::TotalScanlines==0)
@@ -1060,33 +1197,45 @@ u32 RunFrame()
             ARM9Target = target << ARM9ClockShift;
             CurCPU = 0;
 
+            PROFILER_MARK(arm9start, ARM9Timestamp);
+
             if (CPUStop & 0x80000000)
             {
                 // GXFIFO stall
+                PROFILER_SWITCH(PROFILER_STAGE(Stage_GXStall));
                 s32 cycles = GPU3D::CyclesToRunFor();
 
                 ARM9Timestamp = std::min(ARM9Target, ARM9Timestamp+(cycles<<ARM9ClockShift));
+                PROFILER_CYCLES(PROFILER_STAGE(Stage_GXStall), (ARM9Timestamp - arm9start) >> ARM9ClockShift);
             }
             else if (CPUStop & 0x0FFF)
             {
+                PROFILER_SWITCH(PROFILER_STAGE(Stage_DMA9));
                 DMAs[0]->Run<ConsoleType>();
                 if (!(CPUStop & 0x80000000)) DMAs[1]->Run<ConsoleType>();
                 if (!(CPUStop & 0x80000000)) DMAs[2]->Run<ConsoleType>();
                 if (!(CPUStop & 0x80000000)) DMAs[3]->Run<ConsoleType>();
                 if (ConsoleType == 1) DSi::RunNDMAs(0);
+                PROFILER_CYCLES(PROFILER_STAGE(Stage_DMA9), (ARM9Timestamp - arm9start) >> ARM9ClockShift);
             }
             else
             {
+                PROFILER_SWITCH(PROFILER_STAGE(Stage_ARM9));
 #ifdef JIT_ENABLED
                 if (EnableJIT)
                     ARM9->ExecuteJIT();
                 else
 #endif
                     ARM9->Execute();
+                PROFILER_CYCLES(PROFILER_STAGE(Stage_ARM9), (ARM9Timestamp - arm9start) >> ARM9ClockShift);
             }
 
             RunTimers(0);
+
+            PROFILER_SWITCH(PROFILER_STAGE(Stage_GPU3DGeometry));
+            PROFILER_MARK(gpu3dstart, GPU3D::Timestamp);
             GPU3D::Run();
+            PROFILER_CYCLES(PROFILER_STAGE(Stage_GPU3DGeometry), GPU3D::Timestamp - gpu3dstart);
 
             target = ARM9Timestamp >> ARM9ClockShift;
             CurCPU = 1;
@@ -1095,28 +1244,35 @@ u32 RunFrame()
             {
                 ARM7Target = target; // might be changed by a reschedule
 
+                PROFILER_MARK(arm7start, ARM7Timestamp);
+
                 if (CPUStop & 0x0FFF0000)
                 {
+                    PROFILER_SWITCH(PROFILER_STAGE(Stage_DMA7));
                     DMAs[4]->Run<ConsoleType>();
                     DMAs[5]->Run<ConsoleType>();
                     DMAs[6]->Run<ConsoleType>();
                     DMAs[7]->Run<ConsoleType>();
                     if (ConsoleType == 1) DSi::RunNDMAs(1);
+                    PROFILER_CYCLES(PROFILER_STAGE(Stage_DMA7), ARM7Timestamp - arm7start);
                 }
                 else
                 {
+                    PROFILER_SWITCH(PROFILER_STAGE(Stage_ARM7));
 #ifdef JIT_ENABLED
                     if (EnableJIT)
                         ARM7->ExecuteJIT();
                     else
 #endif
                         ARM7->Execute();
+                    PROFILER_CYCLES(PROFILER_STAGE(Stage_ARM7), ARM7Timestamp - arm7start);
                 }
 
                 RunTimers(1);
             }
 
             RunSystem(target);
+            PROFILER_SWITCH(PROFILER_STAGE(Stage_Other));
 
             if (CPUStop & 0x40000000)
             {
@@ -1135,6 +1291,10 @@ u32 RunFrame()
             GPU3D::Timestamp-SysTimestamp);
 #endif
         SPU::TransferOutput();
+
+#ifdef PROFILER_ENABLED
+        Profiler::EndFrame(SysTimestamp - FrameStartTimestamp);
+#endif
     }
 
     // In the context of TASes, frame count is traditionally the primary measure of emulated time,
@@ -1185,24 +1345,22 @@ void ScheduleEvent(u32 id, bool periodic, s32 delay, void (*func)(u32), u32 para
         return;
     }
 
-    SchedEvent* evt = &SchedList[id];
+    SchedEvent evt;
 
     if (periodic)
-        evt->Timestamp += delay;
+        evt.Timestamp = SchedList[id].Timestamp + delay;
     else
     {
         if (CurCPU == 0)
-            evt->Timestamp = (ARM9Timestamp >> ARM9ClockShift) + delay;
+            evt.Timestamp = (ARM9Timestamp >> ARM9ClockShift) + delay;
         else
-            evt->Timestamp = ARM7Timestamp + delay;
+            evt.Timestamp = ARM7Timestamp + delay;
     }
 
-    evt->Func = func;
-    evt->Param = param;
+    evt.Func = func;
+    evt.Param = param;
 
-    SchedListMask |= (1<<id);
-
-    Reschedule(evt->Timestamp);
+    AddEvent(id, evt);
 }
 
 void ScheduleEvent(u32 id, u64 timestamp, void (*func)(u32), u32 param)
@@ -1213,20 +1371,18 @@ void ScheduleEvent(u32 id, u64 timestamp, void (*func)(u32), u32 param)
         return;
     }
 
-    SchedEvent* evt = &SchedList[id];
-
-    evt->Timestamp = timestamp;
-    evt->Func = func;
-    evt->Param = param;
-
-    SchedListMask |= (1<<id);
+    SchedEvent evt;
+    evt.Timestamp = timestamp;
+    evt.Func = func;
+    evt.Param = param;
 
-    Reschedule(evt->Timestamp);
+    AddEvent(id, evt);
 }
 
 void CancelEvent(u32 id)
 {
     SchedListMask &= ~(1<<id);
+    SchedHeapRemove(id);
 }
 
 
@@ -2225,6 +2381,7 @@ void ARM9Write8(u32 addr, u8 val)
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
         *(u8*)&MainRAM[addr & MainRAMMask] = val;
+        MainRAMDirty[(addr & MainRAMMask) / StateDirtyPageSize] = true;
         return;
 
     case 0x03000000:
@@ -2234,6 +2391,7 @@ void ARM9Write8(u32 addr, u8 val)
             ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
             *(u8*)&SWRAM_ARM9.Mem[addr & SWRAM_ARM9.Mask] = val;
+            SharedWRAMDirty[(SWRAM_ARM9.Mem - SharedWRAM + (addr & SWRAM_ARM9.Mask)) / StateDirtyPageSize] = true;
         }
         return;
 
@@ -2270,6 +2428,7 @@ void ARM9Write16(u32 addr, u16 val)
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
         *(u16*)&MainRAM[addr & MainRAMMask] = val;
+        MainRAMDirty[(addr & MainRAMMask) / StateDirtyPageSize] = true;
         return;
 
     case 0x03000000:
@@ -2279,6 +2438,7 @@ void ARM9Write16(u32 addr, u16 val)
             ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
             *(u16*)&SWRAM_ARM9.Mem[addr & SWRAM_ARM9.Mask] = val;
+            SharedWRAMDirty[(SWRAM_ARM9.Mem - SharedWRAM + (addr & SWRAM_ARM9.Mask)) / StateDirtyPageSize] = true;
         }
         return;
 
@@ -2336,6 +2496,7 @@ void ARM9Write32(u32 addr, u32 val)
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
         *(u32*)&MainRAM[addr & MainRAMMask] = val;
+        MainRAMDirty[(addr & MainRAMMask) / StateDirtyPageSize] = true;
         return ;
 
     case 0x03000000:
@@ -2345,6 +2506,7 @@ void ARM9Write32(u32 addr, u32 val)
             ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
             *(u32*)&SWRAM_ARM9.Mem[addr & SWRAM_ARM9.Mask] = val;
+            SharedWRAMDirty[(SWRAM_ARM9.Mem - SharedWRAM + (addr & SWRAM_ARM9.Mask)) / StateDirtyPageSize] = true;
         }
         return;
 
@@ -2637,6 +2799,7 @@ void ARM7Write8(u32 addr, u8 val)
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
         *(u8*)&MainRAM[addr & MainRAMMask] = val;
+        MainRAMDirty[(addr & MainRAMMask) / StateDirtyPageSize] = true;
         return;
 
     case 0x03000000:
@@ -2646,6 +2809,7 @@ void ARM7Write8(u32 addr, u8 val)
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
             *(u8*)&SWRAM_ARM7.Mem[addr & SWRAM_ARM7.Mask] = val;
+            SharedWRAMDirty[(SWRAM_ARM7.Mem - SharedWRAM + (addr & SWRAM_ARM7.Mask)) / StateDirtyPageSize] = true;
             return;
         }
         else
@@ -2654,6 +2818,7 @@ void ARM7Write8(u32 addr, u8 val)
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
             *(u8*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
+            ARM7WRAMDirty[(addr & (ARM7WRAMSize - 1)) / StateDirtyPageSize] = true;
             return;
         }
 
@@ -2662,6 +2827,7 @@ void ARM7Write8(u32 addr, u8 val)
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
         *(u8*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
+        ARM7WRAMDirty[(addr & (ARM7WRAMSize - 1)) / StateDirtyPageSize] = true;
         return;
 
     case 0x04000000:
@@ -2706,6 +2872,7 @@ void ARM7Write16(u32 addr, u16 val)
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
         *(u16*)&MainRAM[addr & MainRAMMask] = val;
+        MainRAMDirty[(addr & MainRAMMask) / StateDirtyPageSize] = true;
         return;
 
     case 0x03000000:
@@ -2715,6 +2882,7 @@ void ARM7Write16(u32 addr, u16 val)
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
             *(u16*)&SWRAM_ARM7.Mem[addr & SWRAM_ARM7.Mask] = val;
+            SharedWRAMDirty[(SWRAM_ARM7.Mem - SharedWRAM + (addr & SWRAM_ARM7.Mask)) / StateDirtyPageSize] = true;
             return;
         }
         else
@@ -2723,6 +2891,7 @@ void ARM7Write16(u32 addr, u16 val)
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
             *(u16*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
+            ARM7WRAMDirty[(addr & (ARM7WRAMSize - 1)) / StateDirtyPageSize] = true;
             return;
         }
 
@@ -2731,6 +2900,7 @@ void ARM7Write16(u32 addr, u16 val)
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
         *(u16*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
+        ARM7WRAMDirty[(addr & (ARM7WRAMSize - 1)) / StateDirtyPageSize] = true;
         return;
 
     case 0x04000000:
@@ -2786,6 +2956,7 @@ void ARM7Write32(u32 addr, u32 val)
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
         *(u32*)&MainRAM[addr & MainRAMMask] = val;
+        MainRAMDirty[(addr & MainRAMMask) / StateDirtyPageSize] = true;
         return;
 
     case 0x03000000:
@@ -2795,6 +2966,7 @@ void ARM7Write32(u32 addr, u32 val)
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
             *(u32*)&SWRAM_ARM7.Mem[addr & SWRAM_ARM7.Mask] = val;
+            SharedWRAMDirty[(SWRAM_ARM7.Mem - SharedWRAM + (addr & SWRAM_ARM7.Mask)) / StateDirtyPageSize] = true;
             return;
         }
         else
@@ -2803,6 +2975,7 @@ void ARM7Write32(u32 addr, u32 val)
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
             *(u32*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
+            ARM7WRAMDirty[(addr & (ARM7WRAMSize - 1)) / StateDirtyPageSize] = true;
             return;
         }
 
@@ -2811,6 +2984,7 @@ void ARM7Write32(u32 addr, u32 val)
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
         *(u32*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
+        ARM7WRAMDirty[(addr & (ARM7WRAMSize - 1)) / StateDirtyPageSize] = true;
         return;
 
     case 0x04000000:
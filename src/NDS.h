@@ -22,6 +22,7 @@
 #include <string>
 
 #include "Savestate.h"
+#include "NonStupidBitfield.h"
 #include "types.h"
 
 // when touching the main loop/timing code, pls test a lot of shit
@@ -222,6 +223,13 @@ extern u32 KeyInput;
 const u32 ARM7WRAMSize = 0x10000;
 extern u8* ARM7WRAM;
 
+// pages written to since the last savestate saved or loaded incrementally,
+// see IncrementalSavestate
+const u32 StateDirtyPageSize = 0x1000;
+extern NonStupidBitField<MainRAMMaxSize/StateDirtyPageSize> MainRAMDirty;
+extern NonStupidBitField<SharedWRAMSize/StateDirtyPageSize> SharedWRAMDirty;
+extern NonStupidBitField<ARM7WRAMSize/StateDirtyPageSize> ARM7WRAMDirty;
+
 bool Init();
 void DeInit();
 void Reset();
@@ -239,6 +247,7 @@ void SetConsoleType(int type);
 void LoadBIOS();
 
 bool LoadCart(const u8* romdata, u32 romlen, const u8* savedata, u32 savelen);
+bool LoadCart(FILE* romfile, u32 romlen, const u8* savedata, u32 savelen);
 void LoadSave(const u8* savedata, u32 savelen);
 void EjectCart();
 bool CartInserted();
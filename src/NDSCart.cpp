@@ -18,6 +18,9 @@
 
 #include <stdio.h>
 #include <string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 #include "NDS.h"
 #include "DSi.h"
 #include "NDSCart.h"
@@ -55,6 +58,9 @@ u8* CartROM;
 u32 CartROMSize;
 u32 CartID;
 
+// whether CartROM is a mapping of the ROM file rather than a copy
+bool CartROMMapped;
+
 NDSHeader Header;
 NDSBanner Banner;
 
@@ -1437,14 +1443,30 @@ bool Init()
 {
     CartInserted = false;
     CartROM = nullptr;
+    CartROMMapped = false;
     Cart = nullptr;
 
     return true;
 }
 
+void FreeROM()
+{
+    if (!CartROM) return;
+
+#ifndef _WIN32
+    if (CartROMMapped)
+        munmap(CartROM, CartROMSize);
+    else
+#endif
+        delete[] CartROM;
+
+    CartROM = nullptr;
+    CartROMMapped = false;
+}
+
 void DeInit()
 {
-    if (CartROM) delete[] CartROM;
+    FreeROM();
     if (Cart) delete Cart;
 }
 
@@ -1579,14 +1601,8 @@ void DecryptSecureArea(u8* out)
     }
 }
 
-bool LoadROM(const u8* romdata, u32 romlen)
+bool AllocateROM(u32 romlen)
 {
-    if (CartInserted)
-        EjectCart();
-
-    memset(&Header, 0, sizeof(Header));
-    memset(&Banner, 0, sizeof(Banner));
-
     CartROMSize = 0x200;
     while (CartROMSize < romlen)
         CartROMSize <<= 1;
@@ -1602,8 +1618,98 @@ bool LoadROM(const u8* romdata, u32 romlen)
     }
 
     memset(CartROM, 0, CartROMSize);
+    return true;
+}
+
+bool MapROM(FILE* file, u32 romlen)
+{
+#ifdef _WIN32
+    return false;
+#else
+    CartROMSize = 0x200;
+    while (CartROMSize < romlen)
+        CartROMSize <<= 1;
+
+    // reserve the whole rounded up size first, so that whatever is past the
+    // end of the file reads as zero instead of faulting
+    void* rom = mmap(nullptr, CartROMSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (rom == MAP_FAILED)
+        return false;
+
+    // private mapping, so the secure area reencryption or DLDI patching
+    // only copy the pages they touch and never make it to the file
+    if (mmap(rom, romlen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(file), 0) == MAP_FAILED)
+    {
+        munmap(rom, CartROMSize);
+        return false;
+    }
+
+    CartROM = (u8*)rom;
+    CartROMMapped = true;
+    return true;
+#endif
+}
+
+void PrefetchROM(u32 addr, u32 len)
+{
+#ifndef _WIN32
+    if (!CartROMMapped || addr >= CartROMSize) return;
+    if (len > CartROMSize - addr) len = CartROMSize - addr;
+
+    u32 start = addr & ~0xFFF;
+    madvise(&CartROM[start], len + (addr - start), MADV_WILLNEED);
+#endif
+}
+
+bool SetupCart(u32 romlen);
+
+bool LoadROM(const u8* romdata, u32 romlen)
+{
+    if (CartInserted)
+        EjectCart();
+
+    if (!AllocateROM(romlen))
+        return false;
+
     memcpy(CartROM, romdata, romlen);
 
+    return SetupCart(romlen);
+}
+
+bool LoadROM(FILE* file, u32 romlen)
+{
+    if (CartInserted)
+        EjectCart();
+
+    if (!MapROM(file, romlen))
+    {
+        if (!AllocateROM(romlen))
+            return false;
+
+        fseek(file, 0, SEEK_SET);
+        if (fread(CartROM, romlen, 1, file) != 1)
+        {
+            printf("NDSCart: failed to read ROM\n");
+            FreeROM();
+            return false;
+        }
+    }
+
+    if (!SetupCart(romlen))
+        return false;
+
+    // the boot binaries are needed right away, the rest is paged in as the game reads it
+    PrefetchROM(Header.ARM9ROMOffset, Header.ARM9Size);
+    PrefetchROM(Header.ARM7ROMOffset, Header.ARM7Size);
+
+    return true;
+}
+
+bool SetupCart(u32 romlen)
+{
+    memset(&Header, 0, sizeof(Header));
+    memset(&Banner, 0, sizeof(Banner));
+
     memcpy(&Header, CartROM, sizeof(Header));
 
     u8 unitcode = Header.UnitCode;
@@ -1742,8 +1848,7 @@ void EjectCart()
     Cart = nullptr;
 
     CartInserted = false;
-    if (CartROM) delete[] CartROM;
-    CartROM = nullptr;
+    FreeROM();
     CartROMSize = 0;
     CartID = 0;
 
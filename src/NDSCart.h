@@ -220,6 +220,9 @@ void DoSavestate(Savestate* file);
 void DecryptSecureArea(u8* out);
 
 bool LoadROM(const u8* romdata, u32 romlen);
+// maps the ROM file instead of copying it where possible, pages are then only
+// read in when they're accessed. the file can be closed afterwards.
+bool LoadROM(FILE* file, u32 romlen);
 void LoadSave(const u8* savedata, u32 savelen);
 void SetupDirectBoot(std::string romname);
 
@@ -46,6 +46,8 @@ enum ConfigEntry
     JIT_LiteralOptimizations,
     JIT_BranchOptimizations,
     JIT_FastMemory,
+    JIT_BackgroundCompile,
+    JIT_CodeMemorySize,
 #endif
 
     ExternalBIOSEnable,
@@ -0,0 +1,179 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <string.h>
+#include <chrono>
+#include "Profiler.h"
+#include "Platform.h"
+
+
+namespace Profiler
+{
+
+const char* EventNames[NDS::Event_MAX] =
+{
+    "LCD",
+    "SPU",
+    "Wifi",
+
+    "DisplayFIFO",
+    "ROMTransfer",
+    "ROMSPITransfer",
+    "SPITransfer",
+    "Div",
+    "Sqrt",
+
+    "DSi_SDMMCTransfer",
+    "DSi_SDIOTransfer",
+    "DSi_NWifi",
+    "DSi_CamIRQ",
+    "DSi_CamTransfer",
+    "DSi_DSP",
+};
+
+const char* StageNames[Stage_MAX] =
+{
+    "ARM9",
+    "ARM7",
+    "DMA9",
+    "DMA7",
+    "GXStall",
+    "GPU3DGeometry",
+    "GPU3DRender",
+    "GPU2D",
+    "Other",
+};
+
+const char* GetEventName(int id)
+{
+    if (id < 0 || id >= NDS::Event_MAX) return "";
+    return EventNames[id];
+}
+
+const char* GetStageName(int id)
+{
+    if (id < 0 || id >= Stage_MAX) return "";
+    return StageNames[id];
+}
+
+#ifdef PROFILER_ENABLED
+
+FrameProfile Current;
+Counter* Stack[8];
+int StackPos;
+u64 LastTime;
+
+u64 FrameStartTime;
+
+FrameProfile Last;
+FrameProfile Totals;
+Platform::Mutex* Lock;
+
+
+bool Init()
+{
+    Lock = Platform::Mutex_Create();
+
+    memset(&Current, 0, sizeof(Current));
+    memset(&Last, 0, sizeof(Last));
+    memset(&Totals, 0, sizeof(Totals));
+
+    StackPos = 0;
+    Stack[0] = &Current.Stages[Stage_Other];
+    LastTime = GetHostTime();
+
+    return true;
+}
+
+void DeInit()
+{
+    Platform::Mutex_Free(Lock);
+}
+
+u64 GetHostTime()
+{
+    auto time = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+}
+
+void BeginFrame()
+{
+    memset(&Current, 0, sizeof(Current));
+
+    StackPos = 0;
+    Stack[0] = &Current.Stages[Stage_Other];
+    LastTime = GetHostTime();
+    FrameStartTime = LastTime;
+}
+
+void AddCounter(Counter* dst, const Counter* src)
+{
+    dst->HostTime += src->HostTime;
+    dst->Cycles += src->Cycles;
+    dst->Count += src->Count;
+}
+
+void EndFrame(u64 cycles)
+{
+    u64 time = GetHostTime();
+    Stack[StackPos]->HostTime += time - LastTime;
+    LastTime = time;
+
+    Current.NumFrames = 1;
+    Current.Frame.HostTime = time - FrameStartTime;
+    Current.Frame.Cycles = cycles;
+    Current.Frame.Count = 1;
+
+    Platform::Mutex_Lock(Lock);
+
+    Last = Current;
+
+    Totals.NumFrames++;
+    AddCounter(&Totals.Frame, &Current.Frame);
+    for (int i = 0; i < NDS::Event_MAX; i++)
+        AddCounter(&Totals.Events[i], &Current.Events[i]);
+    for (int i = 0; i < Stage_MAX; i++)
+        AddCounter(&Totals.Stages[i], &Current.Stages[i]);
+
+    Platform::Mutex_Unlock(Lock);
+}
+
+void GetLastFrame(FrameProfile* profile)
+{
+    Platform::Mutex_Lock(Lock);
+    *profile = Last;
+    Platform::Mutex_Unlock(Lock);
+}
+
+void GetTotals(FrameProfile* profile)
+{
+    Platform::Mutex_Lock(Lock);
+    *profile = Totals;
+    Platform::Mutex_Unlock(Lock);
+}
+
+void ResetTotals()
+{
+    Platform::Mutex_Lock(Lock);
+    memset(&Totals, 0, sizeof(Totals));
+    Platform::Mutex_Unlock(Lock);
+}
+
+#endif
+
+}
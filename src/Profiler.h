@@ -0,0 +1,143 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "types.h"
+#include "NDS.h"
+
+// per-frame breakdown of where the emulator thread spends its time
+// only compiled in when PROFILER_ENABLED is defined (ENABLE_PROFILER in cmake),
+// otherwise all PROFILER_* macros expand to nothing.
+//
+// host time is accounted exclusively: a stage entered from within a scheduler
+// event (eg. 2D rendering from Event_LCD) is subtracted from that event, so
+// all counters of a frame add up to the frame's host time.
+
+namespace Profiler
+{
+
+enum
+{
+    Stage_ARM9 = 0,
+    Stage_ARM7,
+    Stage_DMA9,
+    Stage_DMA7,
+    Stage_GXStall,      // ARM9 stalled on a full GXFIFO
+    Stage_GPU3DGeometry,
+    Stage_GPU3DRender,  // rasterizer, or waiting for the render thread
+    Stage_GPU2D,
+    Stage_Other,        // scheduling and everything else in RunFrame
+
+    Stage_MAX
+};
+
+struct Counter
+{
+    u64 HostTime;   // nanoseconds
+    u64 Cycles;     // emulated cycles at 33MHz
+    u32 Count;
+};
+
+// for scheduler events, Cycles is how late events ran compared to
+// when they were due, summed over all runs.
+// for the GPU render stages, Cycles is always zero.
+struct FrameProfile
+{
+    u32 NumFrames;
+    Counter Frame;
+    Counter Events[NDS::Event_MAX];
+    Counter Stages[Stage_MAX];
+};
+
+const char* GetEventName(int id);
+const char* GetStageName(int id);
+
+#ifdef PROFILER_ENABLED
+
+extern FrameProfile Current;
+extern Counter* Stack[8];
+extern int StackPos;
+extern u64 LastTime;
+
+bool Init();
+void DeInit();
+
+u64 GetHostTime();
+
+void BeginFrame();
+void EndFrame(u64 cycles);
+
+// copies the profile of the last completed frame
+// safe to call from another thread
+void GetLastFrame(FrameProfile* profile);
+
+// sum of all frames since the last reset
+void GetTotals(FrameProfile* profile);
+void ResetTotals();
+
+// attributes the time since the last switch to the current counter
+// and makes another counter current
+inline void Switch(Counter* counter)
+{
+    u64 time = GetHostTime();
+    Stack[StackPos]->HostTime += time - LastTime;
+    LastTime = time;
+    Stack[StackPos] = counter;
+    counter->Count++;
+}
+
+inline void Enter(Counter* counter)
+{
+    u64 time = GetHostTime();
+    Stack[StackPos]->HostTime += time - LastTime;
+    LastTime = time;
+    Stack[++StackPos] = counter;
+    counter->Count++;
+}
+
+inline void Leave()
+{
+    u64 time = GetHostTime();
+    Stack[StackPos--]->HostTime += time - LastTime;
+    LastTime = time;
+}
+
+#define PROFILER_STAGE(stage) (&Profiler::Current.Stages[Profiler::stage])
+#define PROFILER_EVENT(id) (&Profiler::Current.Events[id])
+
+#define PROFILER_SWITCH(counter) Profiler::Switch(counter)
+#define PROFILER_ENTER(counter) Profiler::Enter(counter)
+#define PROFILER_LEAVE() Profiler::Leave()
+#define PROFILER_MARK(name, val) u64 name = (val)
+#define PROFILER_CYCLES(counter, cycles) (counter)->Cycles += (cycles)
+
+#else
+
+#define PROFILER_SWITCH(counter)
+#define PROFILER_ENTER(counter)
+#define PROFILER_LEAVE()
+#define PROFILER_MARK(name, val)
+#define PROFILER_CYCLES(counter, cycles)
+
+#endif
+
+}
+
+#endif // PROFILER_H
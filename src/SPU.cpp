@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <cmath>
+#include <algorithm>
 #include "Platform.h"
 #include "NDS.h"
 #include "DSi.h"
@@ -62,46 +63,15 @@ const s16 PSGTable[8][8] =
     {-0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF}
 };
 
-// audio interpolation is an improvement upon the original hardware
-// (which performs no interpolation)
-int InterpType;
+// interpolation tables, shared by all instances
 s16 InterpCos[0x100];
 s16 InterpCubic[0x100][4];
 
-const u32 OutputBufferSize = 2*2048;
-s16 OutputBackbuffer[2 * OutputBufferSize];
-u32 OutputBackbufferWritePosition;
-
-s16 OutputFrontBuffer[2 * OutputBufferSize];
-u32 OutputFrontBufferWritePosition;
-u32 OutputFrontBufferReadPosition;
-
-Platform::Mutex* AudioLock;
-
-u16 Cnt;
-u8 MasterVolume;
-u16 Bias;
-bool ApplyBias;
-bool Degrade10Bit;
-
-Channel* Channels[16];
-CaptureUnit* Capture[2];
+Instance* Current;
 
 
 bool Init()
 {
-    for (int i = 0; i < 16; i++)
-        Channels[i] = new Channel(i);
-
-    Capture[0] = new CaptureUnit(0);
-    Capture[1] = new CaptureUnit(1);
-
-    AudioLock = Platform::Mutex_Create();
-
-    InterpType = 0;
-    ApplyBias = true;
-    Degrade10Bit = false;
-
     // generate interpolation tables
     // values are 1:1:14 fixed-point
 
@@ -126,21 +96,46 @@ bool Init()
         InterpCubic[i][3] = i3 - i2;
     }
 
+    Current = new Instance();
     return true;
 }
 
 void DeInit()
+{
+    delete Current;
+    Current = nullptr;
+}
+
+
+Instance::Instance()
+{
+    for (int i = 0; i < 16; i++)
+        Channels[i] = new Channel(i, this);
+
+    Capture[0] = new CaptureUnit(0);
+    Capture[1] = new CaptureUnit(1);
+
+    OutputFrontBufferWritePosition = 0;
+    OutputFrontBufferReadPosition = 0;
+    OutputDiscardRequest = 0;
+    OutputUnderruns = 0;
+    OutputOverruns = 0;
+
+    InterpType = 0;
+    ApplyBias = true;
+    Degrade10Bit = false;
+}
+
+Instance::~Instance()
 {
     for (int i = 0; i < 16; i++)
         delete Channels[i];
 
     delete Capture[0];
     delete Capture[1];
-
-    Platform::Mutex_Free(AudioLock);
 }
 
-void Reset()
+void Instance::Reset()
 {
     InitOutput();
 
@@ -154,21 +149,16 @@ void Reset()
     Capture[0]->Reset();
     Capture[1]->Reset();
 
-    NDS::ScheduleEvent(NDS::Event_SPU, true, 1024, Mix, 0);
+    NDS::ScheduleEvent(NDS::Event_SPU, true, 1024, SPU::Mix, 0);
 }
 
-void Stop()
+void Instance::Stop()
 {
-    Platform::Mutex_Lock(AudioLock);
-    memset(OutputFrontBuffer, 0, 2*OutputBufferSize*2);
-
     OutputBackbufferWritePosition = 0;
-    OutputFrontBufferReadPosition = 0;
-    OutputFrontBufferWritePosition = 0;
-    Platform::Mutex_Unlock(AudioLock);
+    DrainOutput();
 }
 
-void DoSavestate(Savestate* file)
+void Instance::DoSavestate(Savestate* file)
 {
     file->Section("SPU.");
 
@@ -184,36 +174,37 @@ void DoSavestate(Savestate* file)
 }
 
 
-void SetPowerCnt(u32 val)
+void Instance::SetPowerCnt(u32 val)
 {
     // TODO
 }
 
 
-void SetInterpolation(int type)
+void Instance::SetInterpolation(int type)
 {
     InterpType = type;
 }
 
-void SetBias(u16 bias)
+void Instance::SetBias(u16 bias)
 {
     Bias = bias;
 }
 
-void SetApplyBias(bool enable)
+void Instance::SetApplyBias(bool enable)
 {
     ApplyBias = enable;
 }
 
-void SetDegrade10Bit(bool enable)
+void Instance::SetDegrade10Bit(bool enable)
 {
     Degrade10Bit = enable;
 }
 
 
-Channel::Channel(u32 num)
+Channel::Channel(u32 num, Instance* owner)
 {
     Num = num;
+    Owner = owner;
 }
 
 Channel::~Channel()
@@ -522,7 +513,7 @@ s32 Channel::Run()
         // for optional interpolation: save previous samples
         // the interpolated audio will be delayed by a couple samples,
         // but it's easier to deal with this way
-        if ((type < 3) && (InterpType != 0))
+        if ((type < 3) && (Owner->InterpType != 0))
         {
             PrevSample[2] = PrevSample[1];
             PrevSample[1] = PrevSample[0];
@@ -542,12 +533,12 @@ s32 Channel::Run()
     s32 val = (s32)CurSample;
 
     // interpolation (emulation improvement, not a hardware feature)
-    if ((type < 3) && (InterpType != 0))
+    if ((type < 3) && (Owner->InterpType != 0))
     {
         s32 samplepos = ((Timer - TimerReload) * 0x100) / (0x10000 - TimerReload);
         if (samplepos > 0xFF) samplepos = 0xFF;
 
-        switch (InterpType)
+        switch (Owner->InterpType)
         {
         case 1: // linear
             val = ((val           * samplepos) +
@@ -712,7 +703,7 @@ void CaptureUnit::Run(s32 sample)
 }
 
 
-void Mix(u32 dummy)
+void Instance::Mix(u32 dummy)
 {
     s32 left = 0, right = 0;
     s32 leftoutput = 0, rightoutput = 0;
@@ -851,81 +842,73 @@ void Mix(u32 dummy)
     OutputBackbuffer[OutputBackbufferWritePosition + 1] = rightoutput >> 1;
     OutputBackbufferWritePosition += 2;
 
-    NDS::ScheduleEvent(NDS::Event_SPU, true, 1024, Mix, 0);
+    NDS::ScheduleEvent(NDS::Event_SPU, true, 1024, SPU::Mix, 0);
 }
 
-void TransferOutput()
+void Instance::TransferOutput()
 {
-    Platform::Mutex_Lock(AudioLock);
-    for (u32 i = 0; i < OutputBackbufferWritePosition; i += 2)
-    {
-        OutputFrontBuffer[OutputFrontBufferWritePosition    ] = OutputBackbuffer[i   ];
-        OutputFrontBuffer[OutputFrontBufferWritePosition + 1] = OutputBackbuffer[i + 1];
+    u32 writepos = OutputFrontBufferWritePosition.load(std::memory_order_relaxed);
+    u32 readpos = OutputFrontBufferReadPosition.load(std::memory_order_acquire);
 
-        OutputFrontBufferWritePosition += 2;
-        OutputFrontBufferWritePosition &= OutputBufferSize*2-1;
-        if (OutputFrontBufferWritePosition == OutputFrontBufferReadPosition)
-        {
-            // advance the read position too, to avoid losing the entire FIFO
-            OutputFrontBufferReadPosition += 2;
-            OutputFrontBufferReadPosition &= OutputBufferSize*2-1;
-        }
+    u32 len = OutputBackbufferWritePosition >> 1;
+    u32 space = OutputBufferSize - (writepos - readpos);
+    if (len > space)
+    {
+        // the audio thread is lagging behind, drop what doesn't fit
+        OutputOverruns.fetch_add(1, std::memory_order_relaxed);
+        len = space;
     }
+
+    u32 start = writepos & (OutputBufferSize-1);
+    u32 len1 = std::min(len, OutputBufferSize - start);
+    memcpy(&OutputFrontBuffer[start * 2], &OutputBackbuffer[0], len1 * 4);
+    memcpy(&OutputFrontBuffer[0], &OutputBackbuffer[len1 * 2], (len - len1) * 4);
+
+    OutputFrontBufferWritePosition.store(writepos + len, std::memory_order_release);
     OutputBackbufferWritePosition = 0;
-    Platform::Mutex_Unlock(AudioLock);
 }
 
-void TrimOutput()
+// called from the emulator thread, makes the audio thread skip
+// everything but the last 'keep' samples written so far
+void Instance::DiscardOutput(u32 keep)
 {
-    Platform::Mutex_Lock(AudioLock);
-    const int halflimit = (OutputBufferSize / 2);
-
-    int readpos = OutputFrontBufferWritePosition - (halflimit*2);
-    if (readpos < 0) readpos += (OutputBufferSize*2);
+    u32 writepos = OutputFrontBufferWritePosition.load(std::memory_order_relaxed);
+    OutputDiscardRequest.store((1ULL << 32) | (u32)(writepos - keep), std::memory_order_release);
+}
 
-    OutputFrontBufferReadPosition = readpos;
-    Platform::Mutex_Unlock(AudioLock);
+void Instance::TrimOutput()
+{
+    const int halflimit = (OutputBufferSize / 2);
+    DiscardOutput(halflimit);
 }
 
-void DrainOutput()
+void Instance::DrainOutput()
 {
-    Platform::Mutex_Lock(AudioLock);
-    OutputFrontBufferWritePosition = 0;
-    OutputFrontBufferReadPosition = 0;
-    Platform::Mutex_Unlock(AudioLock);
+    DiscardOutput(0);
 }
 
-void InitOutput()
+void Instance::InitOutput()
 {
-    Platform::Mutex_Lock(AudioLock);
     memset(OutputBackbuffer, 0, 2*OutputBufferSize*2);
-    memset(OutputFrontBuffer, 0, 2*OutputBufferSize*2);
-    OutputFrontBufferReadPosition = 0;
-    OutputFrontBufferWritePosition = 0;
-    Platform::Mutex_Unlock(AudioLock);
+    OutputBackbufferWritePosition = 0;
+    DrainOutput();
 }
 
-int GetOutputSize()
+int Instance::GetOutputSize()
 {
-    Platform::Mutex_Lock(AudioLock);
+    u32 writepos = OutputFrontBufferWritePosition.load(std::memory_order_acquire);
+    u32 readpos = OutputFrontBufferReadPosition.load(std::memory_order_acquire);
 
-    int ret;
-    if (OutputFrontBufferWritePosition >= OutputFrontBufferReadPosition)
-        ret = OutputFrontBufferWritePosition - OutputFrontBufferReadPosition;
-    else
-        ret = (OutputBufferSize*2) - OutputFrontBufferReadPosition + OutputFrontBufferWritePosition;
+    u64 discard = OutputDiscardRequest.load(std::memory_order_acquire);
+    if (discard && (s32)((u32)discard - readpos) > 0)
+        readpos = (u32)discard;
 
-    ret >>= 1;
-
-    Platform::Mutex_Unlock(AudioLock);
-    return ret;
+    return writepos - readpos;
 }
 
-void Sync(bool wait)
+void Instance::Sync(bool wait)
 {
     // this function is currently not used anywhere
-    // depending on the usage context the thread safety measures could be made
-    // a lot faster
 
     // sync to audio output in case the core is running too fast
     // * wait=true: wait until enough audio data has been played
@@ -940,47 +923,42 @@ void Sync(bool wait)
     }
     else if (GetOutputSize() > halflimit)
     {
-        Platform::Mutex_Lock(AudioLock);
-
-        int readpos = OutputFrontBufferWritePosition - (halflimit*2);
-        if (readpos < 0) readpos += (OutputBufferSize*2);
-
-        OutputFrontBufferReadPosition = readpos;
-
-        Platform::Mutex_Unlock(AudioLock);
+        TrimOutput();
     }
 }
 
-int ReadOutput(s16* data, int samples)
+int Instance::ReadOutput(s16* data, int samples)
 {
-    Platform::Mutex_Lock(AudioLock);
-    if (OutputFrontBufferReadPosition == OutputFrontBufferWritePosition)
-    {
-        Platform::Mutex_Unlock(AudioLock);
-        return 0;
-    }
+    u32 writepos = OutputFrontBufferWritePosition.load(std::memory_order_acquire);
+    u32 readpos = OutputFrontBufferReadPosition.load(std::memory_order_relaxed);
 
-    for (int i = 0; i < samples; i++)
-    {
-        *data++ = OutputFrontBuffer[OutputFrontBufferReadPosition];
-        *data++ = OutputFrontBuffer[OutputFrontBufferReadPosition + 1];
+    u64 discard = OutputDiscardRequest.exchange(0, std::memory_order_acquire);
+    if (discard && (s32)((u32)discard - readpos) > 0)
+        readpos = (u32)discard;
 
-        OutputFrontBufferReadPosition += 2;
-        OutputFrontBufferReadPosition &= ((2*OutputBufferSize)-1);
+    u32 len = writepos - readpos;
+    if (len < (u32)samples)
+        OutputUnderruns.fetch_add(1, std::memory_order_relaxed);
+    else
+        len = samples;
 
-        if (OutputFrontBufferWritePosition == OutputFrontBufferReadPosition)
-        {
-            Platform::Mutex_Unlock(AudioLock);
-            return i+1;
-        }
-    }
+    u32 start = readpos & (OutputBufferSize-1);
+    u32 len1 = std::min(len, OutputBufferSize - start);
+    memcpy(data, &OutputFrontBuffer[start * 2], len1 * 4);
+    memcpy(data + len1 * 2, &OutputFrontBuffer[0], (len - len1) * 4);
 
-    Platform::Mutex_Unlock(AudioLock);
-    return samples;
+    OutputFrontBufferReadPosition.store(readpos + len, std::memory_order_release);
+    return len;
 }
 
+void Instance::GetOutputStats(u32* underruns, u32* overruns)
+{
+    *underruns = OutputUnderruns.load(std::memory_order_relaxed);
+    *overruns = OutputOverruns.load(std::memory_order_relaxed);
+}
 
-u8 Read8(u32 addr)
+
+u8 Instance::Read8(u32 addr)
 {
     if (addr < 0x04000500)
     {
@@ -1010,7 +988,7 @@ u8 Read8(u32 addr)
     return 0;
 }
 
-u16 Read16(u32 addr)
+u16 Instance::Read16(u32 addr)
 {
     if (addr < 0x04000500)
     {
@@ -1037,7 +1015,7 @@ u16 Read16(u32 addr)
     return 0;
 }
 
-u32 Read32(u32 addr)
+u32 Instance::Read32(u32 addr)
 {
     if (addr < 0x04000500)
     {
@@ -1066,7 +1044,7 @@ u32 Read32(u32 addr)
     return 0;
 }
 
-void Write8(u32 addr, u8 val)
+void Instance::Write8(u32 addr, u8 val)
 {
     if (addr < 0x04000500)
     {
@@ -1107,7 +1085,7 @@ void Write8(u32 addr, u8 val)
     printf("unknown SPU write8 %08X %02X\n", addr, val);
 }
 
-void Write16(u32 addr, u16 val)
+void Instance::Write16(u32 addr, u16 val)
 {
     if (addr < 0x04000500)
     {
@@ -1156,7 +1134,7 @@ void Write16(u32 addr, u16 val)
     printf("unknown SPU write16 %08X %04X\n", addr, val);
 }
 
-void Write32(u32 addr, u32 val)
+void Instance::Write32(u32 addr, u32 val)
 {
     if (addr < 0x04000500)
     {
@@ -1204,4 +1182,122 @@ void Write32(u32 addr, u32 val)
     }
 }
 
+
+// the rest of the core goes through these
+
+void Reset()
+{
+    Current->Reset();
+}
+
+void Stop()
+{
+    Current->Stop();
+}
+
+void DoSavestate(Savestate* file)
+{
+    Current->DoSavestate(file);
+}
+
+void SetPowerCnt(u32 val)
+{
+    Current->SetPowerCnt(val);
+}
+
+void SetInterpolation(int type)
+{
+    Current->SetInterpolation(type);
+}
+
+void SetBias(u16 bias)
+{
+    Current->SetBias(bias);
+}
+
+void SetDegrade10Bit(bool enable)
+{
+    Current->SetDegrade10Bit(enable);
+}
+
+void SetApplyBias(bool enable)
+{
+    Current->SetApplyBias(enable);
+}
+
+void Mix(u32 dummy)
+{
+    Current->Mix(dummy);
+}
+
+void TrimOutput()
+{
+    Current->TrimOutput();
+}
+
+void DrainOutput()
+{
+    Current->DrainOutput();
+}
+
+void InitOutput()
+{
+    Current->InitOutput();
+}
+
+int GetOutputSize()
+{
+    return Current->GetOutputSize();
+}
+
+void Sync(bool wait)
+{
+    Current->Sync(wait);
+}
+
+int ReadOutput(s16* data, int samples)
+{
+    return Current->ReadOutput(data, samples);
+}
+
+void GetOutputStats(u32* underruns, u32* overruns)
+{
+    Current->GetOutputStats(underruns, overruns);
+}
+
+void TransferOutput()
+{
+    Current->TransferOutput();
+}
+
+u8 Read8(u32 addr)
+{
+    return Current->Read8(addr);
+}
+
+u16 Read16(u32 addr)
+{
+    return Current->Read16(addr);
+}
+
+u32 Read32(u32 addr)
+{
+    return Current->Read32(addr);
+}
+
+void Write8(u32 addr, u8 val)
+{
+    Current->Write8(addr, val);
+}
+
+void Write16(u32 addr, u16 val)
+{
+    Current->Write16(addr, val);
+}
+
+void Write32(u32 addr, u32 val)
+{
+    Current->Write32(addr, val);
+}
+
 }
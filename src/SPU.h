@@ -19,11 +19,15 @@
 #ifndef SPU_H
 #define SPU_H
 
+#include <atomic>
+
 #include "Savestate.h"
 
 namespace SPU
 {
 
+class Instance;
+
 bool Init();
 void DeInit();
 void Reset();
@@ -50,6 +54,11 @@ void Sync(bool wait);
 int ReadOutput(s16* data, int samples);
 void TransferOutput();
 
+// number of times the audio thread asked for more samples than were
+// available, and number of times samples had to be dropped because
+// the output buffer was full
+void GetOutputStats(u32* underruns, u32* overruns);
+
 u8 Read8(u32 addr);
 u16 Read16(u32 addr);
 u32 Read32(u32 addr);
@@ -60,7 +69,7 @@ void Write32(u32 addr, u32 val);
 class Channel
 {
 public:
-    Channel(u32 num);
+    Channel(u32 num, Instance* owner);
     ~Channel();
     void Reset();
     void DoSavestate(Savestate* file);
@@ -161,6 +170,7 @@ public:
     void PanOutput(s32 in, s32& left, s32& right);
 
 private:
+    Instance* Owner;
     u32 (*BusRead32)(u32 addr);
 };
 
@@ -221,6 +231,82 @@ private:
     void (*BusWrite32)(u32 addr, u32 val);
 };
 
+// all of the sound unit's state
+// the free functions above work on the current instance
+class Instance
+{
+public:
+    Instance();
+    ~Instance();
+    void Reset();
+    void Stop();
+
+    void DoSavestate(Savestate* file);
+
+    void SetPowerCnt(u32 val);
+    void SetInterpolation(int type);
+    void SetBias(u16 bias);
+    void SetDegrade10Bit(bool enable);
+    void SetApplyBias(bool enable);
+
+    void Mix(u32 dummy);
+
+    void TrimOutput();
+    void DrainOutput();
+    void InitOutput();
+    int GetOutputSize();
+    void Sync(bool wait);
+    int ReadOutput(s16* data, int samples);
+    void TransferOutput();
+    void GetOutputStats(u32* underruns, u32* overruns);
+
+    u8 Read8(u32 addr);
+    u16 Read16(u32 addr);
+    u32 Read32(u32 addr);
+    void Write8(u32 addr, u8 val);
+    void Write16(u32 addr, u16 val);
+    void Write32(u32 addr, u32 val);
+
+    // audio interpolation is an improvement upon the original hardware
+    // (which performs no interpolation)
+    int InterpType;
+
+    Channel* Channels[16];
+    CaptureUnit* Capture[2];
+
+private:
+    static const u32 OutputBufferSize = 2*2048;
+    s16 OutputBackbuffer[2 * OutputBufferSize];
+    u32 OutputBackbufferWritePosition;
+
+    // the front buffer is a single-producer/single-consumer ring, written by the
+    // emulator thread (TransferOutput) and read by the audio thread (ReadOutput)
+    // without locking. positions count stereo samples and only ever increase,
+    // the difference between them is the amount of buffered samples.
+    s16 OutputFrontBuffer[2 * OutputBufferSize];
+    std::atomic<u32> OutputFrontBufferWritePosition;
+    std::atomic<u32> OutputFrontBufferReadPosition;
+
+    // only the audio thread may move the read position. the emulator thread
+    // requests skipping ahead to a given position instead (bit 32 set = pending).
+    // until the audio thread is done with it, the space in front of the read
+    // position stays in use, as it might still be copying from there.
+    std::atomic<u64> OutputDiscardRequest;
+
+    std::atomic<u32> OutputUnderruns;
+    std::atomic<u32> OutputOverruns;
+
+    void DiscardOutput(u32 keep);
+
+    u16 Cnt;
+    u8 MasterVolume;
+    u16 Bias;
+    bool ApplyBias;
+    bool Degrade10Bit;
+};
+
+extern Instance* Current;
+
 }
 
 #endif // SPU_H
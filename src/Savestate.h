@@ -50,6 +50,23 @@ public:
 
     virtual void VarArray(void* data, u32 len) = 0;
 
+    // for memory whose writes are tracked in a bitmap, one bit per pagesize
+    // bytes. savestates that keep the previous state around only need to
+    // write the pages that are set. dirty is null if the writes can't be
+    // tracked at the moment.
+    virtual void VarArrayTracked(void* data, u32 len, u64* dirty, u32 pagesize)
+    {
+        VarArray(data, len);
+
+        // the memory doesn't match whatever was saved incrementally anymore
+        if (!Saving && dirty)
+        {
+            u32 numpages = (len + pagesize - 1) / pagesize;
+            for (u32 i = 0; i < numpages; i++)
+                dirty[i >> 6] |= 1ULL << (i & 0x3F);
+        }
+    }
+
     bool IsAtleastVersion(u32 major, u32 minor)
     {
         if (VersionMajor > major) return true;
@@ -71,6 +71,9 @@ int JIT_MaxBlockSize = 32;
 bool JIT_BranchOptimisations = true;
 bool JIT_LiteralOptimisations = true;
 bool JIT_FastMemory = true;
+bool JIT_BackgroundCompile = false;
+int JIT_CodeMemorySize = 32;
+bool JIT_PersistentCache = false;
 #endif
 
 bool ExternalBIOSEnable;
@@ -241,6 +244,9 @@ ConfigEntry ConfigFile[] =
     #else
         {"JIT_FastMemory", 1, &JIT_FastMemory, true},
     #endif
+    {"JIT_BackgroundCompile", 1, &JIT_BackgroundCompile, false},
+    {"JIT_CodeMemorySize", 0, &JIT_CodeMemorySize, 32},
+    {"JIT_PersistentCache", 1, &JIT_PersistentCache, false},
 #endif
 
     {"ExternalBIOSEnable", 1, &ExternalBIOSEnable, false},
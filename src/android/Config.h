@@ -106,6 +106,9 @@ extern int JIT_MaxBlockSize;
 extern bool JIT_BranchOptimisations;
 extern bool JIT_LiteralOptimisations;
 extern bool JIT_FastMemory;
+extern bool JIT_BackgroundCompile;
+extern int JIT_CodeMemorySize;
+extern bool JIT_PersistentCache;
 #endif
 
 extern bool ExternalBIOSEnable;
@@ -14,8 +14,10 @@
 #include "../AREngine.h"
 #include "../FileSavestate.h"
 #include "../DSi_I2C.h"
+#include "../Profiler.h"
 #include "Config.h"
 #include "MemorySavestate.h"
+#include "IncrementalSavestate.h"
 #include "FrontendUtil.h"
 #include "RewindManager.h"
 #include "ROMManager.h"
@@ -46,6 +48,7 @@ namespace MelonDSAndroid
     AndroidCameraHandler* cameraHandler;
     std::string internalFilesDir;
     EmulatorConfiguration currentConfiguration;
+    bool fastForwardEnabled = false;
 
     // Variables used to keep the current state so that emulation can be reset
     char* currentRomPath = NULL;
@@ -59,6 +62,7 @@ namespace MelonDSAndroid
     void cleanupAudioOutputStream();
     void setupMicInputStream();
     void resetAudioOutputStream();
+    void updateFrameSkip();
     void copyString(char** dest, const char* source);
 
     /**
@@ -109,6 +113,7 @@ namespace MelonDSAndroid
 
 #ifdef JIT_ENABLED
         Config::JIT_Enable = emulatorConfiguration.useJit;
+        Config::JIT_PersistentCache = emulatorConfiguration.jitPersistentCache;
 #endif
 
         Config::AudioBitrate = emulatorConfiguration.audioBitrate;
@@ -121,8 +126,8 @@ namespace MelonDSAndroid
         Config::RewindEnabled = emulatorConfiguration.rewindEnabled;
         Config::RewindCaptureSpacingSeconds = emulatorConfiguration.rewindCaptureSpacingSeconds;
         Config::RewindLengthSeconds = emulatorConfiguration.rewindLengthSeconds;
-        // Use 20MB per savestate
-        RewindManager::SetRewindBufferSizes(1024 * 1024 * 20, 256 * 384 * 4);
+        // Use up to 20MB per savestate, stored compressed in a 64MB arena
+        RewindManager::SetRewindBufferSizes(1024 * 1024 * 20, 256 * 384 * 4, 1024 * 1024 * 64);
     }
 
     void setup(AAssetManager* androidAssetManager, AndroidCameraHandler* androidCameraHandler, RetroAchievements::RACallback* raCallback, u32* textureBufferPointer, bool isMasterInstance) {
@@ -238,6 +243,7 @@ namespace MelonDSAndroid
         }
 
         currentConfiguration = emulatorConfiguration;
+        updateFrameSkip();
     }
 
     int loadRom(char* romPath, char* sramPath, bool loadGbaRom, char* gbaRom, char* gbaSram)
@@ -309,8 +315,9 @@ namespace MelonDSAndroid
         if (ROMManager::GBASave)
             ROMManager::GBASave->CheckFlush();
 
+        // skipped frames leave the last drawn one in front, there's nothing new to copy
         int frontbuf = GPU::FrontBuffer;
-        if (GPU::Framebuffer[frontbuf][0] && GPU::Framebuffer[frontbuf][1])
+        if (!GPU::SkipFrame && GPU::Framebuffer[frontbuf][0] && GPU::Framebuffer[frontbuf][1])
         {
             memcpy(textureBuffer, GPU::Framebuffer[frontbuf][0], 256 * 192 * 4);
             memcpy(&textureBuffer[256 * 192], GPU::Framebuffer[frontbuf][1], 256 * 192 * 4);
@@ -319,13 +326,27 @@ namespace MelonDSAndroid
 
         if (RewindManager::ShouldCaptureState(frame))
         {
-            auto nextRewindState = RewindManager::GetNextRewindSaveState(frame);
-            saveRewindState(nextRewindState);
+            saveRewindState(frame);
         }
 
         return nLines;
     }
 
+    void setFastForwardEnabled(bool enabled)
+    {
+        fastForwardEnabled = enabled;
+        updateFrameSkip();
+    }
+
+    void updateFrameSkip()
+    {
+        int frameSkip = 0;
+        if (fastForwardEnabled)
+            frameSkip = (int) currentConfiguration.fastForwardSpeedMultiplier - 1;
+
+        GPU::SetFrameSkip(frameSkip);
+    }
+
     void pause() {
         if (audioStream != NULL)
             audioStream->requestPause();
@@ -428,9 +449,9 @@ namespace MelonDSAndroid
         return success;
     }
 
-    bool saveRewindState(RewindManager::RewindSaveState rewindSaveState)
+    bool saveRewindState(int frame)
     {
-        MemorySavestate* savestate = new MemorySavestate(rewindSaveState.buffer, true);
+        IncrementalSavestate* savestate = new IncrementalSavestate(RewindManager::GetCaptureBuffer(), true, RewindManager::GetCaptureContext());
         if (savestate->Error)
         {
             delete savestate;
@@ -442,14 +463,21 @@ namespace MelonDSAndroid
             if (success)
                 success = RetroAchievements::DoSavestate(savestate);
 
+            u32 length = savestate->Length();
+            delete savestate;
+
             if (success)
-                memcpy(rewindSaveState.screenshot, textureBuffer, 256 * 384 * 4);
+                success = RewindManager::CommitRewindState(frame, length, (u8*) textureBuffer);
 
-            delete savestate;
             return success;
         }
     }
 
+    bool saveRewindState(RewindManager::RewindSaveState rewindSaveState)
+    {
+        return saveRewindState(rewindSaveState.frame);
+    }
+
     bool loadRewindState(RewindManager::RewindSaveState rewindSaveState)
     {
         bool success = true;
@@ -460,7 +488,7 @@ namespace MelonDSAndroid
         RetroAchievements::DoSavestate(backup);
         delete backup;
 
-        Savestate* savestate = new MemorySavestate(rewindSaveState.buffer, false);
+        Savestate* savestate = new MemorySavestate(RewindManager::RestoreRewindState(rewindSaveState), false);
         if (savestate->Error)
         {
             delete savestate;
@@ -492,6 +520,21 @@ namespace MelonDSAndroid
         };
     }
 
+    bool getFrameProfile(Profiler::FrameProfile* profile)
+    {
+#ifdef PROFILER_ENABLED
+        Profiler::GetLastFrame(profile);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void getAudioStats(u32* underruns, u32* overruns)
+    {
+        SPU::GetOutputStats(underruns, overruns);
+    }
+
     void cleanup()
     {
         RetroAchievements::DeInit();
@@ -503,6 +546,9 @@ namespace MelonDSAndroid
         NDS::DeInit();
         RewindManager::Reset();
 
+        fastForwardEnabled = false;
+        GPU::SetFrameSkip(0);
+
         free(currentRomPath);
         free(currentSramPath);
         free(currentGbaRomPath);
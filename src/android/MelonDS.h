@@ -9,6 +9,7 @@
 #include "retroachievements/RACallback.h"
 #include "../types.h"
 #include "../GPU.h"
+#include "../Profiler.h"
 #include <android/asset_manager.h>
 
 namespace MelonDSAndroid {
@@ -36,6 +37,7 @@ namespace MelonDSAndroid {
         float fastForwardSpeedMultiplier;
         bool showBootScreen;
         bool useJit;
+        bool jitPersistentCache;
         int consoleType;
         bool soundEnabled;
         int volume;
@@ -94,15 +96,57 @@ namespace MelonDSAndroid {
     extern int bootFirmware();
     extern void start();
     extern u32 loop();
+
+    /**
+     * Enables or disables frame skipping while fast-forwarding. While enabled, only one frame out of every
+     * fastForwardSpeedMultiplier is drawn, since the screen can't show more frames than at normal speed anyway. The
+     * texture buffer is only updated by loop() for the frames that are drawn.
+     *
+     * @param enabled If fast-forward is active
+     */
+    extern void setFastForwardEnabled(bool enabled);
+
     extern void pause();
     extern void resume();
     extern bool reset();
     extern void updateMic();
     extern bool saveState(const char* path);
     extern bool loadState(const char* path);
+
+    /**
+     * Captures the current emulator state and screen into the rewind window. The state is stored delta-compressed in
+     * the rewind arena, and shows up in getRewindWindow() afterwards.
+     *
+     * @param frame The frame the state is captured at
+     * @return If the state could be captured
+     */
+    extern bool saveRewindState(int frame);
+
+    /**
+     * Kept for callers of the old API. The buffers of rewindSaveState aren't written to anymore: the state is
+     * captured into the rewind arena for rewindSaveState.frame, as with saveRewindState(int).
+     */
     extern bool saveRewindState(RewindManager::RewindSaveState rewindSaveState);
+
     extern bool loadRewindState(RewindManager::RewindSaveState rewindSaveState);
     extern RewindWindow getRewindWindow();
+
+    /**
+     * Retrieves the profile of the last emulated frame. Can be called from any thread.
+     *
+     * @param profile Where to store the profile
+     * @return False if the library was built without ENABLE_PROFILER, in which case no profile is available
+     */
+    extern bool getFrameProfile(Profiler::FrameProfile* profile);
+
+    /**
+     * Retrieves how often the audio output ran dry or had to drop samples since the emulator was started. Can be
+     * called from any thread.
+     *
+     * @param underruns Where to store the number of audio callbacks that got fewer samples than requested
+     * @param overruns Where to store the number of frames whose samples didn't fit in the output buffer
+     */
+    extern void getAudioStats(u32* underruns, u32* overruns);
     extern void cleanup();
 }
 
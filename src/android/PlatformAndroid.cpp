@@ -77,6 +77,7 @@ namespace Platform
         {
 #ifdef JIT_ENABLED
             case JIT_MaxBlockSize: return Config::JIT_MaxBlockSize;
+            case JIT_CodeMemorySize: return Config::JIT_CodeMemorySize;
 #endif
 
             case DLDI_ImageSize: return imgsizes[Config::DLDISize];
@@ -103,6 +104,7 @@ namespace Platform
             case JIT_LiteralOptimizations: return Config::JIT_LiteralOptimisations != 0;
             case JIT_BranchOptimizations: return Config::JIT_BranchOptimisations != 0;
             case JIT_FastMemory: return Config::JIT_FastMemory != 0;
+            case JIT_BackgroundCompile: return Config::JIT_BackgroundCompile != 0;
 #endif
 
             case ExternalBIOSEnable: return Config::ExternalBIOSEnable != 0;
@@ -33,6 +33,9 @@
 #include "DSi.h"
 #include "SPI.h"
 #include "DSi_I2C.h"
+#ifdef JIT_ENABLED
+#include "ARMJIT.h"
+#endif
 
 
 namespace ROMManager
@@ -288,38 +291,28 @@ bool LoadROM(std::string filepath, std::string sramPath, bool reset)
 {
     if (filepath.empty()) return false;
 
-    u8* filedata;
-    u32 filelen;
-
     FILE* f = Platform::OpenFile(filepath, "rb", true);
     if (!f) return false;
 
     fseek(f, 0, SEEK_END);
     long len = ftell(f);
-    if (len > 0x40000000)
+    if (len <= 0 || len > 0x40000000)
     {
         fclose(f);
         return false;
     }
 
-    fseek(f, 0, SEEK_SET);
-    filedata = new u8[len];
-    size_t nread = fread(filedata, (size_t)len, 1, f);
-    if (nread != 1)
-    {
-        fclose(f);
-        delete[] filedata;
-        return false;
-    }
-
-    fclose(f);
-    filelen = (u32)len;
+    // the ROM is mapped rather than read, the file is kept open until then
+    u32 filelen = (u32)len;
 
     if (NDSSave) delete NDSSave;
     NDSSave = nullptr;
 
     if (reset)
     {
+#ifdef JIT_ENABLED
+        ARMJIT::SetBlockCacheFile("");
+#endif
         NDS::SetConsoleType(Config::ConsoleType);
         NDS::EjectCart();
         NDS::Reset();
@@ -344,7 +337,8 @@ bool LoadROM(std::string filepath, std::string sramPath, bool reset)
         fclose(sav);
     }
 
-    bool res = NDS::LoadCart(filedata, filelen, savedata, savelen);
+    bool res = NDS::LoadCart(f, filelen, savedata, savelen);
+    fclose(f);
     if (res && reset)
     {
         if (Config::DirectBoot || NDS::NeedsDirectBoot())
@@ -358,10 +352,17 @@ bool LoadROM(std::string filepath, std::string sramPath, bool reset)
     {
         CartType = 0;
         NDSSave = new SaveManager(sramPath);
+
+#ifdef JIT_ENABLED
+        // keep the compiled code next to the save file
+        if (Config::JIT_Enable && Config::JIT_PersistentCache)
+            ARMJIT::SetBlockCacheFile(sramPath.substr(0, sramPath.rfind('.')) + ".mljit");
+        else
+            ARMJIT::SetBlockCacheFile("");
+#endif
     }
 
     if (savedata) delete[] savedata;
-    delete[] filedata;
     return res;
 }
 
@@ -370,6 +371,9 @@ void EjectCart()
     if (NDSSave) delete NDSSave;
     NDSSave = nullptr;
 
+#ifdef JIT_ENABLED
+    ARMJIT::SetBlockCacheFile("");
+#endif
     NDS::EjectCart();
 
     CartType = -1;
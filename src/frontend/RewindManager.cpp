@@ -18,43 +18,358 @@
 
 #include "RewindManager.h"
 #include "Config.h"
+#define XXH_STATIC_LINKING_ONLY
+#include "../xxhash/xxhash.h"
+#include <deque>
 #include <list>
+#include <vector>
+#include <string.h>
+
+/*
+    Rewind storage
+
+    Savestates are split in 4KB pages. States are grouped behind a keyframe,
+    which stores every page as is. The other states of the group only store
+    the pages that differ from the keyframe, XORed against it and with the
+    runs of zero words stripped out. A page that didn't change since the
+    previous state of the group is shared with it. States are captured
+    incrementally into the same buffer, so pages that weren't rewritten don't
+    even have to be hashed.
+
+    All of this lives in one ring arena, the screenshots included: states are
+    appended at the head, and whole groups are evicted from the tail when
+    space is needed.
+
+    record layout:
+    SnapshotHeader
+    u64 hashes[NumPages]
+    PageEntry pages[NumPages]
+    page data
+    screenshot
+*/
 
 namespace RewindManager
 {
 
 const int FRAMES_PER_SECOND = 60;
+const int KEYFRAME_INTERVAL = 8;
+
+const u32 PAGE_SIZE = 0x1000;
+const u32 PAGE_WORDS = PAGE_SIZE / 4;
+
+// PageEntry sizes
+const u32 PAGE_SAME_AS_KEYFRAME = 0;
+const u32 PAGE_RAW = 0xFFFFFFFF;
+
+struct SnapshotHeader
+{
+    u32 Size;
+    u32 StateLength;
+    u32 NumPages;
+    u32 Keyframe;
+};
+
+struct PageEntry
+{
+    u32 Offset; // absolute offset in the arena
+    u32 Size;
+};
+
+struct Snapshot
+{
+    RewindSaveState State;
+    u32 Offset;
+    u32 Size;
+    u32 Group;
+    bool Keyframe;
+};
+
+// newest snapshot at the front
+std::deque<Snapshot> Snapshots;
+u32 NextGroup = 0;
+int CapturesSinceKeyframe = 0;
+
+u32 SavestateBufferSize = 0;
+u32 ScreenshotBufferSize = 0;
+u32 ArenaSize = 0;
+
+u8* Arena = nullptr;
+u8* CaptureBuffer = nullptr;
+IncrementalSavestateContext CaptureContext;
+// whether the newest snapshot was encoded from what's in the capture buffer
+// when the changed pages were last cleared
+bool CaptureMatchesNewest = false;
+u8* StagingBuffer = nullptr;
+u32 StagingBufferSize = 0;
 
-std::list<RewindSaveState> RewindWindow = std::list<RewindSaveState>();
-u32 SavestateBufferSize;
-u32 ScreenshotBufferSize;
+// pages whose data is stored in the staged record itself
+std::vector<u32> StagedPages;
 
 int RewindWindowSize()
 {
     return Config::RewindLengthSeconds / Config::RewindCaptureSpacingSeconds;
 }
 
-RewindSaveState CreateRewindSaveState(int frame)
+u32 NumPagesForLength(u32 length)
 {
-    return RewindSaveState {
-        .buffer = new u8[SavestateBufferSize],
-        .bufferSize = SavestateBufferSize,
-        .screenshot = new u8[ScreenshotBufferSize],
-        .screenshotSize = ScreenshotBufferSize,
-        .frame = frame
-    };
+    return (length + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+SnapshotHeader* GetHeader(u32 offset)
+{
+    return (SnapshotHeader*)&Arena[offset];
+}
+
+u64* GetHashes(u32 offset)
+{
+    return (u64*)&Arena[offset + sizeof(SnapshotHeader)];
+}
+
+PageEntry* GetPages(u32 offset)
+{
+    SnapshotHeader* header = GetHeader(offset);
+    return (PageEntry*)&Arena[offset + sizeof(SnapshotHeader) + header->NumPages * sizeof(u64)];
+}
+
+Snapshot* GetKeyframe(u32 group)
+{
+    for (Snapshot& snapshot : Snapshots)
+    {
+        if (snapshot.Group == group && snapshot.Keyframe)
+            return &snapshot;
+    }
+
+    return nullptr;
+}
+
+void EvictOldestGroup()
+{
+    u32 group = Snapshots.back().Group;
+    while (!Snapshots.empty() && Snapshots.back().Group == group)
+        Snapshots.pop_back();
+}
+
+// finds room for a record at the head of the ring, evicting the oldest groups
+// as needed. fails if that would mean evicting protectGroup.
+bool AllocateRecord(u32 size, u32* offset, bool protect, u32 protectGroup)
+{
+    if (size > ArenaSize)
+        return false;
+
+    for (;;)
+    {
+        if (Snapshots.empty())
+        {
+            *offset = 0;
+            return true;
+        }
+
+        u32 tail = Snapshots.back().Offset;
+        u32 head = Snapshots.front().Offset + Snapshots.front().Size;
+
+        if (Snapshots.front().Offset >= tail)
+        {
+            // not wrapped: free space at the end, then at the start
+            if (ArenaSize - head >= size)
+            {
+                *offset = head;
+                return true;
+            }
+            if (tail >= size)
+            {
+                *offset = 0;
+                return true;
+            }
+        }
+        else
+        {
+            if (tail - head >= size)
+            {
+                *offset = head;
+                return true;
+            }
+        }
+
+        if (protect && Snapshots.back().Group == protectGroup)
+            return false;
+
+        EvictOldestGroup();
+    }
+}
+
+u32 EncodeXORPage(u32* dst, const u32* page, const u32* keypage)
+{
+    // sequence of runs: u16 zero words to skip, u16 word count, XORed words
+    u32 outpos = 0;
+    u32 i = 0;
+    while (i < PAGE_WORDS)
+    {
+        u32 skip = 0;
+        while (i < PAGE_WORDS && page[i] == keypage[i])
+        {
+            skip++;
+            i++;
+        }
+        if (i == PAGE_WORDS) break;
+
+        u32 runstart = outpos++;
+        u32 count = 0;
+        while (i < PAGE_WORDS && page[i] != keypage[i])
+        {
+            dst[outpos++] = page[i] ^ keypage[i];
+            count++;
+            i++;
+        }
+
+        dst[runstart] = skip | (count << 16);
+
+        if (outpos >= PAGE_WORDS)
+            return PAGE_RAW;
+    }
+
+    return outpos * 4;
+}
+
+void DecodeXORPage(u32* page, const u32* src, u32 size)
+{
+    u32 words = size / 4;
+    u32 inpos = 0;
+    u32 i = 0;
+    while (inpos < words)
+    {
+        u32 run = src[inpos++];
+        i += run & 0xFFFF;
+
+        u32 count = run >> 16;
+        for (u32 j = 0; j < count; j++)
+            page[i++] ^= src[inpos++];
+    }
+}
+
+// encodes the captured state and the screenshot into the staging buffer,
+// returns the record size. length is padded to whole pages, statelength isn't.
+u32 EncodeSnapshot(u32 length, u32 statelength, const u8* screenshot, Snapshot* keyframe)
+{
+    u32 numpages = NumPagesForLength(length);
+
+    SnapshotHeader* header = (SnapshotHeader*)StagingBuffer;
+    u64* hashes = (u64*)&StagingBuffer[sizeof(SnapshotHeader)];
+    PageEntry* pages = (PageEntry*)&hashes[numpages];
+    u32 datapos = sizeof(SnapshotHeader) + numpages * (sizeof(u64) + sizeof(PageEntry));
+
+    header->StateLength = length;
+    header->NumPages = numpages;
+    header->Keyframe = keyframe ? 0 : 1;
+
+    StagedPages.clear();
+
+    u64* keyhashes = keyframe ? GetHashes(keyframe->Offset) : nullptr;
+    PageEntry* keypages = keyframe ? GetPages(keyframe->Offset) : nullptr;
+    u64* prevhashes = keyframe ? GetHashes(Snapshots.front().Offset) : nullptr;
+    PageEntry* prevpages = keyframe ? GetPages(Snapshots.front().Offset) : nullptr;
+
+    bool skipunchanged = keyframe && CaptureMatchesNewest;
+
+    for (u32 i = 0; i < numpages; i++)
+    {
+        // the padding after the state is cleared every time
+        if (skipunchanged && (i + 1) * PAGE_SIZE <= statelength && !CaptureContext.PageChanged(i))
+        {
+            hashes[i] = prevhashes[i];
+            pages[i] = prevpages[i];
+            continue;
+        }
+
+        u8* page = &CaptureBuffer[i * PAGE_SIZE];
+        hashes[i] = XXH3_64bits(page, PAGE_SIZE);
+
+        if (keyframe)
+        {
+            // equal hashes only make it likely that the pages are the same
+            u8* keypage = &Arena[keypages[i].Offset];
+            if (hashes[i] == keyhashes[i] && !memcmp(page, keypage, PAGE_SIZE))
+            {
+                pages[i].Offset = 0;
+                pages[i].Size = PAGE_SAME_AS_KEYFRAME;
+                continue;
+            }
+
+            u32* encoded = (u32*)&StagingBuffer[datapos];
+            u32 size = EncodeXORPage(encoded, (u32*)page, (u32*)keypage);
+            if (hashes[i] == prevhashes[i] && prevpages[i].Size != PAGE_SAME_AS_KEYFRAME)
+            {
+                // compared in the form the previous state stores it in
+                u8* prevdata = &Arena[prevpages[i].Offset];
+                bool same = prevpages[i].Size == PAGE_RAW
+                    ? !memcmp(page, prevdata, PAGE_SIZE)
+                    : size == prevpages[i].Size && !memcmp(encoded, prevdata, size);
+                if (same)
+                {
+                    pages[i] = prevpages[i];
+                    continue;
+                }
+            }
+
+            if (size != PAGE_RAW)
+            {
+                pages[i].Offset = datapos;
+                pages[i].Size = size;
+                StagedPages.push_back(i);
+                datapos += size;
+                continue;
+            }
+        }
+
+        memcpy(&StagingBuffer[datapos], page, PAGE_SIZE);
+        pages[i].Offset = datapos;
+        pages[i].Size = PAGE_RAW;
+        StagedPages.push_back(i);
+        datapos += PAGE_SIZE;
+    }
+
+    memcpy(&StagingBuffer[datapos], screenshot, ScreenshotBufferSize);
+    datapos += ScreenshotBufferSize;
+
+    header->Size = datapos;
+    return datapos;
 }
 
-void DeleteRewindSaveState(RewindSaveState state)
+void RelocateSnapshot(u32 offset)
 {
-    delete state.buffer;
-    delete state.screenshot;
+    // pages stored in the record itself were encoded relative to its start
+    SnapshotHeader* header = (SnapshotHeader*)StagingBuffer;
+    PageEntry* pages = (PageEntry*)&StagingBuffer[sizeof(SnapshotHeader) + header->NumPages * sizeof(u64)];
+
+    for (u32 i : StagedPages)
+        pages[i].Offset += offset;
 }
 
-void SetRewindBufferSizes(u32 savestateSizeBytes, u32 screenshotSizeBytes)
+void SetRewindBufferSizes(u32 savestateSizeBytes, u32 screenshotSizeBytes, u32 arenaSizeBytes)
 {
+    if (savestateSizeBytes != SavestateBufferSize || screenshotSizeBytes != ScreenshotBufferSize
+        || arenaSizeBytes != ArenaSize)
+    {
+        Reset();
+
+        delete[] Arena;
+        delete[] CaptureBuffer;
+        delete[] StagingBuffer;
+
+        // the capture buffer is rounded to whole pages, plus room for the end marker.
+        // the XOR encoder can write past a page before it gives up on it
+        u32 numpages = NumPagesForLength(savestateSizeBytes + 16);
+        StagingBufferSize = sizeof(SnapshotHeader) + numpages * (sizeof(u64) + sizeof(PageEntry) + PAGE_SIZE)
+            + PAGE_SIZE + screenshotSizeBytes;
+
+        Arena = new u8[arenaSizeBytes];
+        CaptureBuffer = new u8[numpages * PAGE_SIZE];
+        CaptureContext.Invalidate();
+        StagingBuffer = new u8[StagingBufferSize];
+    }
+
     SavestateBufferSize = savestateSizeBytes;
     ScreenshotBufferSize = screenshotSizeBytes;
+    ArenaSize = arenaSizeBytes;
 }
 
 bool ShouldCaptureState(int currentFrame)
@@ -67,65 +382,186 @@ bool ShouldCaptureState(int currentFrame)
     return currentFrame % (Config::RewindCaptureSpacingSeconds * FRAMES_PER_SECOND) == 0;
 }
 
-RewindSaveState GetNextRewindSaveState(int currentFrame)
+u8* GetCaptureBuffer()
+{
+    return CaptureBuffer;
+}
+
+IncrementalSavestateContext* GetCaptureContext()
+{
+    return &CaptureContext;
+}
+
+bool CommitRewindState(int currentFrame, u32 savestateLength, const u8* screenshot)
 {
-    RewindSaveState nextRewindSaveState;
-    if (RewindWindow.size() < RewindWindowSize())
+    if (!Arena || savestateLength > SavestateBufferSize)
+        return false;
+
+    // clear the end of the last page, this also serves as the end marker for
+    // section lookups when the state is restored
+    u32 numpages = NumPagesForLength(savestateLength + 16);
+    memset(&CaptureBuffer[savestateLength], 0, numpages * PAGE_SIZE - savestateLength);
+    u32 length = numpages * PAGE_SIZE;
+
+    Snapshot* keyframe = nullptr;
+    if (!Snapshots.empty() && CapturesSinceKeyframe < KEYFRAME_INTERVAL)
+    {
+        keyframe = GetKeyframe(Snapshots.front().Group);
+        if (keyframe && GetHeader(keyframe->Offset)->NumPages != numpages)
+            keyframe = nullptr;
+    }
+
+    u32 size = EncodeSnapshot(length, savestateLength, screenshot, keyframe);
+    u32 offset;
+    if (!AllocateRecord(size, &offset, keyframe != nullptr, keyframe ? keyframe->Group : 0))
     {
-        // Windows is not yet full. Create new savestate
-        RewindSaveState newRewindSaveState = CreateRewindSaveState(currentFrame);
-        RewindWindow.push_front(newRewindSaveState);
-        nextRewindSaveState = newRewindSaveState;
+        if (!keyframe)
+            return false;
+
+        // the group this state depends on would have to go, start a new one
+        while (!Snapshots.empty())
+            EvictOldestGroup();
+
+        keyframe = nullptr;
+        size = EncodeSnapshot(length, savestateLength, screenshot, nullptr);
+        if (!AllocateRecord(size, &offset, false, 0))
+            return false;
     }
+
+    RelocateSnapshot(offset);
+    memcpy(&Arena[offset], StagingBuffer, size);
+
+    Snapshot snapshot;
+    snapshot.Offset = offset;
+    snapshot.Size = size;
+    snapshot.Keyframe = keyframe == nullptr;
+    snapshot.Group = keyframe ? keyframe->Group : NextGroup++;
+    snapshot.State = RewindSaveState {
+        .buffer = &Arena[offset],
+        .bufferSize = size,
+        .screenshot = &Arena[offset + size - ScreenshotBufferSize],
+        .screenshotSize = ScreenshotBufferSize,
+        .frame = currentFrame
+    };
+
+    Snapshots.push_front(snapshot);
+
+    CaptureContext.ClearChangedPages();
+    CaptureMatchesNewest = true;
+
+    if (snapshot.Keyframe)
+        CapturesSinceKeyframe = 1;
     else
+        CapturesSinceKeyframe++;
+
+    TrimRewindWindowIfRequired();
+    return true;
+}
+
+u8* RestoreRewindState(RewindSaveState state)
+{
+    Snapshot* snapshot = nullptr;
+    for (Snapshot& s : Snapshots)
+    {
+        if (s.State.frame == state.frame)
+        {
+            snapshot = &s;
+            break;
+        }
+    }
+
+    if (!snapshot)
+        return nullptr;
+
+    Snapshot* keyframe = GetKeyframe(snapshot->Group);
+    if (!keyframe)
+        return nullptr;
+
+    CaptureContext.Invalidate();
+    CaptureMatchesNewest = false;
+
+    SnapshotHeader* header = GetHeader(snapshot->Offset);
+    PageEntry* pages = GetPages(snapshot->Offset);
+    PageEntry* keypages = GetPages(keyframe->Offset);
+
+    for (u32 i = 0; i < header->NumPages; i++)
     {
-        // Window is already full. Reuse the oldest savestate and move it to the front
-        auto oldestState = RewindWindow.back();
-        oldestState.frame = currentFrame;
-        RewindWindow.pop_back();
-        RewindWindow.push_front(oldestState);
-        nextRewindSaveState = oldestState;
+        u8* page = &CaptureBuffer[i * PAGE_SIZE];
+
+        if (pages[i].Size == PAGE_RAW)
+        {
+            memcpy(page, &Arena[pages[i].Offset], PAGE_SIZE);
+            continue;
+        }
+
+        memcpy(page, &Arena[keypages[i].Offset], PAGE_SIZE);
+        if (pages[i].Size != PAGE_SAME_AS_KEYFRAME)
+            DecodeXORPage((u32*)page, (u32*)&Arena[pages[i].Offset], pages[i].Size);
     }
 
-    return nextRewindSaveState;
+    return CaptureBuffer;
 }
 
 std::list<RewindSaveState> GetRewindWindow()
 {
-    return RewindWindow;
+    std::list<RewindSaveState> window;
+
+    int windowSize = RewindWindowSize();
+    for (Snapshot& snapshot : Snapshots)
+    {
+        if (window.size() >= windowSize)
+            break;
+
+        window.push_back(snapshot.State);
+    }
+
+    return window;
 }
 
 void OnRewindFromState(RewindSaveState state)
 {
-    auto iterator = RewindWindow.begin();
-    while ((*iterator).frame > state.frame && iterator != RewindWindow.end())
+    while (!Snapshots.empty() && Snapshots.front().State.frame > state.frame)
     {
-        RewindSaveState lastState = *iterator;
-        DeleteRewindSaveState(lastState);
-        iterator++;
-        RewindWindow.pop_front();
+        Snapshots.pop_front();
+        CaptureMatchesNewest = false;
     }
 }
 
 void TrimRewindWindowIfRequired()
 {
+    // groups can only be dropped as a whole. states that fall out of the window
+    // are hidden until the rest of their group does.
     int windowSize = RewindWindowSize();
-    while (RewindWindow.size() > windowSize)
+    while (!Snapshots.empty())
     {
-        auto lastState = RewindWindow.back();
-        DeleteRewindSaveState(lastState);
-        RewindWindow.pop_back();
+        u32 oldestGroup = Snapshots.back().Group;
+
+        int i = 0;
+        bool inWindow = false;
+        for (Snapshot& snapshot : Snapshots)
+        {
+            if (i++ >= windowSize)
+                break;
+
+            if (snapshot.Group == oldestGroup)
+            {
+                inWindow = true;
+                break;
+            }
+        }
+
+        if (inWindow)
+            break;
+
+        EvictOldestGroup();
     }
 }
 
 void Reset()
 {
-    for (auto state : RewindWindow)
-    {
-        DeleteRewindSaveState(state);
-    }
-
-    RewindWindow.clear();
+    Snapshots.clear();
+    CapturesSinceKeyframe = 0;
+    CaptureMatchesNewest = false;
 }
 
-}
\ No newline at end of file
+}
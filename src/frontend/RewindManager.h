@@ -22,10 +22,14 @@
 #include <list>
 
 #include "../types.h"
+#include "../IncrementalSavestate.h"
 
 namespace RewindManager
 {
 
+// rewind states are stored delta-compressed in a preallocated ring arena.
+// buffer/bufferSize point to the compressed record and screenshot into it, use
+// RestoreRewindState() to get a savestate that can be loaded.
 struct RewindSaveState {
     u8* buffer;
     u32 bufferSize;
@@ -34,9 +38,13 @@ struct RewindSaveState {
     int frame;
 };
 
-extern void SetRewindBufferSizes(u32 savestateSizeBytes, u32 screenshotSizeBytes);
+extern void SetRewindBufferSizes(u32 savestateSizeBytes, u32 screenshotSizeBytes, u32 arenaSizeBytes);
 extern bool ShouldCaptureState(int currentFrame);
-extern RewindSaveState GetNextRewindSaveState(int currentFrame);
+extern u8* GetCaptureBuffer();
+// to be used with an IncrementalSavestate on the capture buffer
+extern IncrementalSavestateContext* GetCaptureContext();
+extern bool CommitRewindState(int currentFrame, u32 savestateLength, const u8* screenshot);
+extern u8* RestoreRewindState(RewindSaveState state);
 extern std::list<RewindSaveState> GetRewindWindow();
 extern void OnRewindFromState(RewindSaveState state);
 extern void TrimRewindWindowIfRequired();
@@ -0,0 +1,43 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+
+namespace Bench
+{
+
+// settings the headless platform layer reports to the core
+extern bool JIT_Enable;
+extern int JIT_MaxBlockSize;
+extern bool JIT_BranchOptimisations;
+extern bool JIT_LiteralOptimisations;
+extern bool JIT_FastMemory;
+extern bool JIT_BackgroundCompile;
+extern int JIT_CodeMemorySize;
+
+extern bool ExternalBIOSEnable;
+extern std::string BIOS9Path;
+extern std::string BIOS7Path;
+extern std::string FirmwarePath;
+
+}
+
+#endif // BENCH_H
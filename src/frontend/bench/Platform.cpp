@@ -0,0 +1,360 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+// headless platform layer for the benchmark runner
+// no saves are written, no networking, no camera
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "Platform.h"
+#include "Bench.h"
+
+
+namespace Bench
+{
+
+bool JIT_Enable = false;
+int JIT_MaxBlockSize = 32;
+bool JIT_BranchOptimisations = true;
+bool JIT_LiteralOptimisations = true;
+bool JIT_FastMemory = true;
+bool JIT_BackgroundCompile = false;
+int JIT_CodeMemorySize = 32;
+
+bool ExternalBIOSEnable = false;
+std::string BIOS9Path;
+std::string BIOS7Path;
+std::string FirmwarePath;
+
+}
+
+
+namespace Platform
+{
+
+struct BenchSemaphore
+{
+    std::mutex Lock;
+    std::condition_variable Cond;
+    int Value;
+};
+
+void Init(int argc, char** argv)
+{
+}
+
+void DeInit()
+{
+}
+
+void StopEmu()
+{
+}
+
+int InstanceID()
+{
+    return 0;
+}
+
+std::string InstanceFileSuffix()
+{
+    return "";
+}
+
+
+int GetConfigInt(ConfigEntry entry)
+{
+    switch (entry)
+    {
+#ifdef JIT_ENABLED
+    case JIT_MaxBlockSize: return Bench::JIT_MaxBlockSize;
+    case JIT_CodeMemorySize: return Bench::JIT_CodeMemorySize;
+#endif
+
+    case Firm_Language: return 1;
+    case Firm_BirthdayMonth: return 1;
+    case Firm_BirthdayDay: return 1;
+    case Firm_Color: return 0;
+
+    case AudioBitrate: return 0;
+
+    default: break;
+    }
+
+    return 0;
+}
+
+bool GetConfigBool(ConfigEntry entry)
+{
+    switch (entry)
+    {
+#ifdef JIT_ENABLED
+    case JIT_Enable: return Bench::JIT_Enable;
+    case JIT_LiteralOptimizations: return Bench::JIT_LiteralOptimisations;
+    case JIT_BranchOptimizations: return Bench::JIT_BranchOptimisations;
+    case JIT_FastMemory: return Bench::JIT_FastMemory;
+    case JIT_BackgroundCompile: return Bench::JIT_BackgroundCompile;
+#endif
+
+    case ExternalBIOSEnable: return Bench::ExternalBIOSEnable;
+
+    default: break;
+    }
+
+    // everything else is off, in particular MAC randomization,
+    // which would make runs non-deterministic
+    return false;
+}
+
+std::string GetConfigString(ConfigEntry entry)
+{
+    switch (entry)
+    {
+    case BIOS9Path: return Bench::BIOS9Path;
+    case BIOS7Path: return Bench::BIOS7Path;
+    case FirmwarePath: return Bench::FirmwarePath;
+
+    case Firm_Username: return "melonDS";
+    case Firm_Message: return "";
+
+    default: break;
+    }
+
+    return "";
+}
+
+bool GetConfigArray(ConfigEntry entry, void* data)
+{
+    return false;
+}
+
+
+FILE* OpenFile(std::string path, std::string mode, bool mustexist)
+{
+    if (mustexist)
+    {
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f) return nullptr;
+        fclose(f);
+    }
+
+    return fopen(path.c_str(), mode.c_str());
+}
+
+FILE* OpenLocalFile(std::string path, std::string mode)
+{
+    return OpenFile(path, mode, mode[0] != 'w');
+}
+
+FILE* OpenDataFile(std::string path)
+{
+    return OpenFile(path, "rb", true);
+}
+
+FILE* OpenInternalFile(std::string path, std::string mode)
+{
+    // keep the benchmark from picking up or leaving behind state files
+    return nullptr;
+}
+
+
+Thread* Thread_Create(std::function<void()> func)
+{
+    return (Thread*) new std::thread(func);
+}
+
+void Thread_Free(Thread* thread)
+{
+    delete (std::thread*) thread;
+}
+
+void Thread_Wait(Thread* thread)
+{
+    ((std::thread*) thread)->join();
+}
+
+Semaphore* Semaphore_Create()
+{
+    BenchSemaphore* sema = new BenchSemaphore;
+    sema->Value = 0;
+    return (Semaphore*) sema;
+}
+
+void Semaphore_Free(Semaphore* sema)
+{
+    delete (BenchSemaphore*) sema;
+}
+
+void Semaphore_Reset(Semaphore* sema)
+{
+    BenchSemaphore* s = (BenchSemaphore*) sema;
+    std::lock_guard<std::mutex> lock(s->Lock);
+    s->Value = 0;
+}
+
+void Semaphore_Wait(Semaphore* sema)
+{
+    BenchSemaphore* s = (BenchSemaphore*) sema;
+    std::unique_lock<std::mutex> lock(s->Lock);
+    s->Cond.wait(lock, [s] { return s->Value > 0; });
+    s->Value--;
+}
+
+void Semaphore_Post(Semaphore* sema, int count)
+{
+    BenchSemaphore* s = (BenchSemaphore*) sema;
+    {
+        std::lock_guard<std::mutex> lock(s->Lock);
+        s->Value += count;
+    }
+    s->Cond.notify_all();
+}
+
+Mutex* Mutex_Create()
+{
+    return (Mutex*) new std::mutex;
+}
+
+void Mutex_Free(Mutex* mutex)
+{
+    delete (std::mutex*) mutex;
+}
+
+void Mutex_Lock(Mutex* mutex)
+{
+    ((std::mutex*) mutex)->lock();
+}
+
+void Mutex_Unlock(Mutex* mutex)
+{
+    ((std::mutex*) mutex)->unlock();
+}
+
+bool Mutex_TryLock(Mutex* mutex)
+{
+    return ((std::mutex*) mutex)->try_lock();
+}
+
+void Sleep(u64 usecs)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(usecs));
+}
+
+
+void WriteNDSSave(const u8* savedata, u32 savelen, u32 writeoffset, u32 writelen)
+{
+}
+
+void WriteGBASave(const u8* savedata, u32 savelen, u32 writeoffset, u32 writelen)
+{
+}
+
+
+bool MP_Init()
+{
+    return false;
+}
+
+void MP_DeInit()
+{
+}
+
+void MP_Begin()
+{
+}
+
+void MP_End()
+{
+}
+
+int MP_SendPacket(u8* data, int len, u64 timestamp)
+{
+    return 0;
+}
+
+int MP_RecvPacket(u8* data, u64* timestamp)
+{
+    return 0;
+}
+
+int MP_SendCmd(u8* data, int len, u64 timestamp)
+{
+    return 0;
+}
+
+int MP_SendReply(u8* data, int len, u64 timestamp, u16 aid)
+{
+    return 0;
+}
+
+int MP_SendAck(u8* data, int len, u64 timestamp)
+{
+    return 0;
+}
+
+int MP_RecvHostPacket(u8* data, u64* timestamp)
+{
+    return 0;
+}
+
+u16 MP_RecvReplies(u8* data, u64 timestamp, u16 aidmask)
+{
+    return 0;
+}
+
+
+bool LAN_Init()
+{
+    return false;
+}
+
+void LAN_DeInit()
+{
+}
+
+int LAN_SendPacket(u8* data, int len)
+{
+    return 0;
+}
+
+int LAN_RecvPacket(u8* data)
+{
+    return 0;
+}
+
+
+void Camera_Start(int num)
+{
+}
+
+void Camera_Stop(int num)
+{
+}
+
+void Camera_CaptureFrame(int num, u32* frame, int width, int height, bool yuv)
+{
+    memset(frame, 0, width * height * (yuv ? 2 : 4));
+}
+
+}
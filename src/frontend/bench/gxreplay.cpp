@@ -0,0 +1,480 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+// 3D engine capture player
+// plays a capture made with melonDS-bench --gx-record through the geometry
+// engine and the software renderer, without running the CPUs or the 2D engines,
+// and reports how long each of them took per frame.
+// the commands are run without any timing, as fast as the geometry engine
+// goes. the 3D hash only depends on the capture, it has to be the same for
+// every build and renderer setting.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "NDS.h"
+#include "GPU.h"
+#include "GPU3D_Capture.h"
+#include "GPU3D_Soft.h"
+#include "MemorySavestate.h"
+
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash/xxhash.h"
+
+
+GPU::RenderSettings rendersettings = {};
+bool scalar3d = false;
+bool checkscalar = false;
+bool perframe = false;
+
+std::vector<u8> Capture;
+u32 CapturePos;
+bool CaptureDamaged;
+
+std::vector<GPU3D::CmdFIFOEntry> PendingCmds;
+u32 PendingPos;
+
+double GeometryTime;
+
+u32 FrameLines[192][256];
+u32 CheckLines[192][256];
+u32 CheckMismatches;
+
+
+void PrintUsage(const char* exe)
+{
+    printf("usage: %s [options] <capture>\n", exe);
+    printf("\n");
+    printf("      --threaded-3d       render 3D on a separate thread\n");
+    printf("      --3d-threads N      number of threads for 3D rendering (implies --threaded-3d)\n");
+    printf("      --scalar-3d         render 3D without the vector span code\n");
+    printf("      --check-scalar      render every frame a second time with the other span code\n");
+    printf("                          (scalar or vector) and report the frames that differ\n");
+    printf("      --per-frame         print the time taken by every frame\n");
+}
+
+bool LoadCapture(const std::string& path)
+{
+    FILE* f = Platform::OpenFile(path, "rb", true);
+    if (!f)
+    {
+        printf("could not open %s\n", path.c_str());
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long filelen = ftell(f);
+    if (filelen <= 0 || filelen > 0x40000000)
+    {
+        printf("could not read %s\n", path.c_str());
+        fclose(f);
+        return false;
+    }
+    Capture.resize(filelen);
+    fseek(f, 0, SEEK_SET);
+    size_t len = fread(Capture.data(), 1, Capture.size(), f);
+    fclose(f);
+
+    if (len != Capture.size())
+    {
+        printf("could not read %s\n", path.c_str());
+        return false;
+    }
+
+    CapturePos = 0;
+    CaptureDamaged = false;
+    return true;
+}
+
+bool ReadData(void* data, u32 len)
+{
+    if (len > Capture.size() - CapturePos)
+    {
+        CaptureDamaged = true;
+        return false;
+    }
+
+    memcpy(data, &Capture[CapturePos], len);
+    CapturePos += len;
+    return true;
+}
+
+u8 Read8()
+{
+    u8 ret = 0;
+    ReadData(&ret, 1);
+    return ret;
+}
+
+u16 Read16()
+{
+    u16 ret = 0;
+    ReadData(&ret, 2);
+    return ret;
+}
+
+u32 Read32()
+{
+    u32 ret = 0;
+    ReadData(&ret, 4);
+    return ret;
+}
+
+// runs the commands until the geometry engine waits for a buffer swap
+void RunPendingCommands()
+{
+    auto start = std::chrono::steady_clock::now();
+    PendingPos += GPU3D::ReplayCommands(PendingCmds.data() + PendingPos, (u32)PendingCmds.size() - PendingPos);
+    auto end = std::chrono::steady_clock::now();
+    GeometryTime += std::chrono::duration<double, std::milli>(end - start).count();
+
+    if (PendingPos == PendingCmds.size())
+    {
+        PendingCmds.clear();
+        PendingPos = 0;
+    }
+}
+
+void MapVRAM(u32 bank, u8 cnt)
+{
+    switch (bank)
+    {
+    case 0:
+    case 1: GPU::MapVRAM_AB(bank, cnt); break;
+    case 2:
+    case 3: GPU::MapVRAM_CD(bank, cnt); break;
+    case 4: GPU::MapVRAM_E(bank, cnt); break;
+    case 5:
+    case 6: GPU::MapVRAM_FG(bank, cnt); break;
+    }
+}
+
+bool WriteVRAM(u32 bank, u32 offset, u32 len)
+{
+    if (bank > 6 || offset > GPU::VRAMMask[bank] || len > GPU::VRAMMask[bank] + 1 - offset)
+        return false;
+
+    if (!ReadData(&GPU::VRAM[bank][offset], len))
+        return false;
+
+    for (u32 addr = offset; addr < offset + len; addr += GPU::VRAMDirtyGranularity)
+        GPU::VRAMDirty[bank][addr / GPU::VRAMDirtyGranularity] = true;
+
+    return true;
+}
+
+// same order as in a real frame, the renderer has until VCount144 to finish
+void DrawFrame(u32 (*lines)[256])
+{
+    GPU3D::VCount215();
+    for (int i = 0; i < 144; i++)
+        memcpy(lines[i], GPU3D::GetLine(i), 256*4);
+    GPU3D::VCount144();
+    for (int i = 144; i < 192; i++)
+        memcpy(lines[i], GPU3D::GetLine(i), 256*4);
+}
+
+// returns the time taken to render, the 3D output is added to the hash
+double RenderFrame(u64& hash)
+{
+    auto start = std::chrono::steady_clock::now();
+    DrawFrame(FrameLines);
+    auto end = std::chrono::steady_clock::now();
+
+    hash = XXH3_64bits_withSeed(FrameLines, sizeof(FrameLines), hash);
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// renders the last frame again with the other span code, both have to give
+// the same output
+void CheckFrame(int frame)
+{
+    auto renderer = static_cast<GPU3D::SoftRenderer*>(GPU3D::CurrentRenderer.get());
+
+    renderer->ScalarSpans = !scalar3d;
+    DrawFrame(CheckLines);
+    renderer->ScalarSpans = scalar3d;
+
+    for (int i = 0; i < 192; i++)
+    {
+        if (memcmp(FrameLines[i], CheckLines[i], 256*4))
+        {
+            printf("frame %d: line %d differs between the scalar and the vector span code\n", frame, i);
+            CheckMismatches++;
+            break;
+        }
+    }
+}
+
+void PrintTimes(const char* name, std::vector<double> times)
+{
+    double total = 0;
+    for (double t : times) total += t;
+    std::sort(times.begin(), times.end());
+
+    int num = (int)times.size();
+    printf("%-18savg %.3f ms, median %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           name,
+           total / num,
+           times[num / 2],
+           times[std::min(num - 1, (num * 99) / 100)],
+           times.back());
+}
+
+int RunCapture(const std::string& path)
+{
+    if (!LoadCapture(path)) return 1;
+
+    u32 magic = Read32();
+    u32 version = Read32();
+    u32 statelen = Read32();
+    if (magic != GPU3D_Capture::Magic || version != GPU3D_Capture::Version ||
+        statelen > Capture.size() - CapturePos)
+    {
+        printf("%s is not a 3D capture this build can play\n", path.c_str());
+        return 1;
+    }
+
+    if (!NDS::Init())
+    {
+        printf("could not initialize the emulator\n");
+        return 1;
+    }
+
+    GPU::InitRenderer(0);
+    static_cast<GPU3D::SoftRenderer*>(GPU3D::CurrentRenderer.get())->ScalarSpans = scalar3d;
+    GPU::SetRenderSettings(0, rendersettings);
+
+    NDS::SetConsoleType(0);
+    NDS::EjectCart();
+    NDS::Reset();
+
+    // the threaded renderer starts with a frame queued, the one shown first
+    // after a reset. it has to be out of the way before the state is replaced
+    for (int i = 0; i < 192; i++)
+        GPU3D::GetLine(i);
+    GPU3D::VCount144();
+
+    {
+        MemorySavestate savestate(&Capture[CapturePos], false);
+        GPU3D::DoSavestate(&savestate);
+    }
+    CapturePos += statelen;
+
+    std::vector<double> geometrytimes;
+    std::vector<double> rendertimes;
+    u64 numcmds = 0;
+    u64 hash = 0;
+
+    GeometryTime = 0;
+    CheckMismatches = 0;
+    PendingCmds.clear();
+    PendingPos = 0;
+
+    while (CapturePos < Capture.size() && !CaptureDamaged)
+    {
+        u8 type = Read8();
+        switch (type)
+        {
+        case GPU3D_Capture::Record_Commands:
+            {
+                u32 num = Read32();
+                if (num > (Capture.size() - CapturePos) / 5)
+                {
+                    CaptureDamaged = true;
+                    break;
+                }
+
+                for (u32 i = 0; i < num; i++)
+                {
+                    GPU3D::CmdFIFOEntry entry;
+                    entry.Command = Read8();
+                    entry.Param = Read32();
+                    PendingCmds.push_back(entry);
+                }
+                numcmds += num;
+                RunPendingCommands();
+            }
+            break;
+
+        case GPU3D_Capture::Record_Write8:
+            {
+                u32 addr = Read32();
+                GPU3D::Write8(addr, Read8());
+            }
+            break;
+        case GPU3D_Capture::Record_Write16:
+            {
+                u32 addr = Read32();
+                GPU3D::Write16(addr, Read16());
+            }
+            break;
+        case GPU3D_Capture::Record_Write32:
+            {
+                u32 addr = Read32();
+                GPU3D::Write32(addr, Read32());
+            }
+            break;
+
+        case GPU3D_Capture::Record_Enable:
+            {
+                bool geometry = Read8();
+                GPU3D::SetEnabled(geometry, Read8());
+            }
+            break;
+
+        case GPU3D_Capture::Record_RenderXPos:
+            GPU3D::SetRenderXPos(Read16());
+            break;
+
+        case GPU3D_Capture::Record_VRAMCNT:
+            {
+                u32 bank = Read8();
+                MapVRAM(bank, Read8());
+            }
+            break;
+
+        case GPU3D_Capture::Record_VRAM:
+            {
+                u32 bank = Read8();
+                u32 offset = Read32();
+                u32 len = Read32();
+                if (!CaptureDamaged && !WriteVRAM(bank, offset, len))
+                    CaptureDamaged = true;
+            }
+            break;
+
+        case GPU3D_Capture::Record_VBlank:
+            {
+                auto start = std::chrono::steady_clock::now();
+                GPU3D::VBlank();
+                auto end = std::chrono::steady_clock::now();
+                GeometryTime += std::chrono::duration<double, std::milli>(end - start).count();
+
+                // whatever waited for the buffer swap can go on now
+                if (!PendingCmds.empty())
+                    RunPendingCommands();
+            }
+            break;
+
+        case GPU3D_Capture::Record_RenderFrame:
+            {
+                double rendertime = RenderFrame(hash);
+                if (checkscalar)
+                    CheckFrame((int)rendertimes.size());
+                if (perframe)
+                    printf("frame %d: geometry %.3f ms, render %.3f ms\n",
+                           (int)rendertimes.size(), GeometryTime, rendertime);
+
+                geometrytimes.push_back(GeometryTime);
+                rendertimes.push_back(rendertime);
+                GeometryTime = 0;
+            }
+            break;
+
+        default:
+            CaptureDamaged = true;
+            break;
+        }
+    }
+
+    if (CaptureDamaged)
+        printf("%s is damaged, stopped at offset %u\n", path.c_str(), CapturePos);
+
+    if (!rendertimes.empty())
+    {
+        double total = 0;
+        for (double t : geometrytimes) total += t;
+        for (double t : rendertimes) total += t;
+
+        printf("capture:          %s\n", path.c_str());
+        printf("3d:               %s, %d thread(s)%s\n",
+               rendersettings.Soft_Threaded ? "threaded" : "unthreaded",
+               rendersettings.Soft_Threaded ? std::max(rendersettings.Soft_ThreadCount, 1) : 0,
+               scalar3d ? ", scalar spans" : "");
+        printf("frames:           %d\n", (int)rendertimes.size());
+        printf("commands:         %llu\n", (unsigned long long)numcmds);
+        printf("fps:              %.2f\n", rendertimes.size() / total * 1000.0);
+        PrintTimes("geometry time:", geometrytimes);
+        PrintTimes("render time:", rendertimes);
+        printf("3d hash:          %016llx\n", (unsigned long long)hash);
+        if (checkscalar)
+            printf("scalar check:     %u frame(s) differ\n", CheckMismatches);
+    }
+    else
+        printf("%s has no frames\n", path.c_str());
+
+    GPU::DeInitRenderer();
+    NDS::DeInit();
+
+    return (CaptureDamaged || rendertimes.empty() || CheckMismatches) ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+    rendersettings.Soft_Threaded = false;
+    rendersettings.Soft_ThreadCount = 1;
+    rendersettings.GL_ScaleFactor = 1;
+    std::string path;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasval = (i+1) < argc;
+
+        if (arg == "--threaded-3d")
+            rendersettings.Soft_Threaded = true;
+        else if (arg == "--3d-threads" && hasval)
+        {
+            rendersettings.Soft_Threaded = true;
+            rendersettings.Soft_ThreadCount = atoi(argv[++i]);
+        }
+        else if (arg == "--scalar-3d")
+            scalar3d = true;
+        else if (arg == "--check-scalar")
+            checkscalar = true;
+        else if (arg == "--per-frame")
+            perframe = true;
+        else if (arg[0] != '-' && path.empty())
+            path = arg;
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (path.empty())
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    Platform::Init(argc, argv);
+    int ret = RunCapture(path);
+    Platform::DeInit();
+
+    return ret;
+}
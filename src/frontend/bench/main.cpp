@@ -0,0 +1,447 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+// headless benchmark runner
+// boots a ROM without any frontend, runs a fixed number of frames as fast as
+// possible and reports timings along with hashes of the video and audio output.
+// no input is ever given, so two runs of the same build on the same ROM
+// produce the same hashes (unless the game reads the RTC, which follows the
+// host clock).
+// when built with ENABLE_PROFILER, the time spent per subsystem is listed too.
+//
+// with --gx-replay, the GX commands sent during the measured frames are kept
+// and run through the geometry engine again once the console is stopped, so
+// that the geometry code can be timed without the CPUs or the renderers.
+// with --gx-record, the same is written to a file along with the textures and
+// the 3D registers, see gxreplay.cpp to play it back with the renderers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+#include "Platform.h"
+#include "NDS.h"
+#include "GPU.h"
+#include "GPU2D_Soft.h"
+#include "GPU3D_Capture.h"
+#include "GPU3D_Soft.h"
+#include "MemorySavestate.h"
+#include "SPU.h"
+#include "Profiler.h"
+#ifdef JIT_ENABLED
+#include "ARM.h"
+#include "ARMJIT.h"
+#endif
+
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash/xxhash.h"
+
+
+#ifdef PROFILER_ENABLED
+void PrintCounter(const char* name, const Profiler::Counter& counter, const Profiler::FrameProfile& totals)
+{
+    if (!counter.Count) return;
+
+    double frames = totals.NumFrames;
+    printf("  %-20s %8.3f ms %6.2f%% %10.0f cycles %8.1f runs\n",
+           name,
+           counter.HostTime / frames / 1000000.0,
+           counter.HostTime * 100.0 / totals.Frame.HostTime,
+           counter.Cycles / frames,
+           counter.Count / frames);
+}
+
+void PrintProfile()
+{
+    Profiler::FrameProfile totals;
+    Profiler::GetTotals(&totals);
+    if (!totals.NumFrames) return;
+
+    printf("per frame:\n");
+    PrintCounter("frame", totals.Frame, totals);
+    for (int i = 0; i < Profiler::Stage_MAX; i++)
+        PrintCounter(Profiler::GetStageName(i), totals.Stages[i], totals);
+    for (int i = 0; i < NDS::Event_MAX; i++)
+    {
+        std::string name = std::string("Event_") + Profiler::GetEventName(i);
+        PrintCounter(name.c_str(), totals.Events[i], totals);
+    }
+}
+#endif
+
+void PrintUsage(const char* exe)
+{
+    printf("usage: %s [options] <rom.nds>\n", exe);
+    printf("\n");
+    printf("  -n, --frames N          number of frames to measure (default: 3600)\n");
+    printf("  -w, --warmup N          number of frames to run before measuring (default: 60)\n");
+#ifdef JIT_ENABLED
+    printf("      --jit               use the JIT recompiler instead of the interpreter\n");
+    printf("      --jit-block-size N  maximum JIT block size (default: 32)\n");
+    printf("      --no-fastmem        disable JIT fast memory\n");
+    printf("      --jit-async         compile JIT blocks on a separate thread\n");
+    printf("      --jit-code-size MB  size of the JIT code memory (default: 32)\n");
+    printf("      --jit-cache PATH    keep the compiled JIT code in PATH across runs\n");
+#endif
+    printf("      --threaded-3d       render 3D on a separate thread\n");
+    printf("      --3d-threads N      number of threads for 3D rendering (implies --threaded-3d)\n");
+    printf("      --scalar-3d         render 3D without the vector span code, the video hash\n");
+    printf("                          has to be the same as without this option\n");
+    printf("      --scalar-2d         composite 2D without the vector code, the video hash\n");
+    printf("                          has to be the same as without this option\n");
+    printf("      --frameskip N       draw only one frame out of every N+1, the video hash only\n");
+    printf("                          covers the frames that are drawn\n");
+    printf("      --gx-replay N       replay the GX commands of the measured frames N times\n");
+    printf("                          through the geometry engine and time it\n");
+    printf("      --gx-record PATH    record the 3D engine input of the measured frames to PATH,\n");
+    printf("                          to be played with melonDS-gxreplay\n");
+    printf("      --bios9 PATH        ARM9 BIOS to use instead of FreeBIOS\n");
+    printf("      --bios7 PATH        ARM7 BIOS to use instead of FreeBIOS\n");
+    printf("      --firmware PATH     firmware to use with the external BIOS\n");
+}
+
+int numframes = 3600;
+int numwarmup = 60;
+GPU::RenderSettings rendersettings = {};
+bool scalar2d = false;
+bool scalar3d = false;
+int frameskip = 0;
+int numgxreplays = 0;
+std::string gxrecordpath;
+std::string jitcachepath;
+
+// the geometry engine state is saved with its vertex and polygon RAM
+const u32 GXStateSize = 4 * 1024 * 1024;
+
+void RunGXReplay(const std::vector<GPU3D::CmdFIFOEntry>& cmds, u8* state)
+{
+    int numflushes = 0;
+    for (const GPU3D::CmdFIFOEntry& entry : cmds)
+    {
+        if (entry.Command == 0x50) numflushes++;
+    }
+
+    // the console might have turned the 3D engine off by now
+    GPU3D::SetEnabled(true, true);
+
+    std::vector<double> passtimes(numgxreplays);
+    for (int i = 0; i < numgxreplays; i++)
+    {
+        // every pass starts from the state the commands were captured from
+        MemorySavestate savestate(state, false);
+        GPU3D::DoSavestate(&savestate);
+
+        auto start = std::chrono::steady_clock::now();
+        for (u32 pos = 0; pos < cmds.size();)
+        {
+            pos += GPU3D::ReplayCommands(&cmds[pos], (u32)cmds.size() - pos);
+            GPU3D::VBlank();
+        }
+        auto end = std::chrono::steady_clock::now();
+        passtimes[i] = std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    std::sort(passtimes.begin(), passtimes.end());
+    double best = passtimes.front();
+
+    printf("gx replay:        %zu commands, %d buffer swaps, %d passes\n", cmds.size(), numflushes, numgxreplays);
+    printf("gx replay time:   min %.3f ms, median %.3f ms per pass, %.1f ns per command\n",
+           best, passtimes[numgxreplays / 2], cmds.empty() ? 0.0 : best * 1000000.0 / cmds.size());
+}
+
+// undoes the setup of RunBenchmark once the emulator was started
+void StopEmulator()
+{
+    NDS::Stop();
+#ifdef JIT_ENABLED
+    if (Bench::JIT_Enable)
+        ARMJIT::SetBlockCacheFile("");
+#endif
+    GPU::DeInitRenderer();
+}
+
+// returns the emulated frames per second, or a negative value on error
+double RunBenchmark(const std::string& rompath)
+{
+    FILE* f = Platform::OpenFile(rompath, "rb", true);
+    if (!f)
+    {
+        printf("could not open %s\n", rompath.c_str());
+        return -1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    if (len <= 0 || len > 0x40000000)
+    {
+        printf("could not read %s\n", rompath.c_str());
+        fclose(f);
+        return -1;
+    }
+    u32 romlen = (u32)len;
+
+    if (!NDS::Init())
+    {
+        printf("could not initialize the emulator\n");
+        fclose(f);
+        return -1;
+    }
+
+    GPU::InitRenderer(0);
+    static_cast<GPU2D::SoftRenderer*>(GPU::GPU2D_Renderer.get())->ScalarCompositing = scalar2d;
+    static_cast<GPU3D::SoftRenderer*>(GPU3D::CurrentRenderer.get())->ScalarSpans = scalar3d;
+    GPU::SetRenderSettings(0, rendersettings);
+    GPU::SetFrameSkip(frameskip);
+
+    NDS::SetConsoleType(0);
+    NDS::EjectCart();
+    NDS::Reset();
+
+    bool loaded = NDS::LoadCart(f, romlen, nullptr, 0);
+    fclose(f);
+    if (!loaded)
+    {
+        printf("could not load %s\n", rompath.c_str());
+        GPU::DeInitRenderer();
+        NDS::DeInit();
+        return -1;
+    }
+
+#ifdef JIT_ENABLED
+    if (Bench::JIT_Enable)
+        ARMJIT::SetBlockCacheFile(jitcachepath);
+#endif
+
+    NDS::SetupDirectBoot(rompath.substr(rompath.find_last_of("/\\") + 1));
+    NDS::Start();
+
+    s16 audiobuf[1024 * 2];
+
+    for (int i = 0; i < numwarmup; i++)
+    {
+        NDS::RunFrame();
+        // only reading makes room for more samples
+        while (SPU::ReadOutput(audiobuf, 1024) > 0);
+    }
+
+#ifdef PROFILER_ENABLED
+    Profiler::ResetTotals();
+#endif
+
+    std::vector<GPU3D::CmdFIFOEntry> gxcmds;
+    std::unique_ptr<u8[]> gxstate;
+    if (numgxreplays > 0)
+    {
+        gxstate = std::make_unique<u8[]>(GXStateSize);
+        MemorySavestate savestate(gxstate.get(), true);
+        GPU3D::DoSavestate(&savestate);
+        GPU3D::SetCmdCapture(&gxcmds);
+    }
+    else if (!gxrecordpath.empty())
+    {
+        if (!GPU3D_Capture::Start(gxrecordpath))
+        {
+            StopEmulator();
+            NDS::DeInit();
+            return -1;
+        }
+    }
+
+    std::vector<double> frametimes(numframes);
+    u64 videohash = 0;
+    u64 audiohash = 0;
+    u64 lasthash = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < numframes; i++)
+    {
+        auto framestart = std::chrono::steady_clock::now();
+        NDS::RunFrame();
+        auto frameend = std::chrono::steady_clock::now();
+        frametimes[i] = std::chrono::duration<double, std::milli>(frameend - framestart).count();
+
+        // hashing isn't part of the measured frame time
+        if (!GPU::SkipFrame)
+        {
+            int frontbuf = GPU::FrontBuffer;
+            videohash = XXH3_64bits_withSeed(GPU::Framebuffer[frontbuf][0], 256*192*4, videohash);
+            videohash = XXH3_64bits_withSeed(GPU::Framebuffer[frontbuf][1], 256*192*4, videohash);
+
+            lasthash = XXH3_64bits(GPU::Framebuffer[frontbuf][0], 256*192*4);
+            lasthash = XXH3_64bits_withSeed(GPU::Framebuffer[frontbuf][1], 256*192*4, lasthash);
+        }
+
+        for (;;)
+        {
+            int num = SPU::ReadOutput(audiobuf, 1024);
+            if (num <= 0) break;
+            audiohash = XXH3_64bits_withSeed(audiobuf, num * 2 * sizeof(s16), audiohash);
+        }
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    double total = std::chrono::duration<double>(end - start).count();
+
+    GPU3D::SetCmdCapture(nullptr);
+    GPU3D_Capture::Stop();
+
+    double emutime = 0;
+    for (double t : frametimes) emutime += t;
+    std::sort(frametimes.begin(), frametimes.end());
+
+    printf("rom:              %s\n", rompath.c_str());
+#ifdef JIT_ENABLED
+    printf("cpu:              %s\n", Bench::JIT_Enable ? "jit" : "interpreter");
+#else
+    printf("cpu:              interpreter\n");
+#endif
+    printf("3d:               %s, %d thread(s)\n",
+           rendersettings.Soft_Threaded ? "threaded" : "unthreaded",
+           rendersettings.Soft_Threaded ? std::max(rendersettings.Soft_ThreadCount, 1) : 0);
+    printf("frames:           %d (+%d warmup)\n", numframes, numwarmup);
+    if (frameskip > 0)
+        printf("frameskip:        %d, one frame drawn out of %d\n", frameskip, frameskip + 1);
+    printf("time:             %.3f s\n", total);
+    printf("fps:              %.2f\n", numframes / emutime * 1000.0);
+    printf("frame time:       avg %.3f ms, min %.3f ms, median %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           emutime / numframes,
+           frametimes.front(),
+           frametimes[numframes / 2],
+           frametimes[std::min(numframes - 1, (numframes * 99) / 100)],
+           frametimes.back());
+    printf("last frame hash:  %016llx\n", (unsigned long long)lasthash);
+    printf("video hash:       %016llx\n", (unsigned long long)videohash);
+    printf("audio hash:       %016llx\n", (unsigned long long)audiohash);
+#ifdef JIT_ENABLED
+    if (Bench::JIT_Enable)
+        printf("jit link hits:    ARM9 %llu, ARM7 %llu\n",
+               (unsigned long long)NDS::ARM9->LinkHits, (unsigned long long)NDS::ARM7->LinkHits);
+    if (Bench::JIT_Enable)
+        printf("jit slow memory:  ARM9 %llu, ARM7 %llu accesses\n",
+               (unsigned long long)NDS::ARM9->SlowMemAccesses, (unsigned long long)NDS::ARM7->SlowMemAccesses);
+    if (Bench::JIT_Enable)
+    {
+        ARMJIT::CodeMemoryStats stats;
+        ARMJIT::GetCodeMemoryStats(stats);
+        printf("jit code memory:  %u/%u KB used in %u segments, %u evicted (%u blocks)\n",
+               stats.Used / 1024, stats.Size / 1024, stats.NumSegments, stats.SegmentsEvicted, stats.BlocksEvicted);
+    }
+#endif
+#ifdef PROFILER_ENABLED
+    PrintProfile();
+#endif
+
+    StopEmulator();
+
+    // the renderer is gone by now, so nothing reads the polygons while they're replaced
+    if (numgxreplays > 0)
+        RunGXReplay(gxcmds, gxstate.get());
+
+    NDS::DeInit();
+
+    return numframes / emutime * 1000.0;
+}
+
+int main(int argc, char** argv)
+{
+    rendersettings.Soft_Threaded = false;
+    rendersettings.Soft_ThreadCount = 1;
+    rendersettings.GL_ScaleFactor = 1;
+    std::string rompath;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasval = (i+1) < argc;
+
+        if ((arg == "-n" || arg == "--frames") && hasval)
+            numframes = atoi(argv[++i]);
+        else if ((arg == "-w" || arg == "--warmup") && hasval)
+            numwarmup = atoi(argv[++i]);
+#ifdef JIT_ENABLED
+        else if (arg == "--jit")
+            Bench::JIT_Enable = true;
+        else if (arg == "--jit-block-size" && hasval)
+            Bench::JIT_MaxBlockSize = std::clamp(atoi(argv[++i]), 1, 32);
+        else if (arg == "--no-fastmem")
+            Bench::JIT_FastMemory = false;
+        else if (arg == "--jit-async")
+            Bench::JIT_BackgroundCompile = true;
+        else if (arg == "--jit-code-size" && hasval)
+            Bench::JIT_CodeMemorySize = atoi(argv[++i]);
+        else if (arg == "--jit-cache" && hasval)
+            jitcachepath = argv[++i];
+#endif
+        else if (arg == "--threaded-3d")
+            rendersettings.Soft_Threaded = true;
+        else if (arg == "--3d-threads" && hasval)
+        {
+            rendersettings.Soft_Threaded = true;
+            rendersettings.Soft_ThreadCount = atoi(argv[++i]);
+        }
+        else if (arg == "--scalar-2d")
+            scalar2d = true;
+        else if (arg == "--scalar-3d")
+            scalar3d = true;
+        else if (arg == "--frameskip" && hasval)
+            frameskip = atoi(argv[++i]);
+        else if (arg == "--gx-replay" && hasval)
+            numgxreplays = atoi(argv[++i]);
+        else if (arg == "--gx-record" && hasval)
+            gxrecordpath = argv[++i];
+        else if (arg == "--bios9" && hasval)
+            Bench::BIOS9Path = argv[++i];
+        else if (arg == "--bios7" && hasval)
+            Bench::BIOS7Path = argv[++i];
+        else if (arg == "--firmware" && hasval)
+            Bench::FirmwarePath = argv[++i];
+        else if (arg[0] != '-' && rompath.empty())
+            rompath = arg;
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // both use the command capture
+    bool gxrecord = !gxrecordpath.empty();
+    if (rompath.empty() || numframes < 1 || numwarmup < 0 || (gxrecord && numgxreplays > 0))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    Bench::ExternalBIOSEnable = !Bench::BIOS9Path.empty() && !Bench::BIOS7Path.empty() && !Bench::FirmwarePath.empty();
+
+    Platform::Init(argc, argv);
+
+    int ret = RunBenchmark(rompath) < 0 ? 1 : 0;
+
+    Platform::DeInit();
+
+    return ret;
+}
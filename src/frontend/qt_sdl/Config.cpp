@@ -54,6 +54,7 @@ int ScreenVSyncInterval;
 
 int _3DRenderer;
 bool Threaded3D;
+int Threads3D;
 
 int GL_ScaleFactor;
 bool GL_BetterPolygons;
@@ -71,6 +72,9 @@ int JIT_MaxBlockSize = 32;
 bool JIT_BranchOptimisations = true;
 bool JIT_LiteralOptimisations = true;
 bool JIT_FastMemory = true;
+bool JIT_BackgroundCompile = false;
+int JIT_CodeMemorySize = 32;
+bool JIT_PersistentCache = false;
 #endif
 
 bool ExternalBIOSEnable;
@@ -220,6 +224,7 @@ ConfigEntry ConfigFile[] =
 
     {"3DRenderer", 0, &_3DRenderer, 0, false},
     {"Threaded3D", 1, &Threaded3D, true, false},
+    {"Threads3D", 0, &Threads3D, 1, false},
 
     {"GL_ScaleFactor", 0, &GL_ScaleFactor, 1, false},
     {"GL_BetterPolygons", 1, &GL_BetterPolygons, false, false},
@@ -241,6 +246,9 @@ ConfigEntry ConfigFile[] =
     #else
         {"JIT_FastMemory", 1, &JIT_FastMemory, true, false},
     #endif
+    {"JIT_BackgroundCompile", 1, &JIT_BackgroundCompile, false, false},
+    {"JIT_CodeMemorySize", 0, &JIT_CodeMemorySize, 32, false},
+    {"JIT_PersistentCache", 1, &JIT_PersistentCache, false, false},
 #endif
 
     {"ExternalBIOSEnable", 1, &ExternalBIOSEnable, false, false},
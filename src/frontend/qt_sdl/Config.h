@@ -98,6 +98,7 @@ extern int ScreenVSyncInterval;
 
 extern int _3DRenderer;
 extern bool Threaded3D;
+extern int Threads3D;
 
 extern int GL_ScaleFactor;
 extern bool GL_BetterPolygons;
@@ -115,6 +116,9 @@ extern int JIT_MaxBlockSize;
 extern bool JIT_BranchOptimisations;
 extern bool JIT_LiteralOptimisations;
 extern bool JIT_FastMemory;
+extern bool JIT_BackgroundCompile;
+extern int JIT_CodeMemorySize;
+extern bool JIT_PersistentCache;
 #endif
 
 extern bool ExternalBIOSEnable;
@@ -180,6 +180,7 @@ int GetConfigInt(ConfigEntry entry)
     {
 #ifdef JIT_ENABLED
     case JIT_MaxBlockSize: return Config::JIT_MaxBlockSize;
+    case JIT_CodeMemorySize: return Config::JIT_CodeMemorySize;
 #endif
 
     case DLDI_ImageSize: return imgsizes[Config::DLDISize];
@@ -206,6 +207,7 @@ bool GetConfigBool(ConfigEntry entry)
     case JIT_LiteralOptimizations: return Config::JIT_LiteralOptimisations != 0;
     case JIT_BranchOptimizations: return Config::JIT_BranchOptimisations != 0;
     case JIT_FastMemory: return Config::JIT_FastMemory != 0;
+    case JIT_BackgroundCompile: return Config::JIT_BackgroundCompile != 0;
 #endif
 
     case ExternalBIOSEnable: return Config::ExternalBIOSEnable != 0;
@@ -33,6 +33,9 @@
 #include "DSi.h"
 #include "SPI.h"
 #include "DSi_I2C.h"
+#ifdef JIT_ENABLED
+#include "ARMJIT.h"
+#endif
 
 
 namespace ROMManager
@@ -483,7 +486,9 @@ bool LoadROM(QStringList filepath, bool reset)
 {
     if (filepath.empty()) return false;
 
-    u8* filedata;
+    // regular files are mapped by the core, archives have to be extracted
+    FILE* romfile = nullptr;
+    u8* filedata = nullptr;
     u32 filelen;
 
     std::string basepath;
@@ -495,29 +500,17 @@ bool LoadROM(QStringList filepath, bool reset)
         // regular file
 
         std::string filename = filepath.at(0).toStdString();
-        FILE* f = Platform::OpenFile(filename, "rb", true);
-        if (!f) return false;
+        romfile = Platform::OpenFile(filename, "rb", true);
+        if (!romfile) return false;
 
-        fseek(f, 0, SEEK_END);
-        long len = ftell(f);
-        if (len > 0x40000000)
-        {
-            fclose(f);
-            delete[] filedata;
-            return false;
-        }
-
-        fseek(f, 0, SEEK_SET);
-        filedata = new u8[len];
-        size_t nread = fread(filedata, (size_t)len, 1, f);
-        if (nread != 1)
+        fseek(romfile, 0, SEEK_END);
+        long len = ftell(romfile);
+        if (len <= 0 || len > 0x40000000)
         {
-            fclose(f);
-            delete[] filedata;
+            fclose(romfile);
             return false;
         }
 
-        fclose(f);
         filelen = (u32)len;
 
         int pos = LastSep(filename);
@@ -557,6 +550,9 @@ bool LoadROM(QStringList filepath, bool reset)
 
     if (reset)
     {
+#ifdef JIT_ENABLED
+        ARMJIT::SetBlockCacheFile("");
+#endif
         NDS::SetConsoleType(Config::ConsoleType);
         NDS::EjectCart();
         NDS::Reset();
@@ -583,7 +579,15 @@ bool LoadROM(QStringList filepath, bool reset)
         fclose(sav);
     }
 
-    bool res = NDS::LoadCart(filedata, filelen, savedata, savelen);
+    bool res;
+    if (romfile)
+    {
+        res = NDS::LoadCart(romfile, filelen, savedata, savelen);
+        fclose(romfile);
+    }
+    else
+        res = NDS::LoadCart(filedata, filelen, savedata, savelen);
+
     if (res && reset)
     {
         if (Config::DirectBoot || NDS::NeedsDirectBoot())
@@ -597,11 +601,18 @@ bool LoadROM(QStringList filepath, bool reset)
         CartType = 0;
         NDSSave = new SaveManager(savname);
 
+#ifdef JIT_ENABLED
+        if (Config::JIT_Enable && Config::JIT_PersistentCache)
+            ARMJIT::SetBlockCacheFile(GetAssetPath(false, Config::SaveFilePath, ".mljit"));
+        else
+            ARMJIT::SetBlockCacheFile("");
+#endif
+
         LoadCheats();
     }
 
     if (savedata) delete[] savedata;
-    delete[] filedata;
+    if (filedata) delete[] filedata;
     return res;
 }
 
@@ -612,6 +623,9 @@ void EjectCart()
 
     UnloadCheats();
 
+#ifdef JIT_ENABLED
+    ARMJIT::SetBlockCacheFile("");
+#endif
     NDS::EjectCart();
 
     CartType = -1;